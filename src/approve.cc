@@ -17,56 +17,58 @@
 #include "config.h"
 #endif
 // Project
+#include "autoapprove.h"
 #include "fd.h"
+#include "identity.h"
+#include "metrics.h"
+#include "procid.h"
 #include "simproto.pb.h"
 #include "util.h"
 
 // Libraries
 #include "google/protobuf/text_format.h"
+#ifdef HAVE_GOOGLE_PROTOBUF_UTIL_JSON_UTIL_H
+#include "google/protobuf/util/json_util.h"
+#endif
 
 // C++
+#include <algorithm>
+#include <array>
 #include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <csignal>
 #include <cstring>
+#include <ctime>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <unordered_set>
 #include <vector>
 
 // POSIX
 #include <dirent.h>
+#include <getopt.h>
 #include <grp.h>
+#include <poll.h>
 #include <pwd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 namespace Sim {
-[[nodiscard]] FD connect(const std::string& fn)
-{
-    // Create socket.
-    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
-    if (sock == -1) {
-        throw SysError("socket");
-    }
-    Defer defer([&] { ::close(sock); });
-
-    // connect.
-    struct sockaddr_un sa {
-    };
-    sa.sun_family = AF_UNIX;
-    strncpy(static_cast<char*>(sa.sun_path), fn.c_str(), sizeof sa.sun_path);
-    if (::connect(sock, reinterpret_cast<struct sockaddr*>(&sa), sizeof sa)) {
-        throw SysError("connect");
-    }
-
-    FD fd(sock);
-    defer.defuse();
-    return std::move(fd);
-}
-
-
 class ApproveSocket
 {
 public:
@@ -86,7 +88,15 @@ private:
     const std::string fn_;
 };
 
-[[nodiscard]] std::vector<std::string> list_dir(const std::string& d)
+// The sim that created request socket `fn`, if it's in the name.
+[[nodiscard]] bool socket_owner(const std::string& fn, ProcessID* id)
+{
+    const auto dash = fn.find('-');
+    return dash != std::string::npos && parse_process_id(fn.substr(dash + 1), id);
+}
+
+// All sockets in `d`, including those still being set up.
+[[nodiscard]] std::vector<std::string> list_sockets(const std::string& d)
 {
     // TODO(C++17): https://en.cppreference.com/w/cpp/filesystem/directory_iterator
     DIR* dir = opendir(d.c_str());
@@ -104,71 +114,212 @@ private:
             }
             throw SysError("readdir");
         }
-        if (ent->d_type != DT_SOCK) {
-            continue;
+        if (ent->d_type == DT_SOCK) {
+            ret.emplace_back(ent->d_name);
         }
-        ret.emplace_back(ent->d_name);
     }
     return ret;
 }
 
-void handle_request(const simproto::SimConfig& config, const std::string& fn)
+// Request sockets in `d`, skipping those whose sim is gone.
+[[nodiscard]] std::vector<std::string> list_dir(const std::string& d)
 {
-    std::cerr << "Picking up " << fn << std::endl;
-    ApproveSocket sock(config.sock_dir() + "/" + fn);
-
-    simproto::ApproveRequest req;
-    if (!req.ParseFromString(sock.fd().read())) {
-        throw std::runtime_error("failed to parse approve request proto");
+    std::vector<std::string> ret;
+    size_t stale = 0;
+    for (auto& fn : list_sockets(d)) {
+        // Dotfiles are sockets still being set up.
+        if (fn[0] == '.') {
+            continue;
+        }
+        ProcessID owner;
+        if (socket_owner(fn, &owner) && liveness(owner) == Liveness::dead) {
+            stale++;
+            continue;
+        }
+        ret.push_back(std::move(fn));
     }
+    if (stale > 0) {
+        std::cerr << "Skipping " << stale << " request"
+                  << (stale == 1 ? " whose sim is" : "s whose sims are")
+                  << " gone. Remove with `approve --gc` as root.\n";
+    }
+    return ret;
+}
 
-    // Check that other side is part of admin group.
-    {
-        const auto gid = sock.fd().get_gid();
-        const auto uid = sock.fd().get_uid();
-        const auto user = uid_to_username(uid);
-        if (!user_is_member(user, gid, config.admin_group())) {
-            throw std::runtime_error("user <" + user + "> is not part of admin group <" +
-                                     config.admin_group() + ">");
+// Remove request sockets left behind by sims that were killed, and so
+// never cleaned up. Only sockets naming their sim are considered, and
+// before removing one it's checked that nobody is listening on it.
+void collect_garbage(const std::string& d)
+{
+    size_t removed = 0;
+    size_t unknown = 0;
+    for (const auto& fn : list_sockets(d)) {
+        ProcessID owner;
+        if (!socket_owner(fn, &owner)) {
+            // From an older sim, which would die from the connection
+            // attempt, since it's not from an approver.
+            unknown++;
+            continue;
         }
-        std::cerr << "From user <" << user << "> (" << uid << ")\n";
+        if (liveness(owner) != Liveness::dead) {
+            continue;
+        }
+        const auto path = d + "/" + fn;
+        try {
+            (void)connect(path);
+            continue;
+        } catch (const SysError& e) {
+            if (e.err() != ECONNREFUSED) {
+                std::cerr << "Keeping " << fn << ": " << e.what() << std::endl;
+                continue;
+            }
+        } catch (const std::exception& e) {
+            // E.g. a path too long to connect to.
+            std::cerr << "Keeping " << fn << ": " << e.what() << std::endl;
+            continue;
+        }
+        if (unlink(path.c_str()) && errno != ENOENT) {
+            throw SysError("unlink(" + path + ")");
+        }
+        removed++;
     }
+    std::cerr << "Removed " << removed << " stale request sockets";
+    if (unknown > 0) {
+        std::cerr << ", left " << unknown << " from older sims that can't be checked";
+    }
+    std::cerr << "\n";
+}
 
-    // Print request.
-    {
-        std::string s;
-        if (!google::protobuf::TextFormat::PrintToString(req, &s)) {
-            throw std::runtime_error("failed to print ASCII version of proto");
+// Make text from the requester safe to print to a terminal, keeping
+// only newlines and tabs of the control characters.
+[[nodiscard]] std::string sanitize(const std::string& s)
+{
+    std::string ret;
+    ret.reserve(s.size());
+    for (const char ch : s) {
+        const auto u = static_cast<unsigned char>(ch);
+        if (ch == '\n' || ch == '\t' || (u >= 0x20 && u != 0x7f)) {
+            ret.push_back(ch);
+            continue;
         }
-        const std::string bar = "------------------";
-        std::cout << bar << std::endl << s << bar << std::endl;
+        std::array<char, 5> buf{};
+        snprintf(buf.data(), buf.size(), "\\x%02x", u);
+        ret += buf.data();
+    }
+    return ret;
+}
+
+// Time left, as e.g. "4m05s".
+[[nodiscard]] std::string format_left(int64_t seconds)
+{
+    std::array<char, 32> buf{};
+    if (seconds >= 3600) {
+        snprintf(buf.data(),
+                 buf.size(),
+                 "%ldh%02ldm",
+                 static_cast<long>(seconds / 3600),
+                 static_cast<long>(seconds / 60 % 60));
+    } else {
+        snprintf(buf.data(),
+                 buf.size(),
+                 "%ldm%02lds",
+                 static_cast<long>(seconds / 60),
+                 static_cast<long>(seconds % 60));
     }
+    return buf.data();
+}
+
+[[nodiscard]] int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void print_request(const simproto::ApproveRequest& req)
+{
+    // The diff of an edit is printed as is, not as one escaped string.
+    auto copy = req;
+    copy.clear_deadline_us();
+    std::string diff;
+    if (copy.has_edit()) {
+        diff = sanitize(copy.edit().diff());
+        copy.mutable_edit()->clear_diff();
+    }
+    for (auto& edit : *copy.mutable_edits()) {
+        diff += sanitize(edit.diff());
+        edit.clear_diff();
+    }
+    std::string s;
+    if (!google::protobuf::TextFormat::PrintToString(copy, &s)) {
+        throw std::runtime_error("failed to print ASCII version of proto");
+    }
+    const std::string bar = "------------------";
+    std::cout << bar << std::endl << s << bar << std::endl;
+    if (!diff.empty()) {
+        std::cout << diff << bar << std::endl;
+    }
+    if (req.has_deadline_us()) {
+        const int64_t left =
+            static_cast<int64_t>(req.deadline_us()) / 1000000 - now_us() / 1000000;
+        std::cout << "Expires in " << format_left(std::max<int64_t>(left, 0)) << "\n";
+    }
+}
 
-    // Check with user if we should approve.
+// Check with user if we should approve. `await` is called before
+// reading input, and throws to abort asking.
+[[nodiscard]] simproto::ApproveResponse ask(const std::function<void()>& await)
+{
     simproto::ApproveResponse resp;
     for (bool valid = false, prompt = true; !valid;) {
         if (prompt) {
-            std::cout << "Approve? [y]es / [n]o / [c]omment> " << std::flush;
+            std::cout << "Approve? [y]es / [n]o / [r]euse for a while / [c]omment> "
+                      << std::flush;
         }
         prompt = true;
 
+        await();
         const auto answer = getchar();
         switch (tolower(answer)) {
+        case EOF:
+            throw std::runtime_error("EOF on stdin");
         case '\n':
         case '\r':
             prompt = false;
             continue;
         case 'y':
-            resp.set_approved(true);
+        case 'n':
+            resp.set_approved(tolower(answer) == 'y');
             valid = true;
+            // Flush the rest of the line.
+            for (int ch = answer; ch != '\n' && ch != EOF;) {
+                ch = getchar();
+            }
             break;
-        case 'n':
-            resp.set_approved(false);
+        case 'r': {
+            getchar(); // Flush the newline.
+            std::cout << "Also approve identical requests for how many minutes? "
+                      << std::flush;
+            std::string line;
+            await();
+            if (!std::getline(std::cin, line)) {
+                throw std::runtime_error("EOF on stdin");
+            }
+            char* end = nullptr;
+            const auto minutes = strtoul(line.c_str(), &end, 10);
+            if (line.empty() || *end != '\0' || minutes == 0 || minutes > 24 * 60) {
+                std::cout << "Needs to be between 1 and " << 24 * 60 << "\n";
+                continue;
+            }
+            resp.set_approved(true);
+            resp.set_cache_seconds(minutes * 60);
             valid = true;
             break;
+        }
         case 'c':
             getchar(); // Flush the newline.
             std::cout << "Enter comment and press enter:\n";
+            await();
             const auto comment = [] {
                 std::string ret;
                 std::getline(std::cin, ret);
@@ -180,31 +331,1000 @@ void handle_request(const simproto::SimConfig& config, const std::string& fn)
             break;
         }
     }
+    return resp;
+}
+
+// The requester went away before we could answer.
+class Withdrawn : public std::runtime_error
+{
+public:
+    Withdrawn() : std::runtime_error("request withdrawn") {}
+};
+
+[[nodiscard]] bool is_withdrawn(const SysError& e)
+{
+    switch (e.err()) {
+    case ENOENT:
+    case ECONNREFUSED:
+    case ECONNRESET:
+    case EPIPE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Print why a request could not be handled.
+void report_failure(const std::string& id, const std::exception& e)
+{
+    const auto se = dynamic_cast<const SysError*>(&e);
+    if (dynamic_cast<const Withdrawn*>(&e) != nullptr ||
+        (se != nullptr && is_withdrawn(*se))) {
+        std::cerr << "Request " << id << " was withdrawn\n";
+    } else {
+        std::cerr << "Failed to handle " << id << ": " << e.what() << std::endl;
+    }
+}
+
+// A request waiting for a decision.
+struct Pending {
+    std::string id;
+    simproto::ApproveRequest req;
+    uid_t uid = 0;
+    std::string user;
+
+    // Connection to sim, or null if the request came through the broker.
+    std::unique_ptr<ApproveSocket> sock;
+
+    // Set once the request is known to no longer be pending.
+    bool gone = false;
+};
+
+// A sim sends its request once it accepts the connection, which it may
+// put off while it has many other approvers. Give up on it after this
+// long.
+constexpr auto fetch_timeout = std::chrono::seconds(2);
+
+// Connect to the request socket `fn`, and check that the requester is
+// an admin. The request is then sent by sim.
+[[nodiscard]] Pending
+connect_request(const simproto::SimConfig& config, gid_t admin_gid, const std::string& fn)
+{
+    Pending p;
+    p.id = fn;
+    p.sock = std::make_unique<ApproveSocket>(config.sock_dir() + "/" + fn);
+
+    // Check that other side is part of admin group.
+    const auto cred = p.sock->fd().peer_cred();
+    p.uid = cred.uid;
+    p.user = uid_to_username(p.uid);
+    if (!cred.member_of(admin_gid, config.admin_group(), p.user)) {
+        throw std::runtime_error("user <" + p.user + "> is not part of admin group <" +
+                                 config.admin_group() + ">");
+    }
+    return p;
+}
+
+// Read and parse the request that sim sends on connect.
+void read_request(Pending* p)
+{
+    const auto data = p->sock->fd().read();
+    if (data.empty()) {
+        throw Withdrawn();
+    }
+    if (!p->req.ParseFromString(data)) {
+        throw std::runtime_error("failed to parse approve request proto");
+    }
+}
+
+// Connect to all the sockets, and call `got` with each request as soon
+// as it has been read.
+//
+// Requests are read concurrently, so that one slow sim doesn't hold up
+// the rest. Each sim gets fetch_timeout from when it was connected to.
+void fetch_each(const simproto::SimConfig& config,
+                const std::vector<std::string>& fns,
+                const std::function<void(Pending)>& got)
+{
+    struct Conn {
+        Pending p;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    const gid_t admin_gid = group_to_gid(config.admin_group());
+    std::vector<Conn> conns;
+    for (const auto& fn : fns) {
+        try {
+            conns.push_back(Conn{ connect_request(config, admin_gid, fn),
+                                  std::chrono::steady_clock::now() + fetch_timeout });
+        } catch (const std::exception& e) {
+            report_failure(fn, e);
+        }
+    }
+
+    while (!conns.empty()) {
+        const auto now = std::chrono::steady_clock::now();
+        auto first = no_deadline;
+        std::vector<Conn> waiting;
+        for (auto& c : conns) {
+            if (c.deadline <= now) {
+                std::cerr << "Request " << c.p.id
+                          << " wasn't sent in time, skipping\n";
+                continue;
+            }
+            first = std::min(first, c.deadline);
+            waiting.push_back(std::move(c));
+        }
+        conns = std::move(waiting);
+        if (conns.empty()) {
+            break;
+        }
+
+        std::vector<struct pollfd> fds(conns.size());
+        for (size_t c = 0; c < conns.size(); c++) {
+            fds[c].fd = conns[c].p.sock->fd().get();
+            fds[c].events = POLLIN;
+        }
+        if (poll(fds.data(), fds.size(), poll_timeout(first)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("poll");
+        }
+        waiting.clear();
+        for (size_t c = 0; c < conns.size(); c++) {
+            auto& conn = conns[c];
+            if (!fds[c].revents) {
+                waiting.push_back(std::move(conn));
+                continue;
+            }
+            try {
+                read_request(&conn.p);
+            } catch (const std::exception& e) {
+                report_failure(conn.p.id, e);
+                continue;
+            }
+            got(std::move(conn.p));
+        }
+        conns = std::move(waiting);
+    }
+}
+
+// Like fetch_each(), but return all the requests.
+[[nodiscard]] std::vector<Pending> fetch(const simproto::SimConfig& config,
+                                         const std::vector<std::string>& fns)
+{
+    std::vector<Pending> ret;
+    fetch_each(config, fns, [&ret](Pending p) { ret.push_back(std::move(p)); });
+    return ret;
+}
+
+// Connection to the simd broker.
+class BrokerClient
+{
+public:
+    explicit BrokerClient(const std::string& fn);
+
+    // Get pending requests. With `watch`, the broker will then keep
+    // sending new requests, to be picked up with next().
+    [[nodiscard]] std::vector<simproto::BrokerReply> list(bool watch);
+
+    // Read a reply that poll() says is there. Requests are queued, and
+    // withdrawals noted.
+    void pump();
+
+    // Next queued request. There must be one.
+    [[nodiscard]] simproto::BrokerReply next();
+    [[nodiscard]] bool has_queued() const noexcept { return !queue_.empty(); }
+
+    // True if the broker said that request `id`, which it gave us, is
+    // no longer pending.
+    [[nodiscard]] bool is_withdrawn(const std::string& id) const
+    {
+        return withdrawn_.count(id) > 0;
+    }
+
+    // Done with request `id`.
+    void forget(const std::string& id);
+
+    // Send decisions, and wait for the acks. Returns the error for
+    // each decision, empty if it was delivered.
+    [[nodiscard]] std::vector<std::string>
+    decide(const std::vector<simproto::ApproveResponse>& resps);
+
+    [[nodiscard]] int fd() const noexcept { return fd_.get(); }
+
+private:
+    void send(const simproto::BrokerRequest& req);
+    [[nodiscard]] simproto::BrokerReply read();
+    [[nodiscard]] simproto::BrokerReply read_raw();
+
+    FD fd_;
+
+    // Requests pushed while waiting for something else.
+    std::deque<simproto::BrokerReply> queue_;
+
+    // Requests given to us and not yet forgotten, and which of them
+    // have been withdrawn. Withdrawals of other requests are ignored,
+    // so that these don't grow forever.
+    std::unordered_set<std::string> open_;
+    std::unordered_set<std::string> withdrawn_;
+};
+
+BrokerClient::BrokerClient(const std::string& fn) : fd_(connect(fn))
+{
+    // Approvals are trusted by sim, so make sure we're talking to
+    // the real broker.
+    if (fd_.get_uid() != 0) {
+        throw std::runtime_error("broker is not running as root");
+    }
+}
+
+void BrokerClient::send(const simproto::BrokerRequest& req)
+{
+    std::string data;
+    if (!req.SerializeToString(&data)) {
+        throw std::runtime_error("failed to serialize broker request");
+    }
+    fd_.write(data);
+}
+
+simproto::BrokerReply BrokerClient::read()
+{
+    auto reply = read_raw();
+    if (reply.has_error()) {
+        throw std::runtime_error("broker: " + reply.error());
+    }
+    return reply;
+}
+
+simproto::BrokerReply BrokerClient::read_raw()
+{
+    const auto data = fd_.read();
+    if (data.empty()) {
+        throw std::runtime_error("broker closed the connection");
+    }
+    simproto::BrokerReply reply;
+    if (!reply.ParseFromString(data)) {
+        throw std::runtime_error("failed to parse broker reply");
+    }
+    if (reply.has_request()) {
+        open_.insert(reply.request().id());
+    }
+    if (reply.has_withdrawn() && open_.count(reply.withdrawn())) {
+        withdrawn_.insert(reply.withdrawn());
+    }
+    return reply;
+}
+
+std::vector<simproto::BrokerReply> BrokerClient::list(bool watch)
+{
+    simproto::BrokerRequest req;
+    req.set_list(true);
+    req.set_watch(watch);
+    send(req);
+
+    std::vector<simproto::BrokerReply> ret;
+    for (;;) {
+        auto reply = read();
+        if (reply.end()) {
+            return ret;
+        }
+        if (reply.has_request()) {
+            ret.push_back(std::move(reply));
+        }
+    }
+}
 
-    // Send reply.
-    std::string resps;
-    if (!resp.SerializeToString(&resps)) {
-        throw std::runtime_error("failed to serialize approve response proto");
+void BrokerClient::pump()
+{
+    auto reply = read();
+    if (reply.has_request()) {
+        queue_.push_back(std::move(reply));
     }
-    sock.fd().write(resps);
+}
+
+simproto::BrokerReply BrokerClient::next()
+{
+    auto ret = std::move(queue_.front());
+    queue_.pop_front();
+    return ret;
+}
+
+void BrokerClient::forget(const std::string& id)
+{
+    open_.erase(id);
+    withdrawn_.erase(id);
+}
+
+std::vector<std::string>
+BrokerClient::decide(const std::vector<simproto::ApproveResponse>& resps)
+{
+    // Send them all before reading any ack. The broker answers each
+    // one in order.
+    for (const auto& resp : resps) {
+        simproto::BrokerRequest req;
+        *req.mutable_response() = resp;
+        send(req);
+    }
+    std::vector<std::string> ret;
+    while (ret.size() < resps.size()) {
+        auto reply = read_raw();
+        if (reply.has_request()) {
+            queue_.push_back(std::move(reply));
+            continue;
+        }
+        if (reply.has_withdrawn()) {
+            continue;
+        }
+        ret.push_back(reply.error());
+    }
+    return ret;
+}
+
+// A request from the broker. The broker has checked that the requester
+// is an admin.
+[[nodiscard]] Pending from_broker(simproto::BrokerReply reply)
+{
+    Pending p;
+    p.id = reply.request().id();
+    p.uid = reply.uid();
+    p.user = reply.user();
+    p.req = std::move(*reply.mutable_request());
+    return p;
+}
+
+// Send the same decision for all of `batch`. All the sims are written
+// to before waiting for the broker to ack any of its requests.
+void respond(const std::vector<Pending*>& batch,
+             const simproto::ApproveResponse& decision,
+             BrokerClient* broker)
+{
+    std::vector<simproto::ApproveResponse> brokered;
+    std::vector<const Pending*> brokered_ps;
+    for (const auto p : batch) {
+        if (p->gone) {
+            report_failure(p->id, Withdrawn());
+            continue;
+        }
+        auto resp = decision;
+        resp.set_id(p->req.id());
+        if (!p->sock) {
+            brokered.push_back(std::move(resp));
+            brokered_ps.push_back(p);
+            continue;
+        }
+        std::string data;
+        if (!resp.SerializeToString(&data)) {
+            throw std::runtime_error("failed to serialize approve response proto");
+        }
+        try {
+            p->sock->fd().set_deadline(std::chrono::steady_clock::now() + fetch_timeout);
+            p->sock->fd().write(data);
+        } catch (const std::exception& e) {
+            report_failure(p->id, e);
+        }
+    }
+    if (brokered.empty()) {
+        return;
+    }
+    try {
+        const auto errs = broker->decide(brokered);
+        for (size_t c = 0; c < errs.size(); c++) {
+            if (!errs[c].empty()) {
+                std::cerr << "Failed to handle " << brokered_ps[c]->id
+                          << ": broker: " << errs[c] << std::endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to send decisions to broker: " << e.what() << std::endl;
+    }
+}
+
+// Wait for input on stdin, watching the requests of `batch`. Throws
+// Withdrawn once none of them is pending: their sims have hung up,
+// the broker says they're gone, or their deadlines have passed.
+void await_input(const std::vector<Pending*>& batch, BrokerClient* broker)
+{
+    for (;;) {
+        std::vector<struct pollfd> fds(2);
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd = -1;
+        fds[1].events = POLLIN;
+        std::vector<Pending*> socks;
+
+        // The last deadline of the live requests, if they all have one.
+        const auto now = now_us();
+        int64_t last_us = 0;
+        bool forever = false;
+        bool live = false;
+        for (const auto p : batch) {
+            if (!p->sock && broker != nullptr && broker->is_withdrawn(p->id)) {
+                p->gone = true;
+            }
+            if (p->req.has_deadline_us() &&
+                static_cast<int64_t>(p->req.deadline_us()) <= now) {
+                p->gone = true;
+            }
+            if (p->gone) {
+                continue;
+            }
+            live = true;
+            if (p->req.has_deadline_us()) {
+                last_us = std::max<int64_t>(last_us, p->req.deadline_us());
+            } else {
+                forever = true;
+            }
+            if (p->sock) {
+                // sim sends nothing more, so this is it hanging up.
+                struct pollfd pfd {
+                };
+                pfd.fd = p->sock->fd().get();
+                pfd.events = POLLIN;
+                fds.push_back(pfd);
+                socks.push_back(p);
+            } else if (broker != nullptr) {
+                fds[1].fd = broker->fd();
+            }
+        }
+        if (!live) {
+            throw Withdrawn();
+        }
+        const auto deadline =
+            forever ? no_deadline
+                    : std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(last_us - now);
+        if (poll(fds.data(), fds.size(), poll_timeout(deadline)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("poll");
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        if (fds[1].revents) {
+            broker->pump();
+        }
+        for (size_t c = 0; c < socks.size(); c++) {
+            if (fds[c + 2].revents) {
+                socks[c]->gone = true;
+            }
+        }
+    }
+}
+
+// Print a group of identical requests.
+void print_group(const std::vector<Pending*>& group)
+{
+    const auto& first = *group.front();
+    if (group.size() == 1) {
+        std::cerr << "Picking up " << first.id << std::endl;
+        std::cerr << "From user <" << first.user << "> (" << first.uid << ")\n";
+        print_request(first.req);
+        return;
+    }
+    std::cerr << "Picking up " << group.size() << " identical requests:";
+    for (const auto p : group) {
+        std::cerr << " " << p->id;
+    }
+    std::cerr << "\nFrom user <" << first.user << "> (" << first.uid << ")\n";
+    auto req = first.req;
+    req.clear_id();
+    print_request(req);
+}
+
+// Ask which of `n` groups to decide on. Returns nothing on quit.
+[[nodiscard]] std::vector<size_t> select_groups(size_t n)
+{
+    for (;;) {
+        std::cout << "Select requests (e.g. 1,3-4), [a]ll, or [q]uit> " << std::flush;
+        std::string line;
+        if (!std::getline(std::cin, line) || line == "q") {
+            return {};
+        }
+        std::vector<size_t> ret;
+        if (line == "a") {
+            for (size_t c = 0; c < n; c++) {
+                ret.push_back(c);
+            }
+            return ret;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream ss(line);
+        bool valid = true;
+        for (std::string tok; ss >> tok;) {
+            char* end = nullptr;
+            const size_t first = strtoul(tok.c_str(), &end, 10);
+            size_t last = first;
+            if (*end == '-') {
+                last = strtoul(end + 1, &end, 10);
+            }
+            if (*end != '\0' || first < 1 || last < first || last > n) {
+                valid = false;
+                break;
+            }
+            for (size_t c = first; c <= last; c++) {
+                ret.push_back(c - 1);
+            }
+        }
+        if (!valid || ret.empty()) {
+            std::cout << "Invalid selection\n";
+            continue;
+        }
+        std::sort(ret.begin(), ret.end());
+        ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+        return ret;
+    }
+}
+
+// Ask for and send decisions for all of `pending`.
+//
+// Identical requests (e.g. from a rollout) are grouped, and each
+// group is decided with a single answer. With more than one group the
+// approver selects which groups the next answer applies to.
+void decide_all(std::vector<Pending> pending, BrokerClient* broker)
+{
+    std::vector<std::vector<Pending*>> groups;
+    {
+        std::map<std::string, size_t> index;
+        for (auto& p : pending) {
+            // Requests sent at different times have different
+            // deadlines, but are still the same request.
+            auto req = p.req;
+            req.clear_id();
+            req.clear_deadline_us();
+            std::string key;
+            if (!google::protobuf::TextFormat::PrintToString(req, &key)) {
+                throw std::runtime_error("failed to print ASCII version of proto");
+            }
+            key = std::to_string(p.uid) + "\n" + key;
+            const auto found = index.find(key);
+            if (found != index.end()) {
+                groups[found->second].push_back(&p);
+                continue;
+            }
+            index[key] = groups.size();
+            groups.push_back({ &p });
+        }
+    }
+
+    while (!groups.empty()) {
+        std::vector<size_t> selected{ 0 };
+        if (groups.size() == 1) {
+            print_group(groups[0]);
+        } else {
+            for (size_t c = 0; c < groups.size(); c++) {
+                std::cerr << "[" << c + 1 << "] ";
+                print_group(groups[c]);
+            }
+            selected = select_groups(groups.size());
+            if (selected.empty()) {
+                return;
+            }
+        }
+        std::vector<Pending*> batch;
+        for (const auto n : selected) {
+            batch.insert(batch.end(), groups[n].begin(), groups[n].end());
+        }
+        try {
+            const auto resp = ask([&batch, broker] { await_input(batch, broker); });
+            respond(batch, resp, broker);
+        } catch (const Withdrawn& e) {
+            std::cout << "\n";
+            for (const auto p : batch) {
+                report_failure(p->id, e);
+            }
+        }
+        for (const auto p : batch) {
+            if (!p->sock && broker != nullptr) {
+                broker->forget(p->id);
+            }
+        }
+        for (auto n = selected.rbegin(); n != selected.rend(); ++n) {
+            groups.erase(groups.begin() + *n);
+        }
+    }
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+// Start watching sock_dir for new requests. Returns false if there is
+// no sock_dir, which with a broker is fine.
+[[nodiscard]] bool
+add_watch(int ino, const simproto::SimConfig& config, const BrokerClient* broker)
+{
+    if (inotify_add_watch(ino, config.sock_dir().c_str(), IN_CREATE | IN_MOVED_TO) !=
+        -1) {
+        return true;
+    }
+    // With a broker, the directory only exists once some sim has
+    // fallen back to it.
+    if (errno != ENOENT || broker == nullptr) {
+        throw SysError("inotify_add_watch(" + config.sock_dir() + ")");
+    }
+    std::cerr << "No " << config.sock_dir() << ", only watching the broker\n";
+    return false;
+}
+
+// Room for many inotify events, so that a burst of new requests is
+// read in one go. A vector's memory is aligned for any inotify_event.
+constexpr size_t inotify_buffer_size = 64 * 1024;
+
+// Read inotify events, and return the new request sockets.
+[[nodiscard]] std::vector<std::string>
+new_sockets(int ino, const std::string& dir, std::vector<char>* buf)
+{
+    const ssize_t rc = ::read(ino, buf->data(), buf->size());
+    if (rc == -1) {
+        if (errno == EINTR) {
+            return {};
+        }
+        throw SysError("read(inotify)");
+    }
+    std::vector<std::string> fns;
+    for (ssize_t ofs = 0; ofs < rc;) {
+        const auto ev = reinterpret_cast<const struct inotify_event*>(&(*buf)[ofs]);
+        ofs += sizeof(struct inotify_event) + ev->len;
+        if (ev->len == 0 || (ev->mask & IN_ISDIR) || ev->name[0] == '.') {
+            continue;
+        }
+        const std::string fn(ev->name);
+        struct stat st {
+        };
+        if (lstat((dir + "/" + fn).c_str(), &st) || !S_ISSOCK(st.st_mode)) {
+            // Gone already, or not a request.
+            continue;
+        }
+        fns.push_back(fn);
+    }
+    return fns;
+}
+
+// Handle requests as they show up, until killed.
+[[noreturn]] void
+watch(const simproto::SimConfig& config, BrokerClient* broker, std::vector<Pending> pending)
+{
+    const int ino = inotify_init1(IN_CLOEXEC);
+    if (ino == -1) {
+        throw SysError("inotify_init1");
+    }
+    Defer _([ino] { ::close(ino); });
+    if (add_watch(ino, config, broker)) {
+        // Handle what's already there. Only after adding the watch, so
+        // that nothing is missed.
+        for (auto& p : fetch(config, list_dir(config.sock_dir()))) {
+            pending.push_back(std::move(p));
+        }
+    }
+    decide_all(std::move(pending), broker);
+    std::cerr << "Waiting for requests...\n";
+
+    std::vector<char> buf(inotify_buffer_size);
+    for (;;) {
+        if (broker != nullptr && broker->has_queued()) {
+            std::vector<Pending> queued;
+            while (broker->has_queued()) {
+                queued.push_back(from_broker(broker->next()));
+            }
+            decide_all(std::move(queued), broker);
+        }
+
+        std::array<struct pollfd, 2> fds{};
+        fds[0].fd = ino;
+        fds[0].events = POLLIN;
+        fds[1].fd = broker ? broker->fd() : -1;
+        fds[1].events = POLLIN;
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("poll");
+        }
+        if (fds[1].revents) {
+            // Queued, and decided on at the top of the loop.
+            try {
+                broker->pump();
+            } catch (const std::exception& e) {
+                std::cerr << "Lost broker: " << e.what() << std::endl;
+                broker = nullptr;
+            }
+        }
+        if (fds[0].revents) {
+            const auto fns = new_sockets(ino, config.sock_dir(), &buf);
+            decide_all(fetch(config, fns), broker);
+        }
+    }
+}
+#endif
+
+// Approve what `rules` approve, from one event loop, and leave the rest
+// for humans. Closing the connection without an answer makes sim wait
+// for the next approver.
+//
+// With `follow`, keep handling new requests until killed. Otherwise
+// only handle those pending now.
+void auto_approve(const simproto::SimConfig& config,
+                  const AutoApprover& rules,
+                  BrokerClient* broker,
+                  std::vector<Pending> pending,
+                  bool follow)
+{
+    const auto decide = [&rules, &broker](Pending* p) {
+        Defer forget([p, &broker] {
+            if (!p->sock && broker != nullptr) {
+                broker->forget(p->id);
+            }
+        });
+        if (!p->sock && broker != nullptr && broker->is_withdrawn(p->id)) {
+            report_failure(p->id, Withdrawn());
+            return;
+        }
+        const auto rule = rules.match(p->req, p->user, time(nullptr));
+        if (rule == nullptr) {
+            std::cerr << "Leaving " << p->id << " from <" << p->user << "> for humans\n";
+            return;
+        }
+        std::cerr << "Approving " << p->id << " from <" << p->user << "> by rule <"
+                  << rule->name() << ">\n";
+        simproto::ApproveResponse resp;
+        resp.set_approved(true);
+        resp.set_comment("policy rule " + rule->name());
+        respond({ p }, resp, broker);
+    };
+    for (auto& p : pending) {
+        decide(&p);
+    }
+
+    int ino = -1;
+    if (follow) {
+#ifdef HAVE_SYS_INOTIFY_H
+        ino = inotify_init1(IN_CLOEXEC);
+        if (ino == -1) {
+            throw SysError("inotify_init1");
+        }
+        if (!add_watch(ino, config, broker)) {
+            ::close(ino);
+            ino = -1;
+        }
+#else
+        throw std::runtime_error("daemon mode is not supported on this platform");
+#endif
+    }
+    const Defer close_ino([ino] {
+        if (ino != -1) {
+            ::close(ino);
+        }
+    });
+
+    // Connections to sims that haven't sent their request yet, by fd.
+    const gid_t admin_gid = group_to_gid(config.admin_group());
+    std::map<int, Pending> conns;
+    const auto add = [&](const std::vector<std::string>& fns) {
+        for (const auto& fn : fns) {
+            try {
+                auto p = connect_request(config, admin_gid, fn);
+                const int fd = p.sock->fd().get();
+                conns.emplace(fd, std::move(p));
+            } catch (const std::exception& e) {
+                report_failure(fn, e);
+            }
+        }
+    };
+    // After adding the watch, so that nothing is missed.
+    if (access(config.sock_dir().c_str(), F_OK) == 0) {
+        add(list_dir(config.sock_dir()));
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + fetch_timeout;
+    for (;;) {
+        while (follow && broker != nullptr && broker->has_queued()) {
+            auto p = from_broker(broker->next());
+            decide(&p);
+        }
+        int timeout = -1;
+        if (!follow) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  deadline - std::chrono::steady_clock::now())
+                                  .count();
+            if (conns.empty() || left <= 0) {
+                break;
+            }
+            timeout = static_cast<int>(left);
+        }
+
+        std::vector<struct pollfd> fds(2);
+        fds[0].fd = ino;
+        fds[0].events = POLLIN;
+        fds[1].fd = (follow && broker) ? broker->fd() : -1;
+        fds[1].events = POLLIN;
+        for (const auto& c : conns) {
+            struct pollfd pfd {
+            };
+            pfd.fd = c.first;
+            pfd.events = POLLIN;
+            fds.push_back(pfd);
+        }
+        if (poll(fds.data(), fds.size(), timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("poll");
+        }
+        if (fds[1].revents) {
+            try {
+                broker->pump();
+            } catch (const std::exception& e) {
+                std::cerr << "Lost broker: " << e.what() << std::endl;
+                broker = nullptr;
+            }
+        }
+        for (size_t c = 2; c < fds.size(); c++) {
+            if (!fds[c].revents) {
+                continue;
+            }
+            const auto found = conns.find(fds[c].fd);
+            try {
+                read_request(&found->second);
+                decide(&found->second);
+            } catch (const std::exception& e) {
+                report_failure(found->second.id, e);
+            }
+            conns.erase(found);
+        }
+#ifdef HAVE_SYS_INOTIFY_H
+        if (fds[0].revents) {
+            std::vector<char> buf(inotify_buffer_size);
+            add(new_sockets(ino, config.sock_dir(), &buf));
+        }
+#endif
+    }
+    for (const auto& c : conns) {
+        std::cerr << "Request " << c.second.id
+                  << " wasn't sent in time, skipping\n";
+    }
+}
+
+enum class ListFormat { text, ndjson };
+
+[[nodiscard]] std::string json_string(const std::string& s)
+{
+    std::string ret = "\"";
+    for (const char ch : s) {
+        const auto u = static_cast<unsigned char>(ch);
+        if (ch == '"' || ch == '\\') {
+            ret += '\\';
+            ret += ch;
+        } else if (u < 0x20) {
+            std::array<char, 7> buf{};
+            snprintf(buf.data(), buf.size(), "\\u%04x", u);
+            ret += buf.data();
+        } else {
+            ret += ch;
+        }
+    }
+    return ret + "\"";
+}
+
+// Print a request for --list, flushed so that readers get it right
+// away.
+void print_listed(const Pending& p, ListFormat format)
+{
+    if (format == ListFormat::text) {
+        std::cout << "Request " << p.id << " from user <" << p.user << "> (" << p.uid
+                  << ")\n";
+        print_request(p.req);
+        return;
+    }
+#ifdef HAVE_GOOGLE_PROTOBUF_UTIL_JSON_UTIL_H
+    google::protobuf::util::JsonPrintOptions opts;
+    opts.preserve_proto_field_names = true;
+    std::string req;
+    if (!google::protobuf::util::MessageToJsonString(p.req, &req, opts).ok()) {
+        throw std::runtime_error("failed to print request as JSON");
+    }
+    std::cout << "{\"id\":" << json_string(p.id) << ",\"user\":" << json_string(p.user)
+              << ",\"uid\":" << p.uid
+              << ",\"via\":" << json_string(p.sock ? "sock_dir" : "broker")
+              << ",\"request\":" << req << "}" << std::endl;
+#else
+    throw std::runtime_error("JSON output needs protobuf's json_util.h");
+#endif
+}
+
+// Print all pending requests, without answering any. Each is printed
+// as soon as it's been read, so a slow sim only delays itself.
+void list_pending(const simproto::SimConfig& config,
+                  const std::vector<Pending>& brokered,
+                  ListFormat format)
+{
+    for (const auto& p : brokered) {
+        print_listed(p, format);
+    }
+    // With a broker this directory only exists if some sim has fallen
+    // back to it.
+    if (!config.broker_socket().empty() && access(config.sock_dir().c_str(), F_OK)) {
+        return;
+    }
+    // Closing the connection without an answer leaves the request for
+    // others.
+    fetch_each(config, list_dir(config.sock_dir()), [format](Pending p) {
+        print_listed(p, format);
+    });
+}
+
+[[nodiscard]] simproto::ApprovePolicy load_policy(const std::string& fn)
+{
+    std::ifstream f(fn);
+    if (!f) {
+        throw std::runtime_error("failed to open policy " + fn);
+    }
+    const std::string str((std::istreambuf_iterator<char>(f)),
+                          std::istreambuf_iterator<char>());
+    simproto::ApprovePolicy policy;
+    if (!google::protobuf::TextFormat::ParseFromString(str, &policy)) {
+        throw std::runtime_error("error parsing policy " + fn);
+    }
+    return policy;
 }
 
 [[noreturn]] void usage(const char* av0, int err)
 {
-    std::cout << av0 << ": Usage [ -h ]\n";
+    std::cout << av0
+              << ": Usage [ -h ] [ -w ] [ --policy <file> [ --daemon ] ] | --gc | "
+                 "--list [ --format=text|ndjson ]\n";
     exit(err);
 }
 
 [[nodiscard]] int mainwrap(int argc, char** argv)
 {
     // Parse options.
+    bool watch_mode = false;
+    bool daemon_mode = false;
+    bool gc_mode = false;
+    bool list_mode = false;
+    auto list_format = ListFormat::text;
+    bool format_set = false;
+    std::string policy_file;
     {
+        const std::array<struct option, 8> longopts{ {
+            { "daemon", no_argument, nullptr, 'd' },
+            { "format", required_argument, nullptr, 'f' },
+            { "gc", no_argument, nullptr, 'g' },
+            { "help", no_argument, nullptr, 'h' },
+            { "list", no_argument, nullptr, 'l' },
+            { "policy", required_argument, nullptr, 'p' },
+            { "watch", no_argument, nullptr, 'w' },
+            { nullptr, 0, nullptr, 0 },
+        } };
         int opt;
-        while ((opt = getopt(argc, argv, "h")) != -1) {
+        while ((opt = getopt_long(argc, argv, "dhp:w", longopts.data(), nullptr)) != -1) {
             switch (opt) {
+            case 'd':
+                daemon_mode = true;
+                break;
+            case 'f':
+                if (!strcmp(optarg, "ndjson")) {
+                    list_format = ListFormat::ndjson;
+                } else if (strcmp(optarg, "text")) {
+                    usage(argv[0], EXIT_FAILURE);
+                }
+                format_set = true;
+                break;
+            case 'g':
+                gc_mode = true;
+                break;
+            case 'l':
+                list_mode = true;
+                break;
             case 'h':
                 usage(argv[0], EXIT_SUCCESS);
                 break;
+            case 'p':
+                policy_file = optarg;
+                break;
+            case 'w':
+                watch_mode = true;
+                break;
             default: /* '?' */
                 usage(argv[0], EXIT_FAILURE);
             }
@@ -213,9 +1333,21 @@ void handle_request(const simproto::SimConfig& config, const std::string& fn)
     if (argc != optind) {
         throw std::runtime_error("Trailing args on command line");
     }
+    if ((daemon_mode && policy_file.empty()) || (watch_mode && !policy_file.empty()) ||
+        (gc_mode && (watch_mode || daemon_mode || !policy_file.empty())) ||
+        (list_mode && (gc_mode || watch_mode || daemon_mode || !policy_file.empty())) ||
+        (format_set && !list_mode)) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+    // Before anything else, so that a broken policy fails right away.
+    std::unique_ptr<AutoApprover> rules;
+    if (!policy_file.empty()) {
+        rules = std::make_unique<AutoApprover>(load_policy(policy_file));
+    }
 
     // Load config.
     simproto::SimConfig config;
+    const auto config_start = std::chrono::steady_clock::now();
     {
         std::ifstream f(config_file);
         const std::string str((std::istreambuf_iterator<char>(f)),
@@ -224,22 +1356,83 @@ void handle_request(const simproto::SimConfig& config, const std::string& fn)
             throw std::runtime_error("error parsing config " + std::string(config_file));
         }
     }
+    const auto config_time = std::chrono::steady_clock::now() - config_start;
+    if (gc_mode) {
+        collect_garbage(config.sock_dir());
+        return EXIT_SUCCESS;
+    }
+    const IdentityCache identities(config);
 
-    // Find list of things to approve.
-    const auto socks = list_dir(config.sock_dir());
-    if (socks.empty()) {
-        std::cerr << "Nothing to approve\n";
-        return 1;
+    // Only sim exports the metrics, but approvers can add to them if
+    // they can write the data file.
+    std::unique_ptr<Metrics> metrics;
+    if (!config.metrics_file().empty()) {
+        try {
+            metrics = std::make_unique<Metrics>(config.metrics_file(),
+                                                group_to_gid(config.approve_group()));
+            metrics->observe(Histogram::config_load, config_time);
+            set_lookup_timer([m = metrics.get()](std::chrono::nanoseconds d) {
+                m->observe(Histogram::nss_lookup, d);
+            });
+        } catch (const std::exception&) {
+            metrics.reset();
+        }
     }
+    const Defer reset_timer([] { set_lookup_timer(nullptr); });
+
+    // A requester going away just makes our write fail.
+    signal(SIGPIPE, SIG_IGN);
 
-    // Loop over them and approve them.
-    for (const auto& fn : socks) {
+    // Requests queued in the broker, if there is one.
+    std::unique_ptr<BrokerClient> broker;
+    std::vector<Pending> pending;
+    if (!config.broker_socket().empty()) {
         try {
-            handle_request(config, fn);
-        } catch (const std::exception& e) {
-            std::cerr << "Failed to handle " << fn << ": " << e.what() << std::endl;
+            broker = std::make_unique<BrokerClient>(config.broker_socket());
+            for (auto& r : broker->list(watch_mode || daemon_mode)) {
+                pending.push_back(from_broker(std::move(r)));
+            }
+        } catch (const SysError& e) {
+            std::cerr << "Broker unavailable: " << e.what() << std::endl;
+            broker.reset();
         }
     }
+
+    if (rules) {
+        auto_approve(config, *rules, broker.get(), std::move(pending), daemon_mode);
+        return EXIT_SUCCESS;
+    }
+
+    if (list_mode) {
+        list_pending(config, pending, list_format);
+        return EXIT_SUCCESS;
+    }
+
+    // Unbuffered, so that poll() on stdin sees all input not yet read.
+    setvbuf(stdin, nullptr, _IONBF, 0);
+
+    if (watch_mode) {
+#ifdef HAVE_SYS_INOTIFY_H
+        watch(config, broker.get(), std::move(pending));
+#else
+        throw std::runtime_error("watch mode is not supported on this platform");
+#endif
+    }
+
+    // Find list of things to approve. With a broker this directory
+    // only exists if some sim has fallen back to it.
+    std::vector<std::string> socks;
+    if (config.broker_socket().empty() || access(config.sock_dir().c_str(), F_OK) == 0) {
+        socks = list_dir(config.sock_dir());
+    }
+    if (socks.empty() && pending.empty()) {
+        std::cerr << "Nothing to approve\n";
+        return 1;
+    }
+    for (auto& p : fetch(config, socks)) {
+        pending.push_back(std::move(p));
+    }
+    decide_all(std::move(pending), broker.get());
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,705 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "auditindex.h"
+
+// Project
+#include "auditlog.h"
+#include "sha256.h"
+#include "util.h"
+
+// Libraries
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+// C++
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr std::array<char, 8> index_magic{ 'S', 'I', 'M', 'A', 'I', 'D', 'X', '1' };
+constexpr std::array<char, 8> compressed_magic{ 'S', 'I', 'M', 'A', 'U', 'D', 'Z', '1' };
+
+constexpr const char* index_suffix = ".idx";
+constexpr const char* compressed_suffix = ".z";
+
+// Segments this close to the end are left alone, since the log may
+// still be writing to them, or reading them back in recover().
+constexpr size_t active_segments = 2;
+
+constexpr size_t bloom_bits = 4096;
+constexpr int bloom_hashes = 3;
+
+struct IndexHeader {
+    std::array<char, 8> magic;
+    uint64_t segment_size; // Uncompressed, to tell if the index is stale.
+    uint64_t entries;
+    int64_t min_time;
+    int64_t max_time;
+    std::array<uint64_t, bloom_bits / 64> bloom;
+};
+
+// One per command in a record, or one for a record without any.
+// Entries of the same record are next to each other.
+struct IndexEntry {
+    int64_t time_us;
+    uint64_t offset;
+    uint32_t user;
+    uint32_t host;
+    uint32_t command;
+    uint32_t pad;
+};
+
+// Header of a compressed segment, followed by the zlib stream.
+struct CompressedHeader {
+    std::array<char, 8> magic;
+    uint64_t size;
+};
+
+// FNV-1a. `kind` keeps e.g. a user and a command of the same name
+// apart in the Bloom filter.
+[[nodiscard]] uint64_t key_hash(char kind, const std::string& value)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const auto add = [&h](uint8_t b) {
+        h ^= b;
+        h *= 0x100000001b3ULL;
+    };
+    add(kind);
+    for (const auto ch : value) {
+        add(static_cast<uint8_t>(ch));
+    }
+    return h;
+}
+
+void bloom_add(IndexHeader* h, uint64_t key)
+{
+    for (int c = 0; c < bloom_hashes; c++) {
+        const uint64_t bit = (key >> (c * 21)) % bloom_bits;
+        h->bloom[bit / 64] |= uint64_t{ 1 } << (bit % 64);
+    }
+}
+
+[[nodiscard]] bool bloom_has(const IndexHeader& h, uint64_t key)
+{
+    for (int c = 0; c < bloom_hashes; c++) {
+        const uint64_t bit = (key >> (c * 21)) % bloom_bits;
+        if (!(h.bloom[bit / 64] & (uint64_t{ 1 } << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The commands run or files edited by a record.
+[[nodiscard]] std::vector<std::string> record_commands(const simproto::AuditRecord& r)
+{
+    std::vector<std::string> ret;
+    const auto& req = r.request();
+    if (req.has_command()) {
+        ret.push_back(req.command().command());
+    }
+    for (const auto& cmd : req.batch()) {
+        ret.push_back(cmd.command());
+    }
+    if (req.has_edit()) {
+        ret.push_back(req.edit().filename());
+    }
+    for (const auto& e : req.edits()) {
+        ret.push_back(e.filename());
+    }
+    return ret;
+}
+
+[[nodiscard]] bool matches(const AuditQuery& q, const simproto::AuditRecord& r)
+{
+    if (r.time_us() < q.since_us || r.time_us() >= q.until_us) {
+        return false;
+    }
+    if ((!q.user.empty() && r.user() != q.user) ||
+        (!q.host.empty() && r.host() != q.host)) {
+        return false;
+    }
+    if (q.command.empty()) {
+        return true;
+    }
+    const auto cmds = record_commands(r);
+    return std::find(cmds.begin(), cmds.end(), q.command) != cmds.end();
+}
+
+struct Segment {
+    uint64_t n;
+    bool compressed;
+};
+
+// Segments in `dir`, plain or compressed, in order. If compressing was
+// interrupted, both may exist, and the plain one is complete.
+[[nodiscard]] std::vector<Segment> list_segments(const std::string& dir)
+{
+    std::vector<Segment> ret;
+    for (const auto n : audit_segments(dir)) {
+        ret.push_back(Segment{ n, false });
+    }
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        throw SysError("opendir(" + dir + ")");
+    }
+    Defer _([d] { closedir(d); });
+    const auto len = audit_segment_name(0).size();
+    const std::string suffix = compressed_suffix;
+    while (const struct dirent* ent = readdir(d)) {
+        const std::string name = ent->d_name;
+        if (name.size() != len + suffix.size() ||
+            name.compare(len, suffix.size(), suffix)) {
+            continue;
+        }
+        const uint64_t n = strtoull(name.c_str(), nullptr, 16);
+        if (audit_segment_name(n) + suffix != name) {
+            continue;
+        }
+        const bool plain = std::any_of(
+            ret.begin(), ret.end(), [n](const Segment& s) { return s.n == n; });
+        if (!plain) {
+            ret.push_back(Segment{ n, true });
+        }
+    }
+    std::sort(ret.begin(), ret.end(), [](const Segment& a, const Segment& b) {
+        return a.n < b.n;
+    });
+    return ret;
+}
+
+[[nodiscard]] std::string segment_path(const std::string& dir, const Segment& seg)
+{
+    return dir + "/" + audit_segment_name(seg.n) +
+           (seg.compressed ? compressed_suffix : "");
+}
+
+[[nodiscard]] std::string index_path(const std::string& dir, uint64_t n)
+{
+    auto name = audit_segment_name(n);
+    name.replace(name.rfind('.'), std::string::npos, index_suffix);
+    return dir + "/" + name;
+}
+
+// Read-only mapping of a whole file. Empty files aren't mapped.
+class Mapping
+{
+public:
+    explicit Mapping(const std::string& fn)
+    {
+        const int fd = open(fn.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            throw SysError("open(" + fn + ")");
+        }
+        Defer _([fd] { ::close(fd); });
+        struct stat st {
+        };
+        if (fstat(fd, &st)) {
+            throw SysError("fstat(" + fn + ")");
+        }
+        size_ = st.st_size;
+        if (size_ == 0) {
+            return;
+        }
+        void* m = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) {
+            throw SysError("mmap(" + fn + ")");
+        }
+        data_ = static_cast<const char*>(m);
+    }
+    ~Mapping()
+    {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    // No copy or move.
+    Mapping(const Mapping&) = delete;
+    Mapping(Mapping&&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+    Mapping& operator=(Mapping&&) = delete;
+
+    [[nodiscard]] const char* data() const noexcept { return data_; }
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+[[nodiscard]] CompressedHeader compressed_header(const Mapping& m, const std::string& fn)
+{
+    CompressedHeader h{};
+    if (m.size() < sizeof(h)) {
+        throw std::runtime_error("truncated compressed audit segment " + fn);
+    }
+    memcpy(&h, m.data(), sizeof(h));
+    if (h.magic != compressed_magic) {
+        throw std::runtime_error("bad magic in compressed audit segment " + fn);
+    }
+    return h;
+}
+
+[[nodiscard]] std::string decompress(const Mapping& m, const std::string& fn)
+{
+    const auto h = compressed_header(m, fn);
+#ifdef HAVE_ZLIB_H
+    std::string ret(h.size, '\0');
+    uLongf len = h.size;
+    if (uncompress(reinterpret_cast<Bytef*>(&ret[0]),
+                   &len,
+                   reinterpret_cast<const Bytef*>(m.data() + sizeof(h)),
+                   m.size() - sizeof(h)) != Z_OK ||
+        len != h.size) {
+        throw std::runtime_error("corrupt compressed audit segment " + fn);
+    }
+    return ret;
+#else
+    throw std::runtime_error("sim built without zlib, can't read " + fn);
+#endif
+}
+
+// Contents of a segment, mapped if plain and decompressed if not.
+class SegmentData
+{
+public:
+    SegmentData(const std::string& dir, Segment seg)
+    {
+        std::string fn = segment_path(dir, seg);
+        try {
+            map_ = std::make_unique<Mapping>(fn);
+        } catch (const SysError& e) {
+            // Compressed since it was listed.
+            if (seg.compressed || e.err() != ENOENT) {
+                throw;
+            }
+            seg.compressed = true;
+            fn = segment_path(dir, seg);
+            map_ = std::make_unique<Mapping>(fn);
+        }
+        if (seg.compressed) {
+            buf_ = decompress(*map_, fn);
+            map_.reset();
+        }
+    }
+
+    [[nodiscard]] const char* data() const noexcept
+    {
+        return map_ ? map_->data() : buf_.data();
+    }
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return map_ ? map_->size() : buf_.size();
+    }
+
+private:
+    std::unique_ptr<Mapping> map_;
+    std::string buf_;
+};
+
+// Uncompressed size of a segment, without decompressing it.
+[[nodiscard]] uint64_t segment_size(const std::string& dir, const Segment& seg)
+{
+    const auto fn = segment_path(dir, seg);
+    if (seg.compressed) {
+        return compressed_header(Mapping(fn), fn).size;
+    }
+    struct stat st {
+    };
+    if (stat(fn.c_str(), &st)) {
+        throw SysError("stat(" + fn + ")");
+    }
+    return st.st_size;
+}
+
+// The index of a segment, if it has an index matching its size.
+class IndexFile
+{
+public:
+    IndexFile(const std::string& dir, const Segment& seg)
+    {
+        const auto fn = index_path(dir, seg.n);
+        try {
+            map_ = std::make_unique<Mapping>(fn);
+        } catch (const SysError& e) {
+            if (e.err() != ENOENT) {
+                throw;
+            }
+            return;
+        }
+        if (map_->size() < sizeof(IndexHeader)) {
+            map_.reset();
+            return;
+        }
+        const auto& h = header();
+        if (h.magic != index_magic ||
+            map_->size() != sizeof(IndexHeader) + h.entries * sizeof(IndexEntry) ||
+            h.segment_size != segment_size(dir, seg)) {
+            map_.reset();
+        }
+    }
+
+    [[nodiscard]] bool ok() const noexcept { return map_ != nullptr; }
+    [[nodiscard]] const IndexHeader& header() const
+    {
+        return *reinterpret_cast<const IndexHeader*>(map_->data());
+    }
+    [[nodiscard]] const IndexEntry* entries() const
+    {
+        return reinterpret_cast<const IndexEntry*>(map_->data() + sizeof(IndexHeader));
+    }
+
+private:
+    std::unique_ptr<Mapping> map_;
+};
+
+// Write `data` to `fn` through a temporary file, so that readers see
+// either the old or the new contents. With `sync`, it's on disk before
+// it replaces the old file.
+void replace_file(const std::string& fn, const std::string& data, bool sync)
+{
+    const auto tmp = fn + ".tmp";
+    const int fd =
+        open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        throw SysError("open(" + tmp + ")");
+    }
+    Defer undo([&tmp] { unlink(tmp.c_str()); });
+    {
+        Defer _([fd] { ::close(fd); });
+        for (size_t ofs = 0; ofs < data.size();) {
+            const ssize_t rc = write(fd, data.data() + ofs, data.size() - ofs);
+            if (rc == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw SysError("write(" + tmp + ")");
+            }
+            ofs += rc;
+        }
+        if (sync && fsync(fd)) {
+            throw SysError("fsync(" + tmp + ")");
+        }
+    }
+    if (rename(tmp.c_str(), fn.c_str())) {
+        throw SysError("rename(" + tmp + ", " + fn + ")");
+    }
+    undo.defuse();
+}
+
+[[nodiscard]] simproto::AuditRecord
+parse_record(const char* rec, size_t len, const std::string& fn)
+{
+    simproto::AuditRecord r;
+    if (!r.ParseFromArray(rec, len)) {
+        throw std::runtime_error("corrupt record in audit log " + fn);
+    }
+    return r;
+}
+
+void write_index(const std::string& dir, const Segment& seg)
+{
+    const SegmentData data(dir, seg);
+    const auto fn = segment_path(dir, seg);
+    IndexHeader h{};
+    h.magic = index_magic;
+    h.segment_size = data.size();
+    h.min_time = std::numeric_limits<int64_t>::max();
+    h.max_time = std::numeric_limits<int64_t>::min();
+    std::vector<IndexEntry> entries;
+    scan_audit_segment(
+        data.data(), data.size(), [&](size_t ofs, const char* rec, size_t len) {
+            const auto r = parse_record(rec, len, fn);
+            h.min_time = std::min(h.min_time, r.time_us());
+            h.max_time = std::max(h.max_time, r.time_us());
+            IndexEntry e{};
+            e.time_us = r.time_us();
+            e.offset = ofs;
+            const auto user = key_hash('u', r.user());
+            const auto host = key_hash('h', r.host());
+            bloom_add(&h, user);
+            bloom_add(&h, host);
+            e.user = static_cast<uint32_t>(user);
+            e.host = static_cast<uint32_t>(host);
+            auto cmds = record_commands(r);
+            if (cmds.empty()) {
+                entries.push_back(e);
+            }
+            for (const auto& cmd : cmds) {
+                const auto key = key_hash('c', cmd);
+                bloom_add(&h, key);
+                e.command = static_cast<uint32_t>(key);
+                entries.push_back(e);
+            }
+        });
+    h.entries = entries.size();
+    std::string out(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.append(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(IndexEntry));
+    replace_file(index_path(dir, seg.n), out, false);
+}
+
+// Newest record time in a segment.
+[[nodiscard]] int64_t max_time(const std::string& dir, const Segment& seg)
+{
+    const IndexFile idx(dir, seg);
+    if (idx.ok()) {
+        return idx.header().max_time;
+    }
+    const SegmentData data(dir, seg);
+    int64_t ret = std::numeric_limits<int64_t>::min();
+    const auto fn = segment_path(dir, seg);
+    scan_audit_segment(
+        data.data(), data.size(), [&](size_t, const char* rec, size_t len) {
+            ret = std::max(ret, parse_record(rec, len, fn).time_us());
+        });
+    return ret;
+}
+
+void compress_segment(const std::string& dir, const Segment& seg)
+{
+#ifdef HAVE_ZLIB_H
+    const auto fn = segment_path(dir, seg);
+    const Mapping data(fn);
+    CompressedHeader h{};
+    h.magic = compressed_magic;
+    h.size = data.size();
+    uLongf len = compressBound(data.size());
+    std::string out(sizeof(h) + len, '\0');
+    memcpy(&out[0], &h, sizeof(h));
+    if (compress2(reinterpret_cast<Bytef*>(&out[sizeof(h)]),
+                  &len,
+                  reinterpret_cast<const Bytef*>(data.data()),
+                  data.size(),
+                  Z_BEST_COMPRESSION) != Z_OK) {
+        throw std::runtime_error("failed to compress " + fn);
+    }
+    out.resize(sizeof(h) + len);
+
+    const Segment z{ seg.n, true };
+    const auto zfn = segment_path(dir, z);
+    replace_file(zfn, out, true);
+
+    // This is the only copy once the plain segment is gone, so read
+    // it back before removing that.
+    const auto check = decompress(Mapping(zfn), zfn);
+    if (check.size() != data.size() ||
+        (data.size() && memcmp(check.data(), data.data(), data.size()))) {
+        unlink(zfn.c_str());
+        throw std::runtime_error("compressed " + fn + " doesn't read back the same");
+    }
+    const int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        throw SysError("open(" + dir + ")");
+    }
+    Defer _([dfd] { ::close(dfd); });
+    if (fsync(dfd)) {
+        throw SysError("fsync(" + dir + ")");
+    }
+    if (unlink(fn.c_str())) {
+        throw SysError("unlink(" + fn + ")");
+    }
+#else
+    (void)seg;
+    throw std::runtime_error("sim built without zlib, can't compress audit log " + dir);
+#endif
+}
+
+// Held while updating indexes or compressing, so that two runs don't
+// write the same files.
+class MaintenanceLock
+{
+public:
+    explicit MaintenanceLock(const std::string& dir)
+    {
+        const auto fn = dir + "/maintain.lock";
+        fd_ = open(fn.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd_ == -1) {
+            throw SysError("open(" + fn + ")");
+        }
+        if (flock(fd_, LOCK_EX)) {
+            const SysError err("flock(" + fn + ")");
+            ::close(fd_);
+            throw err;
+        }
+    }
+    ~MaintenanceLock() { ::close(fd_); }
+
+    // No copy or move.
+    MaintenanceLock(const MaintenanceLock&) = delete;
+    MaintenanceLock(MaintenanceLock&&) = delete;
+    MaintenanceLock& operator=(const MaintenanceLock&) = delete;
+    MaintenanceLock& operator=(MaintenanceLock&&) = delete;
+
+private:
+    int fd_;
+};
+} // namespace
+
+AuditIndex::AuditIndex(std::string dir) : dir_(std::move(dir)) {}
+
+AuditQueryStats
+AuditIndex::query(const AuditQuery& q,
+                  const std::function<void(const simproto::AuditRecord&)>& f) const
+{
+    const auto user = key_hash('u', q.user);
+    const auto host = key_hash('h', q.host);
+    const auto command = key_hash('c', q.command);
+
+    AuditQueryStats stats;
+    for (const auto& seg : list_segments(dir_)) {
+        const IndexFile idx(dir_, seg);
+        if (!idx.ok()) {
+            stats.segments_read++;
+            const SegmentData data(dir_, seg);
+            const auto fn = segment_path(dir_, seg);
+            scan_audit_segment(
+                data.data(), data.size(), [&](size_t, const char* rec, size_t len) {
+                    stats.records_read++;
+                    const auto r = parse_record(rec, len, fn);
+                    if (matches(q, r)) {
+                        f(r);
+                    }
+                });
+            continue;
+        }
+
+        const auto& h = idx.header();
+        if (h.entries == 0 || h.max_time < q.since_us || h.min_time >= q.until_us ||
+            (!q.user.empty() && !bloom_has(h, user)) ||
+            (!q.host.empty() && !bloom_has(h, host)) ||
+            (!q.command.empty() && !bloom_has(h, command))) {
+            stats.segments_skipped++;
+            continue;
+        }
+        stats.segments_indexed++;
+
+        // Only read the segment once an entry matches.
+        std::unique_ptr<SegmentData> data;
+        bool done = false;
+        uint64_t done_offset = 0;
+        const auto* entries = idx.entries();
+        for (uint64_t c = 0; c < h.entries; c++) {
+            const auto& e = entries[c];
+            if ((done && e.offset == done_offset) || e.time_us < q.since_us ||
+                e.time_us >= q.until_us ||
+                (!q.user.empty() && e.user != static_cast<uint32_t>(user)) ||
+                (!q.host.empty() && e.host != static_cast<uint32_t>(host)) ||
+                (!q.command.empty() && e.command != static_cast<uint32_t>(command))) {
+                continue;
+            }
+            if (!data) {
+                data = std::make_unique<SegmentData>(dir_, seg);
+            }
+            simproto::AuditRecord r;
+            if (!parse_audit_record(data->data(), data->size(), e.offset, &r)) {
+                throw std::runtime_error("audit index doesn't match " +
+                                         segment_path(dir_, seg));
+            }
+            stats.records_read++;
+            done = true;
+            done_offset = e.offset;
+            // Hashes can collide.
+            if (matches(q, r)) {
+                f(r);
+            }
+        }
+    }
+    return stats;
+}
+
+int AuditIndex::update()
+{
+    const MaintenanceLock _(dir_);
+    const auto segs = list_segments(dir_);
+    int ret = 0;
+    for (size_t c = 0; c + active_segments < segs.size(); c++) {
+        if (IndexFile(dir_, segs[c]).ok()) {
+            continue;
+        }
+        write_index(dir_, segs[c]);
+        ret++;
+    }
+    return ret;
+}
+
+int AuditIndex::compress(int64_t before_us)
+{
+    const MaintenanceLock _(dir_);
+    const auto segs = list_segments(dir_);
+    int ret = 0;
+    for (size_t c = 0; c + active_segments < segs.size(); c++) {
+        const auto& seg = segs[c];
+        if (seg.compressed || max_time(dir_, seg) >= before_us) {
+            continue;
+        }
+        compress_segment(dir_, seg);
+        ret++;
+    }
+    return ret;
+}
+
+uint64_t AuditIndex::verify() const
+{
+    uint64_t seq = 0;
+    Digest prev{};
+    const auto segs = list_segments(dir_);
+    for (size_t c = 0; c < segs.size(); c++) {
+        const SegmentData data(dir_, segs[c]);
+        const auto fn = segment_path(dir_, segs[c]);
+        const auto valid = scan_audit_segment(
+            data.data(), data.size(), [&](size_t ofs, const char* rec, size_t len) {
+                const auto r = parse_record(rec, len, fn);
+                if (r.seq() != seq ||
+                    r.prev_hash() != std::string(prev.begin(), prev.end())) {
+                    throw std::runtime_error("audit log chain broken at seq " +
+                                             std::to_string(seq) + ", " + fn +
+                                             " offset " + std::to_string(ofs));
+                }
+                prev = sha256(std::string(rec, len));
+                seq++;
+            });
+        // The newest segment may end in a record being written.
+        if (valid != data.size() && c + 1 != segs.size()) {
+            throw std::runtime_error("partial record at the end of " + fn);
+        }
+    }
+    return seq;
+}
+
+} // namespace Sim
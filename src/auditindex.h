@@ -0,0 +1,91 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Indexes over the audit log (see auditlog.h), for answering queries
+ * like "what did this user run on that host last quarter" without
+ * reading years of records.
+ *
+ * Every segment but the two newest gets an index file next to it, e.g.
+ * "0000000000000001.idx". It starts with the time range of the segment
+ * and a Bloom filter of the users, hosts, and commands in it, followed
+ * by a fixed size entry per record with the time and hashes of those
+ * fields. A query skips segments by time range and Bloom filter, scans
+ * the entries of the rest through mmap(), and only reads the records
+ * whose entries match. Segments without an up to date index, such as
+ * the one being written, are read in full.
+ *
+ * Old segments can be compressed, e.g. "0000000000000001.log.z". The
+ * index then still lets queries skip them without decompressing.
+ */
+#include "simproto.pb.h"
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+
+namespace Sim {
+
+struct AuditQuery {
+    // Empty matches anything.
+    std::string user;
+    std::string host;
+
+    // argv[0] of a command run, or the name of a file edited.
+    std::string command;
+
+    // Microseconds since the epoch. `until_us` is not included.
+    int64_t since_us = 0;
+    int64_t until_us = std::numeric_limits<int64_t>::max();
+};
+
+// What a query had to read.
+struct AuditQueryStats {
+    uint64_t segments_skipped = 0; // Only read the index header.
+    uint64_t segments_indexed = 0; // Scanned the index entries.
+    uint64_t segments_read = 0;    // Read all records.
+    uint64_t records_read = 0;
+};
+
+class AuditIndex
+{
+public:
+    // For the log in directory `dir`.
+    explicit AuditIndex(std::string dir);
+
+    // Call `f` with every record matching `q`, in log order.
+    AuditQueryStats
+    query(const AuditQuery& q,
+          const std::function<void(const simproto::AuditRecord&)>& f) const;
+
+    // Create or update the index of every segment but the two newest.
+    // Returns the number of indexes written.
+    int update();
+
+    // Compress segments, other than the two newest, whose records are
+    // all older than `before_us`. Returns the number compressed.
+    int compress(int64_t before_us);
+
+    // Check the hash chain through all segments, throwing at the first
+    // break. Returns the number of records.
+    uint64_t verify() const;
+
+private:
+    const std::string dir_;
+};
+
+} // namespace Sim
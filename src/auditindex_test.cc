@@ -0,0 +1,216 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "auditindex.h"
+#include "auditlog.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<limits>
+#include<stdexcept>
+#include<string>
+#include<vector>
+
+#include<fcntl.h>
+#include<unistd.h>
+
+namespace {
+constexpr int64_t hour_us = 3600LL * 1000000;
+
+// What was appended, with seq set.
+std::vector<simproto::AuditRecord> all;
+
+void append(Sim::AuditLog* log, int n)
+{
+  simproto::AuditRecord r;
+  r.set_type(simproto::AuditRecord::EXECUTED);
+  r.set_seq(0);
+  r.set_prev_hash("");
+  r.set_time_us(n * hour_us);
+  r.set_user("user" + std::to_string(n % 5));
+  r.set_host("host" + std::to_string(n % 3));
+  auto req = r.mutable_request();
+  if (n % 10 == 0) {
+    for (int c = 0; c < 3; c++) {
+      auto cmd = req->add_batch();
+      cmd->set_cwd("/");
+      cmd->set_command("/bin/batch" + std::to_string(c));
+    }
+  } else if (n % 11 == 0) {
+    req->mutable_edit()->set_filename("/etc/file" + std::to_string(n % 2));
+  } else {
+    auto cmd = req->mutable_command();
+    cmd->set_cwd("/");
+    cmd->set_command("/bin/cmd" + std::to_string(n % 7));
+  }
+  log->append(r);
+  r.set_seq(all.size());
+  all.push_back(r);
+}
+
+bool want(const Sim::AuditQuery& q, const simproto::AuditRecord& r)
+{
+  if (r.time_us() < q.since_us || r.time_us() >= q.until_us) {
+    return false;
+  }
+  if ((!q.user.empty() && q.user != r.user()) ||
+      (!q.host.empty() && q.host != r.host())) {
+    return false;
+  }
+  if (q.command.empty()) {
+    return true;
+  }
+  const auto& req = r.request();
+  if (req.has_command() && req.command().command() == q.command) {
+    return true;
+  }
+  for (const auto& cmd : req.batch()) {
+    if (cmd.command() == q.command) {
+      return true;
+    }
+  }
+  return req.has_edit() && req.edit().filename() == q.command;
+}
+
+// Run the query, and check that it finds the same as going through
+// every record.
+Sim::AuditQueryStats check(const Sim::AuditIndex& index, const Sim::AuditQuery& q)
+{
+  std::vector<uint64_t> got;
+  const auto stats = index.query(q, [&got](const simproto::AuditRecord& r) {
+    got.push_back(r.seq());
+  });
+  std::vector<uint64_t> expected;
+  for (const auto& r : all) {
+    if (want(q, r)) {
+      expected.push_back(r.seq());
+    }
+  }
+  assert(got == expected);
+  return stats;
+}
+
+Sim::AuditQuery query(const std::string& user,
+                      const std::string& host,
+                      const std::string& command,
+                      int64_t since_us = 0,
+                      int64_t until_us = std::numeric_limits<int64_t>::max())
+{
+  Sim::AuditQuery q;
+  q.user = user;
+  q.host = host;
+  q.command = command;
+  q.since_us = since_us;
+  q.until_us = until_us;
+  return q;
+}
+
+void check_all(const Sim::AuditIndex& index)
+{
+  check(index, query("", "", ""));
+  check(index, query("user1", "", ""));
+  check(index, query("user2", "host1", ""));
+  check(index, query("", "", "/bin/cmd3"));
+  check(index, query("", "", "/bin/batch1"));
+  check(index, query("", "", "/etc/file1"));
+  check(index, query("user3", "", "", 50 * hour_us, 120 * hour_us));
+  check(index, query("nobody", "", ""));
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+
+  char tmpl[] = "/tmp/auditindex_test.XXXXXX";
+  const char* tmp = mkdtemp(tmpl);
+  assert(tmp != nullptr);
+  const std::string dir = std::string(tmp) + "/log";
+
+  constexpr int records = 300;
+  {
+    AuditLog log(dir, 1024, false);
+    for (int c = 0; c < records; c++) {
+      append(&log, c);
+    }
+  }
+  const auto segments = audit_segments(dir).size();
+  assert(segments > 10);
+
+  AuditIndex index(dir);
+
+  // Without indexes, everything is read.
+  {
+    const auto stats = check(index, query("user1", "", ""));
+    assert(stats.segments_read == segments);
+    assert(stats.records_read == records);
+  }
+  check_all(index);
+
+  // All but the two newest segments get indexed, once.
+  assert(index.update() == static_cast<int>(segments - 2));
+  assert(index.update() == 0);
+  check_all(index);
+  {
+    // Time range.
+    const auto stats = check(index, query("", "", "", 10 * hour_us, 20 * hour_us));
+    assert(stats.segments_indexed + stats.segments_skipped == segments - 2);
+    assert(stats.segments_skipped > segments / 2);
+    assert(stats.segments_read == 2);
+    assert(stats.records_read < records / 2);
+  }
+  {
+    // Bloom filter.
+    const auto stats = check(index, query("nobody", "", ""));
+    assert(stats.segments_skipped == segments - 2);
+    assert(stats.records_read < records / 5);
+  }
+  {
+    // Only matching records are read from indexed segments.
+    const auto stats = check(index, query("", "", "/etc/file1"));
+    assert(stats.records_read < records / 5);
+  }
+  assert(index.verify() == records);
+
+  // Compress everything older than the 100th record.
+  const int compressed = index.compress(100 * hour_us);
+  assert(compressed > 0);
+  assert(audit_segments(dir).size() == segments - compressed);
+  assert(index.compress(100 * hour_us) == 0);
+  check_all(index);
+  assert(index.verify() == records);
+  {
+    const auto stats = check(index, query("nobody", "", ""));
+    assert(stats.segments_skipped == segments - 2);
+  }
+
+  // Keep writing. A stale index is ignored until updated.
+  {
+    AuditLog log(dir, 1024, false);
+    for (int c = records; c < 2 * records; c++) {
+      append(&log, c);
+    }
+  }
+  check_all(index);
+  assert(index.update() > 0);
+  check_all(index);
+  assert(index.verify() == 2 * records);
+
+  // Changing an old record breaks the chain.
+  {
+    const auto fn = dir + "/" + audit_segment_name(audit_segments(dir)[0]);
+    const int fd = open(fn.c_str(), O_WRONLY);
+    assert(fd != -1);
+    assert(pwrite(fd, "X", 1, 20) == 1);
+    close(fd);
+    bool threw = false;
+    try {
+      (void)index.verify();
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  assert(!system(("rm -r " + std::string(tmpl)).c_str()));
+}
@@ -0,0 +1,421 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "auditlog.h"
+
+// Project
+#include "sha256.h"
+#include "util.h"
+
+// C++
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr std::array<char, 8> magic{ 'S', 'I', 'M', 'A', 'U', 'D', 'T', '1' };
+
+// A position in the log is the segment number and the offset in it,
+// as one number, so that the synced position can be updated
+// atomically.
+constexpr int offset_bits = 40;
+
+constexpr const char* segment_suffix = ".log";
+constexpr size_t segment_digits = 16;
+
+// Appending fails rather than waits forever for a stuck writer. Long
+// enough for someone else's fdatasync().
+constexpr auto max_lock_wait = std::chrono::seconds(10);
+
+[[nodiscard]] std::chrono::steady_clock::time_point lock_deadline()
+{
+    return std::chrono::steady_clock::now() + max_lock_wait;
+}
+
+[[nodiscard]] uint64_t position(uint64_t segment, uint64_t offset)
+{
+    return segment << offset_bits | offset;
+}
+
+[[nodiscard]] std::string encode_varint(uint64_t n)
+{
+    std::string ret;
+    while (n >= 0x80) {
+        ret.push_back(static_cast<char>(n | 0x80));
+        n >>= 7;
+    }
+    ret.push_back(static_cast<char>(n));
+    return ret;
+}
+
+// Decode the varint at the start of `p`. Returns the number of bytes
+// used, or 0 if it's cut short or too long.
+[[nodiscard]] size_t decode_varint(const char* p, size_t len, uint64_t* n)
+{
+    *n = 0;
+    for (size_t c = 0; c < std::min<size_t>(len, 10); c++) {
+        const auto b = static_cast<uint8_t>(p[c]);
+        *n |= static_cast<uint64_t>(b & 0x7f) << (7 * c);
+        if (!(b & 0x80)) {
+            return c + 1;
+        }
+    }
+    return 0;
+}
+
+[[nodiscard]] std::string read_file(int fd, const std::string& name)
+{
+    std::string ret;
+    std::array<char, 65536> buf;
+    for (off_t ofs = 0;;) {
+        const ssize_t rc = pread(fd, buf.data(), buf.size(), ofs);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("pread(" + name + ")");
+        }
+        if (rc == 0) {
+            return ret;
+        }
+        ret.append(buf.data(), rc);
+        ofs += rc;
+    }
+}
+} // namespace
+
+struct AuditLog::State {
+    std::array<char, 8> magic;
+    uint64_t segment; // Current segment, from 1.
+    uint64_t size;    // Bytes in it.
+    uint64_t seq;     // Of the next record.
+    Digest last;      // SHA-256 of the last record.
+
+    // position() known to be on disk. Updated atomically, without
+    // holding the lock.
+    uint64_t synced;
+};
+
+AuditLog::AuditLog(const std::string& dir, uint64_t segment_bytes, bool sync)
+    : dir_(dir), segment_bytes_(segment_bytes), sync_(sync)
+{
+    if (segment_bytes_ == 0 || segment_bytes_ >= (uint64_t{ 1 } << offset_bits)) {
+        throw std::runtime_error("audit log segment size out of range");
+    }
+    if (mkdir(dir_.c_str(), 0700) && errno != EEXIST) {
+        throw SysError("mkdir(" + dir_ + ")");
+    }
+    dir_fd_ = open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir_fd_ == -1) {
+        throw SysError("open(" + dir_ + ")");
+    }
+    Defer defer([this] {
+        ::close(state_fd_);
+        ::close(dir_fd_);
+    });
+
+    // Only trust a log that nobody else could have written to.
+    struct stat st {
+    };
+    if (fstat(dir_fd_, &st)) {
+        throw SysError("fstat(" + dir_ + ")");
+    }
+    if (st.st_uid != geteuid() || (st.st_mode & 022)) {
+        throw std::runtime_error("audit log " + dir_ +
+                                 " has unsafe owner or permissions");
+    }
+
+    state_fd_ = openat(dir_fd_, "state", O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (state_fd_ == -1) {
+        throw SysError("openat(" + dir_ + ", state)");
+    }
+    {
+        FileLock _(state_fd_, LOCK_EX, lock_deadline(), "audit log " + dir_);
+        if (fstat(state_fd_, &st)) {
+            throw SysError("fstat(" + dir_ + "/state)");
+        }
+        if (!S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+            throw std::runtime_error("audit log state in " + dir_ + " has unsafe owner");
+        }
+        // A new file is all zeroes, and so gets rebuilt on first use.
+        if (static_cast<size_t>(st.st_size) < sizeof(State) &&
+            ftruncate(state_fd_, sizeof(State))) {
+            throw SysError("ftruncate(" + dir_ + "/state)");
+        }
+    }
+    void* m =
+        mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED, state_fd_, 0);
+    if (m == MAP_FAILED) {
+        throw SysError("mmap(" + dir_ + "/state)");
+    }
+    state_ = static_cast<State*>(m);
+    defer.defuse();
+}
+
+AuditLog::~AuditLog()
+{
+    munmap(state_, sizeof(State));
+    ::close(seg_fd_);
+    ::close(state_fd_);
+    ::close(dir_fd_);
+}
+
+void AuditLog::open_segment(uint64_t n, bool create)
+{
+    const auto name = audit_segment_name(n);
+    const int flags =
+        O_RDWR | O_APPEND | O_NOFOLLOW | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    const int fd = openat(dir_fd_, name.c_str(), flags, 0600);
+    if (fd == -1) {
+        throw SysError("openat(" + dir_ + ", " + name + ")");
+    }
+    ::close(seg_fd_);
+    seg_fd_ = fd;
+    seg_ = n;
+}
+
+// Rebuild the state from the segments, on first use or when the state
+// doesn't match the segment. Called with the lock held.
+void AuditLog::recover()
+{
+    State st{};
+    st.magic = magic;
+    const auto segs = audit_segments(dir_);
+    if (segs.empty()) {
+        st.segment = 1;
+        open_segment(st.segment, true);
+        if (sync_ && fsync(dir_fd_)) {
+            throw SysError("fsync(" + dir_ + ")");
+        }
+        *state_ = st;
+        return;
+    }
+
+    // The current segment may have a partly written record at the end,
+    // or no records at all, in which case the chain continues from the
+    // segment before it.
+    st.segment = segs.back();
+    open_segment(st.segment, false);
+    bool found = false;
+    for (auto n = segs.rbegin(); n != segs.rend() && !found; ++n) {
+        const auto name = audit_segment_name(*n);
+        const int fd = openat(dir_fd_, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            throw SysError("openat(" + dir_ + ", " + name + ")");
+        }
+        Defer _([fd] { ::close(fd); });
+        const auto data = read_file(fd, dir_ + "/" + name);
+        const size_t valid = scan_audit_segment(
+            data.data(), data.size(), [&](size_t, const char* rec, size_t len) {
+                simproto::AuditRecord r;
+                if (!r.ParseFromArray(rec, len)) {
+                    throw std::runtime_error("corrupt record in audit log " + dir_ +
+                                             "/" + name);
+                }
+                st.seq = r.seq() + 1;
+                st.last = sha256(std::string(rec, len));
+                found = true;
+            });
+        if (*n == st.segment) {
+            if (valid < data.size() && ftruncate(seg_fd_, valid)) {
+                throw SysError("ftruncate(" + dir_ + "/" + name + ")");
+            }
+            st.size = valid;
+        }
+    }
+    // Nothing is known to be synced in this segment.
+    st.synced = position(st.segment, 0);
+    *state_ = st;
+}
+
+// Start a new segment. The old one is synced first, so that syncing
+// only ever has to care about the current segment.
+void AuditLog::rotate()
+{
+    if (sync_ && fdatasync(seg_fd_)) {
+        throw SysError("fdatasync(" + dir_ + "/" + audit_segment_name(seg_) + ")");
+    }
+    open_segment(state_->segment + 1, true);
+    if (sync_ && fsync(dir_fd_)) {
+        throw SysError("fsync(" + dir_ + ")");
+    }
+    state_->segment = seg_;
+    state_->size = 0;
+    __atomic_store_n(&state_->synced, position(seg_, 0), __ATOMIC_RELEASE);
+}
+
+void AuditLog::append(simproto::AuditRecord record)
+{
+    uint64_t pos;
+    {
+        FileLock _(state_fd_, LOCK_EX, lock_deadline(), "audit log " + dir_);
+        if (state_->magic != magic) {
+            recover();
+        } else {
+            if (seg_ != state_->segment) {
+                open_segment(state_->segment, false);
+            }
+            struct stat st {
+            };
+            if (fstat(seg_fd_, &st)) {
+                throw SysError("fstat(" + dir_ + "/" + audit_segment_name(seg_) + ")");
+            }
+            if (static_cast<uint64_t>(st.st_size) != state_->size) {
+                recover();
+            }
+        }
+
+        record.set_seq(state_->seq);
+        record.set_prev_hash(state_->last.data(), state_->last.size());
+        std::string rec;
+        if (!record.SerializeToString(&rec)) {
+            throw std::runtime_error("failed to serialize audit record");
+        }
+        const auto data = encode_varint(rec.size()) + rec;
+        if (state_->size > 0 && state_->size + data.size() > segment_bytes_) {
+            rotate();
+        }
+        const ssize_t rc = write(seg_fd_, data.data(), data.size());
+        if (rc != static_cast<ssize_t>(data.size())) {
+            const SysError err("write(" + dir_ + "/" + audit_segment_name(seg_) + ")");
+            // Don't leave a partial record behind.
+            (void)ftruncate(seg_fd_, state_->size);
+            if (rc == -1) {
+                throw err;
+            }
+            throw std::runtime_error("short write to audit log " + dir_);
+        }
+        state_->size += data.size();
+        state_->seq++;
+        state_->last = sha256(rec);
+        pos = position(seg_, state_->size);
+    }
+    if (sync_) {
+        sync(pos);
+    }
+}
+
+// Group commit. Whoever holds the segment's lock is syncing it. Once
+// we have it, anything written before the previous holder started is
+// on disk, which is usually our record too. If not, sync everything
+// written so far, for whoever is waiting behind us.
+void AuditLog::sync(uint64_t pos)
+{
+    if (__atomic_load_n(&state_->synced, __ATOMIC_ACQUIRE) >= pos) {
+        return;
+    }
+    FileLock _(seg_fd_, LOCK_EX, lock_deadline(), "audit log " + dir_);
+    if (__atomic_load_n(&state_->synced, __ATOMIC_ACQUIRE) >= pos) {
+        return;
+    }
+    struct stat st {
+    };
+    if (fstat(seg_fd_, &st)) {
+        throw SysError("fstat(" + dir_ + "/" + audit_segment_name(seg_) + ")");
+    }
+    if (fdatasync(seg_fd_)) {
+        throw SysError("fdatasync(" + dir_ + "/" + audit_segment_name(seg_) + ")");
+    }
+    const uint64_t done = position(seg_, st.st_size);
+    uint64_t cur = __atomic_load_n(&state_->synced, __ATOMIC_RELAXED);
+    while (cur < done && !__atomic_compare_exchange_n(&state_->synced,
+                                                      &cur,
+                                                      done,
+                                                      false,
+                                                      __ATOMIC_RELEASE,
+                                                      __ATOMIC_RELAXED)) {
+    }
+}
+
+std::string audit_segment_name(uint64_t n)
+{
+    std::array<char, segment_digits + 1> buf{};
+    snprintf(buf.data(), buf.size(), "%016llx", static_cast<unsigned long long>(n));
+    return buf.data() + std::string(segment_suffix);
+}
+
+std::vector<uint64_t> audit_segments(const std::string& dir)
+{
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        throw SysError("opendir(" + dir + ")");
+    }
+    Defer _([d] { closedir(d); });
+    std::vector<uint64_t> ret;
+    const std::string suffix = segment_suffix;
+    while (const struct dirent* ent = readdir(d)) {
+        const std::string name = ent->d_name;
+        if (name.size() != segment_digits + suffix.size() ||
+            name.compare(segment_digits, suffix.size(), suffix) ||
+            name.find_first_not_of("0123456789abcdef") != segment_digits) {
+            continue;
+        }
+        ret.push_back(strtoull(name.c_str(), nullptr, 16));
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+size_t scan_audit_segment(const char* data,
+                          size_t len,
+                          const std::function<void(size_t, const char*, size_t)>& f)
+{
+    size_t ofs = 0;
+    while (ofs < len) {
+        uint64_t n;
+        const size_t used = decode_varint(data + ofs, len - ofs, &n);
+        if (used == 0 || n > len - ofs - used) {
+            break;
+        }
+        f(ofs, data + ofs + used, n);
+        ofs += used + n;
+    }
+    return ofs;
+}
+
+bool parse_audit_record(const char* data,
+                        size_t len,
+                        size_t offset,
+                        simproto::AuditRecord* rec)
+{
+    if (offset >= len) {
+        return false;
+    }
+    uint64_t n;
+    const size_t used = decode_varint(data + offset, len - offset, &n);
+    if (used == 0 || n > len - offset - used) {
+        return false;
+    }
+    return rec->ParseFromArray(data + offset + used, n);
+}
+
+} // namespace Sim
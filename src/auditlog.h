@@ -0,0 +1,107 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Append only audit log, with each record hash chained to the one
+ * before it.
+ *
+ * The log is a directory of segment files, named by their number in
+ * hex, e.g. "0000000000000001.log". Each segment is a sequence of
+ * records, each a varint length followed by a serialized AuditRecord.
+ * Every record holds the SHA-256 of the one before it, across
+ * segments, so removing or changing a record breaks the chain.
+ *
+ * Writers (any number of processes) append under a lock, and share a
+ * small mmap()ed file, "state", with the current segment, its size,
+ * and the hash of the last record. If the state doesn't match the
+ * segment, e.g. after a crash, it's rebuilt by reading the segment,
+ * and any partly written record at the end is cut off.
+ *
+ * Syncing is shared: a writer that finds its record already synced by
+ * someone else is done, otherwise it syncs everything written so far.
+ * So a burst of appends costs one fdatasync() per batch, not one per
+ * record.
+ */
+#include "simproto.pb.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Sim {
+
+class AuditLog
+{
+public:
+    // Open the log in directory `dir`, creating it if needed. The
+    // directory must be owned by the effective user, and not writable
+    // by anyone else.
+    AuditLog(const std::string& dir, uint64_t segment_bytes, bool sync);
+    ~AuditLog();
+
+    // No copy or move.
+    AuditLog(const AuditLog&) = delete;
+    AuditLog(AuditLog&&) = delete;
+    AuditLog& operator=(const AuditLog&) = delete;
+    AuditLog& operator=(AuditLog&&) = delete;
+
+    // Append a record, setting its seq and prev_hash. With sync, only
+    // returns once it's on disk. Throws LockBusy if another writer
+    // holds the log for too long.
+    void append(simproto::AuditRecord record);
+
+private:
+    struct State;
+    void open_segment(uint64_t n, bool create);
+    void recover();
+    void rotate();
+    void sync(uint64_t pos);
+
+    const std::string dir_;
+    const uint64_t segment_bytes_;
+    const bool sync_;
+    int dir_fd_ = -1;
+    int state_fd_ = -1;
+    State* state_ = nullptr;
+
+    // Open segment, and its number.
+    int seg_fd_ = -1;
+    uint64_t seg_ = 0;
+};
+
+// Name of segment `n`, in the log directory.
+[[nodiscard]] std::string audit_segment_name(uint64_t n);
+
+// Numbers of the segments in log directory `dir`, in order.
+[[nodiscard]] std::vector<uint64_t> audit_segments(const std::string& dir);
+
+// Call `f` with the offset and serialized AuditRecord of each complete
+// record in `data`, the contents of a segment. Returns the length of
+// the complete records, which is less than `len` if the last record is
+// cut short.
+size_t scan_audit_segment(const char* data,
+                          size_t len,
+                          const std::function<void(size_t, const char*, size_t)>& f);
+
+// Parse the record at `offset` in `data`, the contents of a segment.
+// Returns false if there's no complete and valid record there.
+[[nodiscard]] bool parse_audit_record(const char* data,
+                                      size_t len,
+                                      size_t offset,
+                                      simproto::AuditRecord* rec);
+
+} // namespace Sim
@@ -0,0 +1,152 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "auditlog.h"
+#include "sha256.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<map>
+#include<string>
+
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<unistd.h>
+
+namespace {
+std::string read_file(const std::string& fn)
+{
+  const int fd = open(fn.c_str(), O_RDONLY);
+  assert(fd != -1);
+  struct stat st{};
+  assert(!fstat(fd, &st));
+  std::string ret(st.st_size, '\0');
+  assert(pread(fd, &ret[0], ret.size(), 0) == st.st_size);
+  close(fd);
+  return ret;
+}
+
+// Check the whole chain, and return the number of records per pid.
+std::map<uint32_t, int> verify(const std::string& dir)
+{
+  std::map<uint32_t, int> ret;
+  uint64_t seq = 0;
+  Sim::Digest prev{};
+  for (const auto n : Sim::audit_segments(dir)) {
+    const auto data = read_file(dir + "/" + Sim::audit_segment_name(n));
+    const auto valid = Sim::scan_audit_segment(
+        data.data(), data.size(), [&](size_t, const char* rec, size_t len) {
+          simproto::AuditRecord r;
+          assert(r.ParseFromArray(rec, len));
+          assert(r.seq() == seq);
+          assert(r.prev_hash() == std::string(prev.begin(), prev.end()));
+          seq++;
+          prev = Sim::sha256(std::string(rec, len));
+          ret[r.pid()]++;
+        });
+    assert(valid == data.size());
+  }
+  return ret;
+}
+
+void append(Sim::AuditLog* log, int n)
+{
+  simproto::AuditRecord r;
+  r.set_type(simproto::AuditRecord::EXECUTED);
+  r.set_seq(0);
+  r.set_prev_hash("");
+  r.set_pid(getpid());
+  r.set_comment("record " + std::to_string(n));
+  log->append(r);
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+
+  char tmpl[] = "/tmp/auditlog_test.XXXXXX";
+  const char* tmp = mkdtemp(tmpl);
+  assert(tmp != nullptr);
+  const std::string dir = std::string(tmp) + "/log";
+
+  // Concurrent writers, with segments small enough to rotate often.
+  constexpr int procs = 4;
+  constexpr int records = 50;
+  std::vector<pid_t> pids;
+  for (int c = 0; c < procs; c++) {
+    const pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+      AuditLog log(dir, 1024, true);
+      for (int r = 0; r < records; r++) {
+        append(&log, r);
+      }
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  for (const auto pid : pids) {
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  auto counts = verify(dir);
+  assert(counts.size() == procs);
+  for (const auto& c : counts) {
+    assert(c.second == records);
+  }
+  const auto segs = audit_segments(dir);
+  assert(segs.size() > 1);
+  assert(segs.front() == 1);
+
+  // A partly written record at the end is cut off.
+  const auto last = dir + "/" + audit_segment_name(segs.back());
+  {
+    const int fd = open(last.c_str(), O_WRONLY | O_APPEND);
+    assert(fd != -1);
+    assert(write(fd, "\x50garbage", 8) == 8);
+    close(fd);
+  }
+  {
+    AuditLog log(dir, 1024, false);
+    append(&log, 0);
+  }
+  counts = verify(dir);
+  assert(counts[getpid()] == 1);
+
+  // Losing the state only means rebuilding it.
+  assert(!unlink((dir + "/state").c_str()));
+  {
+    AuditLog log(dir, 1024, true);
+    append(&log, 1);
+  }
+  counts = verify(dir);
+  assert(counts[getpid()] == 2);
+
+  // An empty segment continues the chain from the one before it.
+  {
+    const auto next = dir + "/" + audit_segment_name(audit_segments(dir).back() + 1);
+    const int fd = open(next.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    assert(fd != -1);
+    close(fd);
+    assert(!unlink((dir + "/state").c_str()));
+    AuditLog log(dir, 1024, true);
+    append(&log, 2);
+  }
+  counts = verify(dir);
+  assert(counts[getpid()] == 3);
+
+  // Others must not be able to write.
+  assert(!chmod(dir.c_str(), 0777));
+  bool threw = false;
+  try {
+    AuditLog log(dir, 1024, true);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+
+  assert(!system(("rm -r " + std::string(tmpl)).c_str()));
+}
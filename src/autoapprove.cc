@@ -0,0 +1,146 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "autoapprove.h"
+
+// Project
+#include "policy.h"
+
+// C++
+#include <algorithm>
+#include <regex>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace Sim {
+namespace {
+constexpr uint32_t minutes_per_day = 24 * 60;
+constexpr uint32_t days_per_week = 7;
+
+[[nodiscard]] bool in_window(const simproto::TimeWindow& w, const struct tm& tm)
+{
+    const uint32_t minute = tm.tm_hour * 60 + tm.tm_min;
+    const uint32_t day = tm.tm_wday;
+    const auto on = [&w](uint32_t d) {
+        return w.weekday().empty() ||
+               std::find(w.weekday().begin(), w.weekday().end(), d) !=
+                   w.weekday().end();
+    };
+    if (w.start_minute() <= w.end_minute()) {
+        return on(day) && minute >= w.start_minute() && minute < w.end_minute();
+    }
+    // Spans midnight, so the early part started the day before.
+    return (on(day) && minute >= w.start_minute()) ||
+           (on((day + days_per_week - 1) % days_per_week) && minute < w.end_minute());
+}
+} // namespace
+
+struct AutoApprover::Rule {
+    explicit Rule(const simproto::ApproveRule& r)
+        : rule(r),
+          users(r.user().begin(), r.user().end()),
+          hosts(r.host().begin(), r.host().end()),
+          justification(r.justification_regex().empty()
+                            ? nullptr
+                            : std::make_unique<std::regex>(r.justification_regex())),
+          // Only names are matched, so the PATH makes no difference.
+          commands(r.command(), "")
+    {
+    }
+
+    // Only by name. Resolving args[0] here, in another process, with
+    // the requester's PATH and our own working directory, could find a
+    // different file than the one sim will run.
+    [[nodiscard]] bool match_command(const simproto::Command& cmd) const
+    {
+        const std::vector<std::string> args(cmd.args().begin(), cmd.args().end());
+        return commands.match(args, nullptr);
+    }
+
+    const simproto::ApproveRule rule;
+    const std::unordered_set<std::string> users;
+    const std::unordered_set<std::string> hosts;
+    const std::unique_ptr<std::regex> justification;
+    const CommandMatcher commands;
+};
+
+AutoApprover::AutoApprover(const simproto::ApprovePolicy& policy)
+{
+    for (const auto& r : policy.rule()) {
+        if (r.command().empty()) {
+            throw std::runtime_error("rule <" + r.name() + "> has no commands");
+        }
+        for (const auto& w : r.window()) {
+            if (w.start_minute() > minutes_per_day || w.end_minute() > minutes_per_day) {
+                throw std::runtime_error("rule <" + r.name() +
+                                         "> has a window outside of the day");
+            }
+            for (const auto d : w.weekday()) {
+                if (d >= days_per_week) {
+                    throw std::runtime_error("rule <" + r.name() + "> has a bad weekday");
+                }
+            }
+        }
+        rules_.push_back(std::make_unique<Rule>(r));
+    }
+}
+
+AutoApprover::~AutoApprover() = default;
+
+const simproto::ApproveRule* AutoApprover::match(const simproto::ApproveRequest& req,
+                                                 const std::string& user,
+                                                 time_t now) const
+{
+    if (req.has_edit() || req.edits_size() > 0 ||
+        (!req.has_command() && req.batch().empty())) {
+        return nullptr;
+    }
+    struct tm tm {
+    };
+    localtime_r(&now, &tm);
+    for (const auto& r : rules_) {
+        if (!r->users.empty() && !r->users.count(user)) {
+            continue;
+        }
+        if (!r->hosts.empty() && !r->hosts.count(req.host())) {
+            continue;
+        }
+        if (r->justification &&
+            !std::regex_match(req.justification(), *r->justification)) {
+            continue;
+        }
+        const auto& windows = r->rule.window();
+        if (!windows.empty() &&
+            std::none_of(windows.begin(), windows.end(), [&tm](const auto& w) {
+                return in_window(w, tm);
+            })) {
+            continue;
+        }
+        bool ok = !req.has_command() || r->match_command(req.command());
+        for (const auto& cmd : req.batch()) {
+            ok = ok && r->match_command(cmd);
+        }
+        if (ok) {
+            return &r->rule;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace Sim
@@ -0,0 +1,58 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Compiled form of an ApprovePolicy, for `approve --policy`.
+ *
+ * Regexes and command indexes are built once, not per request.
+ * Commands are matched by name only, as given in the request. sim
+ * resolves them itself, and approve can't know that it would find the
+ * same file.
+ */
+#include "simproto.pb.h"
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Sim {
+
+class AutoApprover
+{
+public:
+    // Throws if a rule is invalid, e.g. has no commands.
+    explicit AutoApprover(const simproto::ApprovePolicy& policy);
+    ~AutoApprover();
+
+    // No copy or move.
+    AutoApprover(const AutoApprover&) = delete;
+    AutoApprover(AutoApprover&&) = delete;
+    AutoApprover& operator=(const AutoApprover&) = delete;
+    AutoApprover& operator=(AutoApprover&&) = delete;
+
+    // The first rule approving `req` from `user` at `now`, or null.
+    // `user` must come from the credentials of the requester, not from
+    // the request.
+    [[nodiscard]] const simproto::ApproveRule*
+    match(const simproto::ApproveRequest& req, const std::string& user, time_t now) const;
+
+private:
+    struct Rule;
+    std::vector<std::unique_ptr<Rule>> rules_;
+};
+
+} // namespace Sim
@@ -0,0 +1,141 @@
+#include "autoapprove.h"
+
+#include "google/protobuf/text_format.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<stdexcept>
+
+namespace {
+simproto::ApprovePolicy parse(const std::string& s)
+{
+  simproto::ApprovePolicy p;
+  assert(google::protobuf::TextFormat::ParseFromString(s, &p));
+  return p;
+}
+
+simproto::ApproveRequest request(const std::vector<std::string>& args)
+{
+  simproto::ApproveRequest req;
+  req.set_host("db1");
+  auto cmd = req.mutable_command();
+  cmd->set_cwd("/");
+  cmd->set_command(args[0]);
+  for (const auto& a : args) {
+    cmd->add_args(a);
+  }
+  auto e = cmd->add_environ();
+  e->set_key("PATH");
+  e->set_value("/bin:/usr/bin");
+  return req;
+}
+
+// Local time on 2026-10-14, a Wednesday.
+time_t at(int hour, int minute, int days = 0)
+{
+  struct tm tm{};
+  tm.tm_year = 126;
+  tm.tm_mon = 9;
+  tm.tm_mday = 14 + days;
+  tm.tm_hour = hour;
+  tm.tm_min = minute;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+
+  const AutoApprover a(parse(R"(
+    rule {
+      name: "restart"
+      user: "ci"
+      host: "db1"
+      command { command: "systemctl" args { arg { literal: "restart" } arg { glob: "*.service" } } }
+      justification_regex: "TICKET-[0-9]+"
+      window { start_minute: 540 end_minute: 1020 weekday: 1 weekday: 2 weekday: 3 }
+    }
+    rule {
+      name: "night"
+      user: "deploy"
+      command { command: "true" }
+      window { start_minute: 1320 end_minute: 120 weekday: 3 }
+    }
+  )"));
+
+  auto req = request({ "systemctl", "restart", "a.service" });
+  req.set_justification("TICKET-12");
+  const auto day = at(12, 0);
+  const auto r = a.match(req, "ci", day);
+  assert(r != nullptr && r->name() == "restart");
+
+  // Only by name, not by the file it resolves to.
+  auto abs = request({ "/bin/systemctl", "restart", "a.service" });
+  abs.set_justification("TICKET-12");
+  assert(a.match(abs, "ci", day) == nullptr);
+
+  // Every condition must hold.
+  assert(!a.match(req, "eve", day));
+  assert(!a.match(req, "ci", at(8, 59)));
+  assert(!a.match(req, "ci", at(17, 0)));
+  assert(!a.match(req, "ci", at(12, 0, 1))); // Thursday.
+  {
+    auto r2 = req;
+    r2.set_host("db2");
+    assert(!a.match(r2, "ci", day));
+    r2 = req;
+    r2.set_justification("TICKET-12 and more");
+    assert(!a.match(r2, "ci", day));
+    r2 = request({ "systemctl", "stop", "a.service" });
+    r2.set_justification("TICKET-12");
+    assert(!a.match(r2, "ci", day));
+    r2 = request({ "./systemctl", "restart", "a.service" });
+    r2.set_justification("TICKET-12");
+    assert(!a.match(r2, "ci", day));
+  }
+
+  // Batches need every command to match.
+  {
+    simproto::ApproveRequest b;
+    b.set_host("db1");
+    b.set_justification("TICKET-1");
+    *b.add_batch() = req.command();
+    *b.add_batch() = req.command();
+    assert(a.match(b, "ci", day));
+    *b.add_batch() = request({ "rm", "-rf", "/" }).command();
+    assert(!a.match(b, "ci", day));
+  }
+
+  // Edits never match.
+  {
+    auto e = req;
+    e.mutable_edit()->set_filename("/etc/passwd");
+    assert(!a.match(e, "ci", day));
+  }
+
+  // Windows over midnight started the day before.
+  {
+    const auto t = request({ "true" });
+    assert(a.match(t, "deploy", at(23, 0)));
+    assert(a.match(t, "deploy", at(1, 0, 1)));
+    assert(!a.match(t, "deploy", at(1, 0)));
+    assert(!a.match(t, "deploy", at(3, 0, 1)));
+  }
+
+  // Bad rules.
+  for (const auto& bad : {
+         "rule { name: \"x\" }",
+         "rule { name: \"x\" command { command: \"ls\" } window { end_minute: 2000 } }",
+         "rule { name: \"x\" command { command: \"ls\" } window { weekday: 7 } }",
+       }) {
+    bool thrown = false;
+    try {
+      const AutoApprover b(parse(bad));
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+}
@@ -0,0 +1,321 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "batch.h"
+
+// Project
+#include "policy.h"
+#include "util.h"
+
+// C++
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// POSIX
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+
+// A started command, and its output not yet printed.
+struct Job {
+    size_t index;
+    pid_t pid;
+    std::array<int, 2> fds;           // stdout, stderr. -1 once at EOF.
+    std::array<std::string, 2> partial; // Output not yet ending in newline.
+};
+
+void write_all(int fd, const std::string& s)
+{
+    for (size_t ofs = 0; ofs < s.size();) {
+        const auto rc = ::write(fd, s.data() + ofs, s.size() - ofs);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("write");
+        }
+        ofs += rc;
+    }
+}
+
+[[nodiscard]] std::string tag(size_t index)
+{
+    return "[" + std::to_string(index + 1) + "] ";
+}
+
+// Print the complete lines in `buf` with a tag, leaving the rest.
+void flush_lines(int fd, size_t index, std::string* buf)
+{
+    std::string out;
+    size_t start = 0;
+    for (size_t nl; (nl = buf->find('\n', start)) != std::string::npos; start = nl + 1) {
+        out += tag(index) + buf->substr(start, nl - start + 1);
+    }
+    buf->erase(0, start);
+    write_all(fd, out);
+}
+
+[[nodiscard]] Job start(size_t index,
+                        const std::vector<std::string>& args,
+                        const Executable& exe,
+                        const std::map<std::string, std::string>& env,
+                        bool own_stdin)
+{
+    std::array<int, 2> out{};
+    std::array<int, 2> err{};
+    if (pipe2(out.data(), O_CLOEXEC)) {
+        throw SysError("pipe2");
+    }
+    if (pipe2(err.data(), O_CLOEXEC)) {
+        const auto e = SysError("pipe2");
+        ::close(out[0]);
+        ::close(out[1]);
+        throw e;
+    }
+
+    const pid_t pid = fork();
+    if (pid == -1) {
+        const auto e = SysError("fork");
+        for (const auto fd : { out[0], out[1], err[0], err[1] }) {
+            ::close(fd);
+        }
+        throw e;
+    }
+    if (pid == 0) {
+        if (dup2(out[1], STDOUT_FILENO) == -1 || dup2(err[1], STDERR_FILENO) == -1) {
+            _exit(127);
+        }
+        if (!own_stdin) {
+            const int null = open("/dev/null", O_RDONLY);
+            if (null == -1 || dup2(null, STDIN_FILENO) == -1) {
+                _exit(127);
+            }
+        }
+        clearenv();
+        for (const auto& e : env) {
+            setenv(e.first.c_str(), e.second.c_str(), 1);
+        }
+        std::vector<char*> argv;
+        for (const auto& a : args) {
+            argv.push_back(const_cast<char*>(a.c_str()));
+        }
+        argv.push_back(nullptr);
+        exe.exec(argv.data());
+        const std::string msg = "sim: exec(" + args[0] + "): " + strerror(errno) + "\n";
+        (void)!::write(STDERR_FILENO, msg.data(), msg.size());
+        _exit(127);
+    }
+    ::close(out[1]);
+    ::close(err[1]);
+    return Job{ index, pid, { out[0], err[0] }, {} };
+}
+
+// Wait for the job, and return its exit status, shell style.
+[[nodiscard]] int reap(const Job& job)
+{
+    int status = 0;
+    while (waitpid(job.pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            throw SysError("waitpid");
+        }
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+} // namespace
+
+std::vector<std::vector<std::string>> parse_batch(const std::string& data)
+{
+    std::vector<std::vector<std::string>> ret;
+    size_t lineno = 0;
+    for (size_t start = 0; start < data.size();) {
+        auto end = data.find('\n', start);
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+        const auto line = data.substr(start, end - start);
+        start = end + 1;
+        lineno++;
+
+        std::vector<std::string> words;
+        std::string word;
+        bool in_word = false;
+        char quote = 0;
+        for (size_t c = 0; c < line.size(); c++) {
+            const char ch = line[c];
+            if (quote == '\'') {
+                if (ch == '\'') {
+                    quote = 0;
+                } else {
+                    word += ch;
+                }
+                continue;
+            }
+            if (ch == '\\') {
+                if (c + 1 == line.size()) {
+                    throw std::runtime_error("batch line " + std::to_string(lineno) +
+                                             ": backslash at end of line");
+                }
+                word += line[++c];
+                in_word = true;
+                continue;
+            }
+            if (quote == '"') {
+                if (ch == '"') {
+                    quote = 0;
+                } else {
+                    word += ch;
+                }
+                continue;
+            }
+            if (ch == '\'' || ch == '"') {
+                quote = ch;
+                in_word = true;
+                continue;
+            }
+            if (ch == ' ' || ch == '\t' || ch == '\r') {
+                if (in_word) {
+                    words.push_back(std::move(word));
+                    word.clear();
+                    in_word = false;
+                }
+                continue;
+            }
+            if (ch == '#' && !in_word && words.empty()) {
+                break;
+            }
+            word += ch;
+            in_word = true;
+        }
+        if (quote) {
+            throw std::runtime_error("batch line " + std::to_string(lineno) +
+                                     ": unterminated quote");
+        }
+        if (in_word) {
+            words.push_back(std::move(word));
+        }
+        if (!words.empty()) {
+            ret.push_back(std::move(words));
+        }
+    }
+    return ret;
+}
+
+int run_batch(const std::vector<std::vector<std::string>>& cmds,
+              const std::vector<Executable>& exes,
+              const std::map<std::string, std::string>& env,
+              int parallel)
+{
+    if (parallel < 1) {
+        throw std::runtime_error("parallelism must be at least 1");
+    }
+    if (exes.size() != cmds.size()) {
+        throw std::logic_error("run_batch: one executable per command needed");
+    }
+    std::vector<Job> running;
+    size_t next = 0;
+    int ret = 0;
+    for (;;) {
+        while (ret == 0 && next < cmds.size() &&
+               running.size() < static_cast<size_t>(parallel)) {
+            running.push_back(start(next, cmds[next], exes[next], env, parallel == 1));
+            next++;
+        }
+        if (running.empty()) {
+            break;
+        }
+
+        std::vector<struct pollfd> fds;
+        for (const auto& job : running) {
+            for (const auto fd : job.fds) {
+                if (fd != -1) {
+                    fds.push_back({ fd, POLLIN, 0 });
+                }
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("poll");
+        }
+
+        std::vector<Job> still;
+        for (auto& job : running) {
+            for (int n = 0; n < 2; n++) {
+                if (job.fds[n] == -1) {
+                    continue;
+                }
+                const auto ready = std::find_if(fds.begin(), fds.end(), [&](const auto& p) {
+                    return p.fd == job.fds[n];
+                });
+                if (ready == fds.end() || !ready->revents) {
+                    continue;
+                }
+                std::array<char, 4096> buf;
+                const auto rc = ::read(job.fds[n], buf.data(), buf.size());
+                if (rc == -1 && errno == EINTR) {
+                    continue;
+                }
+                const int out = n ? STDERR_FILENO : STDOUT_FILENO;
+                if (rc <= 0) {
+                    if (!job.partial[n].empty()) {
+                        job.partial[n] += '\n';
+                    }
+                    flush_lines(out, job.index, &job.partial[n]);
+                    ::close(job.fds[n]);
+                    job.fds[n] = -1;
+                    continue;
+                }
+                job.partial[n].append(buf.data(), rc);
+                flush_lines(out, job.index, &job.partial[n]);
+            }
+            if (job.fds[0] != -1 || job.fds[1] != -1) {
+                still.push_back(std::move(job));
+                continue;
+            }
+            const int status = reap(job);
+            std::cerr << "sim: " << tag(job.index) << cmds[job.index][0]
+                      << " exited with status " << status << std::endl;
+            if (status && !ret) {
+                ret = status;
+            }
+        }
+        running = std::move(still);
+    }
+    if (next < cmds.size()) {
+        std::cerr << "sim: Not running the remaining " << cmds.size() - next
+                  << " commands after failure\n";
+    }
+    return ret;
+}
+
+} // namespace Sim
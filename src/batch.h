@@ -0,0 +1,47 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * This file deals with `sim --batch`, where a list of commands is
+ * approved as one request, and then run.
+ */
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Sim {
+
+class Executable;
+
+// Parse a batch file. One command per line, split into words like a
+// shell would, with '' and "" quoting and backslash escapes, but no
+// expansion. Empty lines and lines starting with '#' are ignored.
+[[nodiscard]] std::vector<std::vector<std::string>> parse_batch(const std::string& data);
+
+// Run the commands with environment `env`, at most `parallel` at a
+// time, and return the exit status for sim. `exes` are the files to
+// run, one per command, as resolved when the batch was checked.
+//
+// Each line of output is prefixed with the 1-based number of the
+// command in the batch, e.g. "[3] ". Once a command fails no new
+// commands are started, and the status of the first failure is
+// returned.
+[[nodiscard]] int run_batch(const std::vector<std::vector<std::string>>& cmds,
+                            const std::vector<Executable>& exes,
+                            const std::map<std::string, std::string>& env,
+                            int parallel);
+
+} // namespace Sim
@@ -0,0 +1,69 @@
+#include "batch.h"
+#include "policy.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<fstream>
+#include<stdexcept>
+
+#include<sys/stat.h>
+#include<unistd.h>
+
+int main()
+{
+  using namespace Sim;
+
+  // Parsing.
+  {
+    const auto cmds = parse_batch("# Comment\n"
+                                  "\n"
+                                  "systemctl restart foo.service\n"
+                                  "  echo 'a b'  \"c d\" e\\ f\n"
+                                  "echo '' x#y \"it's\"\n"
+                                  "echo last");
+    assert(cmds.size() == 4);
+    assert((cmds[0] == std::vector<std::string>{ "systemctl", "restart", "foo.service" }));
+    assert((cmds[1] == std::vector<std::string>{ "echo", "a b", "c d", "e f" }));
+    assert((cmds[2] == std::vector<std::string>{ "echo", "", "x#y", "it's" }));
+    assert((cmds[3] == std::vector<std::string>{ "echo", "last" }));
+  }
+  for (const auto bad : { "echo 'x", "echo \"x", "echo x\\" }) {
+    bool threw = false;
+    try {
+      (void)parse_batch(bad);
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  // Running.
+  const std::map<std::string, std::string> env{ { "PATH", "/bin:/usr/bin" } };
+  auto run = [&env](const std::vector<std::vector<std::string>>& cmds, int parallel) {
+    std::vector<Executable> exes;
+    for (const auto& cmd : cmds) {
+      exes.emplace_back(cmd[0], env.at("PATH"));
+    }
+    return run_batch(cmds, exes, env, parallel);
+  };
+  assert(run({ { "true" }, { "echo", "hello" } }, 1) == 0);
+  assert(run({ { "true" }, { "sh", "-c", "exit 3" }, { "true" } }, 1) == 3);
+  assert(run({ { "true" }, { "false" }, { "true" } }, 3) == 1);
+  assert(run({ { "no-such-command-hopefully" } }, 1) == 127);
+
+  // Scripts are run by their interpreter, from the resolved file.
+  {
+    char tmpl[] = "/tmp/batch_test.XXXXXX";
+    const char* dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    const std::string script = std::string(dir) + "/script";
+    {
+      std::ofstream f(script);
+      f << "#!/bin/sh\nexit 4\n";
+    }
+    assert(!chmod(script.c_str(), 0700));
+    assert(run({ { script } }, 1) == 4);
+    assert(!unlink(script.c_str()));
+    assert(!rmdir(dir));
+  }
+}
@@ -0,0 +1,301 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "copyfile.h"
+
+// Project
+#include "util.h"
+
+// C++
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+namespace Sim {
+namespace {
+// Large enough that syscall overhead doesn't matter.
+constexpr size_t copy_buffer_size = 1024 * 1024;
+
+// Most copy_file_range() and sendfile() will do in one call.
+constexpr size_t max_chunk = 1 << 30;
+
+// Return true if the error means "this method can't be used here",
+// as opposed to an I/O error.
+[[nodiscard]] bool unsupported(int err)
+{
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP ||
+           err == ENOTTY || err == EBADF;
+}
+
+// Copies byte ranges from one file to another, at the same offset,
+// downgrading the method as needed.
+class RangeCopier
+{
+public:
+    RangeCopier(int src, int dst, CopyMethod method)
+        : src_(src), dst_(dst), method_(std::max(method, CopyMethod::copy_file_range))
+    {
+    }
+    [[nodiscard]] CopyMethod method() const noexcept { return method_; }
+
+    // Copy [ofs, end), or until the source ends.
+    void copy(off_t ofs, off_t end);
+
+private:
+    // Each returns bytes copied, 0 at end of file, or -1 with errno
+    // set.
+    [[nodiscard]] ssize_t copy_file_range_chunk(off_t ofs, size_t len);
+    [[nodiscard]] ssize_t sendfile_chunk(off_t ofs, size_t len);
+    [[nodiscard]] ssize_t readwrite_chunk(off_t ofs, size_t len);
+
+    const int src_;
+    const int dst_;
+    CopyMethod method_;
+    std::vector<char> buf_;
+};
+
+void RangeCopier::copy(off_t ofs, const off_t end)
+{
+    while (ofs < end) {
+        const size_t len = std::min<off_t>(end - ofs, max_chunk);
+        ssize_t rc = 0;
+        switch (method_) {
+        case CopyMethod::clone:
+        case CopyMethod::copy_file_range:
+            rc = copy_file_range_chunk(ofs, len);
+            break;
+        case CopyMethod::sendfile:
+            rc = sendfile_chunk(ofs, len);
+            break;
+        case CopyMethod::readwrite:
+            rc = readwrite_chunk(ofs, len);
+            break;
+        }
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (method_ != CopyMethod::readwrite && unsupported(errno)) {
+                method_ = static_cast<CopyMethod>(static_cast<int>(method_) + 1);
+                continue;
+            }
+            throw SysError("copying data with " + to_string(method_));
+        }
+        if (rc == 0) {
+            // Source got shorter.
+            return;
+        }
+        ofs += rc;
+    }
+}
+
+ssize_t RangeCopier::copy_file_range_chunk(off_t ofs, size_t len)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    loff_t in = ofs;
+    loff_t out = ofs;
+    return ::copy_file_range(src_, &in, dst_, &out, len, 0);
+#else
+    (void)ofs;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+ssize_t RangeCopier::sendfile_chunk(off_t ofs, size_t len)
+{
+#ifdef HAVE_SYS_SENDFILE_H
+    // sendfile() writes at the current offset of dst.
+    if (lseek(dst_, ofs, SEEK_SET) == -1) {
+        return -1;
+    }
+    off_t in = ofs;
+    return ::sendfile(dst_, src_, &in, len);
+#else
+    (void)ofs;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+ssize_t RangeCopier::readwrite_chunk(off_t ofs, size_t len)
+{
+    len = std::min(len, copy_buffer_size);
+    if (buf_.size() < len) {
+        buf_.resize(len);
+    }
+    const ssize_t rc = pread(src_, buf_.data(), len, ofs);
+    if (rc <= 0) {
+        return rc;
+    }
+    for (ssize_t done = 0; done < rc;) {
+        const ssize_t wrc = pwrite(dst_, buf_.data() + done, rc - done, ofs + done);
+        if (wrc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Not a fallback case, whatever the error.
+            throw SysError("pwrite");
+        }
+        done += wrc;
+    }
+    return rc;
+}
+
+// Copy a pipe or other unseekable file, in order.
+void copy_stream(int src, int dst)
+{
+    std::vector<char> buf(copy_buffer_size);
+    for (;;) {
+        const ssize_t rc = read(src, buf.data(), buf.size());
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("read");
+        }
+        if (rc == 0) {
+            return;
+        }
+        for (ssize_t done = 0; done < rc;) {
+            const ssize_t wrc = write(dst, buf.data() + done, rc - done);
+            if (wrc == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw SysError("write");
+            }
+            done += wrc;
+        }
+    }
+}
+
+// Find the next data after `ofs`. Returns false if there is none.
+// Without SEEK_DATA support, or if the file isn't sparse, all of
+// the file is data.
+[[nodiscard]] bool
+next_data(int fd, bool sparse, off_t ofs, off_t size, off_t* start, off_t* end)
+{
+#ifdef SEEK_DATA
+    if (sparse) {
+        const off_t data = lseek(fd, ofs, SEEK_DATA);
+        if (data != -1) {
+            const off_t hole = lseek(fd, data, SEEK_HOLE);
+            if (hole == -1) {
+                throw SysError("lseek(SEEK_HOLE)");
+            }
+            *start = data;
+            *end = std::min(hole, size);
+            return *start < *end;
+        }
+        if (errno == ENXIO) {
+            // Only hole left.
+            return false;
+        }
+        if (errno != EINVAL) {
+            throw SysError("lseek(SEEK_DATA)");
+        }
+        // Not supported by the filesystem.
+    }
+#else
+    (void)sparse;
+#endif
+    *start = ofs;
+    *end = size;
+    return ofs < size;
+}
+} // namespace
+
+std::string to_string(CopyMethod m)
+{
+    switch (m) {
+    case CopyMethod::clone:
+        return "clone";
+    case CopyMethod::copy_file_range:
+        return "copy_file_range";
+    case CopyMethod::sendfile:
+        return "sendfile";
+    case CopyMethod::readwrite:
+        return "readwrite";
+    }
+    return "unknown";
+}
+
+CopyMethod copy_data(int src, int dst, CopyMethod first)
+{
+    struct stat st {
+    };
+    if (fstat(src, &st)) {
+        throw SysError("fstat");
+    }
+    // Files in /proc and /sys claim to be empty.
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        copy_stream(src, dst);
+        return CopyMethod::readwrite;
+    }
+
+#ifdef FICLONE
+    if (first == CopyMethod::clone) {
+        if (!ioctl(dst, FICLONE, src)) {
+            return CopyMethod::clone;
+        }
+        if (!unsupported(errno)) {
+            throw SysError("ioctl(FICLONE)");
+        }
+    }
+#endif
+
+    // A file with all its blocks allocated has no holes to look for.
+    const bool sparse = st.st_blocks * 512 < st.st_size;
+
+    RangeCopier copier(src, dst, first);
+    for (off_t ofs = 0;;) {
+        off_t start;
+        off_t end;
+        if (!next_data(src, sparse, ofs, st.st_size, &start, &end)) {
+            break;
+        }
+        copier.copy(start, end);
+        ofs = end;
+    }
+
+    // Sets the size, including any hole at the end.
+    if (ftruncate(dst, st.st_size)) {
+        throw SysError("ftruncate");
+    }
+    return copier.method();
+}
+
+} // namespace Sim
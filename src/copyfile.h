@@ -0,0 +1,43 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Copying file contents for `sim -e`, as cheaply as the filesystem
+ * allows.
+ */
+#include <string>
+
+namespace Sim {
+
+// Ways to copy data, from cheapest to most expensive.
+enum class CopyMethod {
+    clone,           // Share the blocks (FICLONE), e.g. btrfs, XFS.
+    copy_file_range, // Copy in the kernel, maybe offloaded to the server.
+    sendfile,        // Copy in the kernel.
+    readwrite,       // pread()/pwrite() through a large buffer.
+};
+
+[[nodiscard]] std::string to_string(CopyMethod m);
+
+// Copy all of `src` into `dst`, which must be empty.
+//
+// Methods are tried from `first` and down, falling back when the
+// filesystem or kernel doesn't support one. Holes in `src` are found
+// with SEEK_DATA/SEEK_HOLE and skipped, so sparse files stay sparse.
+// Returns the method that copied the data.
+CopyMethod copy_data(int src, int dst, CopyMethod first = CopyMethod::clone);
+
+} // namespace Sim
@@ -0,0 +1,75 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "copyfile.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<string>
+
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+namespace {
+int make_tmp()
+{
+  char fn[] = "/tmp/copyfile_test.XXXXXX";
+  const int fd = mkstemp(fn);
+  assert(fd != -1);
+  unlink(fn);
+  return fd;
+}
+
+std::string read_all(int fd)
+{
+  struct stat st{};
+  assert(!fstat(fd, &st));
+  std::string ret(st.st_size, '\0');
+  assert(pread(fd, &ret[0], ret.size(), 0) == st.st_size);
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+
+  // Sparse file: data, a 64 MiB hole, data, and a hole at the end.
+  constexpr off_t hole = 64 * 1024 * 1024;
+  const int src = make_tmp();
+  const std::string head(100000, 'a');
+  const std::string mid = "in the middle";
+  assert(pwrite(src, head.data(), head.size(), 0) == static_cast<ssize_t>(head.size()));
+  assert(pwrite(src, mid.data(), mid.size(), hole) == static_cast<ssize_t>(mid.size()));
+  assert(!ftruncate(src, 2 * hole));
+  const auto want = read_all(src);
+
+  for (const auto m : { CopyMethod::clone, CopyMethod::copy_file_range,
+                        CopyMethod::sendfile, CopyMethod::readwrite }) {
+    const int dst = make_tmp();
+    const auto used = copy_data(src, dst, m);
+    assert(used >= m);
+    assert(read_all(dst) == want);
+
+    // The holes were not written.
+    struct stat st{};
+    assert(!fstat(dst, &st));
+    assert(st.st_blocks * 512 < hole);
+    close(dst);
+  }
+
+  // Pipes are copied until EOF.
+  {
+    int p[2];
+    assert(!pipe(p));
+    assert(write(p[1], "hello", 5) == 5);
+    close(p[1]);
+    const int dst = make_tmp();
+    assert(copy_data(p[0], dst) == CopyMethod::readwrite);
+    assert(read_all(dst) == "hello");
+    close(dst);
+    close(p[0]);
+  }
+  close(src);
+}
@@ -0,0 +1,558 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "diff.h"
+
+// C++
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace Sim {
+namespace {
+// Compare this much at a time when looking for the common prefix and
+// suffix.
+constexpr size_t compare_block = 4096;
+
+// Below this cost a diff is always minimal.
+constexpr int64_t min_too_expensive = 4096;
+
+struct Line {
+    size_t off;
+    size_t len;
+    uint64_t hash;
+};
+
+// FNV-1a.
+[[nodiscard]] uint64_t hash_line(const char* p, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t c = 0; c < len; c++) {
+        h ^= static_cast<unsigned char>(p[c]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+[[nodiscard]] size_t count_lines(const char* data, size_t begin, size_t end)
+{
+    size_t ret = 0;
+    for (size_t pos = begin; pos < end; ret++) {
+        const void* nl = memchr(data + pos, '\n', end - pos);
+        if (nl == nullptr) {
+            return ret + 1;
+        }
+        pos = static_cast<const char*>(nl) - data + 1;
+    }
+    return ret;
+}
+
+// Start of the line `n` lines before the line starting at `pos`.
+[[nodiscard]] size_t lines_back(const char* data, size_t pos, size_t n)
+{
+    for (; n > 0 && pos > 0; n--) {
+        const void* nl = memrchr(data, '\n', pos - 1);
+        pos = nl ? static_cast<const char*>(nl) - data + 1 : 0;
+    }
+    return pos;
+}
+
+// Start of the line `n` lines after the line starting at `pos`.
+[[nodiscard]] size_t lines_forward(const char* data, size_t pos, size_t end, size_t n)
+{
+    for (; n > 0 && pos < end; n--) {
+        const void* nl = memchr(data + pos, '\n', end - pos);
+        pos = nl ? static_cast<const char*>(nl) - data + 1 : end;
+    }
+    return pos;
+}
+
+[[nodiscard]] size_t common_prefix(const char* a, const char* b, size_t n)
+{
+    size_t pos = 0;
+    while (pos + compare_block <= n && !memcmp(a + pos, b + pos, compare_block)) {
+        pos += compare_block;
+    }
+    while (pos < n && a[pos] == b[pos]) {
+        pos++;
+    }
+    return pos;
+}
+
+// Length of the common suffix, at most n.
+[[nodiscard]] size_t common_suffix(const char* aend, const char* bend, size_t n)
+{
+    size_t len = 0;
+    while (len + compare_block <= n &&
+           !memcmp(aend - len - compare_block, bend - len - compare_block, compare_block)) {
+        len += compare_block;
+    }
+    while (len < n && aend[-1 - static_cast<ptrdiff_t>(len)] ==
+                          bend[-1 - static_cast<ptrdiff_t>(len)]) {
+        len++;
+    }
+    return len;
+}
+
+[[nodiscard]] std::vector<Line> split_lines(const char* data, size_t begin, size_t end)
+{
+    std::vector<Line> ret;
+    for (size_t pos = begin; pos < end;) {
+        const void* nl = memchr(data + pos, '\n', end - pos);
+        const size_t next = nl ? static_cast<const char*>(nl) - data + 1 : end;
+        ret.push_back(Line{ pos, next - pos, hash_line(data + pos, next - pos) });
+        pos = next;
+    }
+    return ret;
+}
+
+// Myers' O(ND) diff, in linear space by recursively splitting on a
+// point on an optimal path. Marks the lines of each side that are not
+// in the longest common subsequence.
+//
+// Like GNU diff, if finding the optimal split costs too much, a good
+// enough one is used instead. The diff is then still correct, just
+// not minimal.
+class Myers
+{
+public:
+    Myers(const char* a,
+          const std::vector<Line>& la,
+          const char* b,
+          const std::vector<Line>& lb,
+          uint64_t max_work);
+
+    void run() { compare(0, la_.size(), 0, lb_.size()); }
+
+    std::vector<bool> changed_a;
+    std::vector<bool> changed_b;
+
+private:
+    [[nodiscard]] bool eq(int64_t x, int64_t y) const
+    {
+        const auto& l1 = la_[x];
+        const auto& l2 = lb_[y];
+        return l1.hash == l2.hash && l1.len == l2.len &&
+               !memcmp(a_ + l1.off, b_ + l2.off, l1.len);
+    }
+
+    void compare(int64_t xoff, int64_t xlim, int64_t yoff, int64_t ylim);
+    void split(int64_t xoff, int64_t xlim, int64_t yoff, int64_t ylim, int64_t* xmid,
+               int64_t* ymid);
+
+    const char* a_;
+    const std::vector<Line>& la_;
+    const char* b_;
+    const std::vector<Line>& lb_;
+    const uint64_t max_work_;
+    uint64_t work_ = 0;
+    int64_t too_expensive_;
+
+    // Furthest reaching x per diagonal, forward and backward. Indexed
+    // by diagonal (x - y) plus diag_off_.
+    std::vector<int64_t> fdiag_;
+    std::vector<int64_t> bdiag_;
+    int64_t diag_off_;
+};
+
+Myers::Myers(const char* a,
+             const std::vector<Line>& la,
+             const char* b,
+             const std::vector<Line>& lb,
+             uint64_t max_work)
+    : changed_a(la.size()),
+      changed_b(lb.size()),
+      a_(a),
+      la_(la),
+      b_(b),
+      lb_(lb),
+      max_work_(max_work),
+      fdiag_(la.size() + lb.size() + 3),
+      bdiag_(la.size() + lb.size() + 3),
+      diag_off_(lb.size() + 1)
+{
+    // About the square root of the input size, like GNU diff.
+    too_expensive_ = 1;
+    for (auto n = la.size() + lb.size(); n != 0; n >>= 2) {
+        too_expensive_ <<= 1;
+    }
+    too_expensive_ = std::max(min_too_expensive, too_expensive_);
+}
+
+void Myers::compare(int64_t xoff, int64_t xlim, int64_t yoff, int64_t ylim)
+{
+    while (xoff < xlim && yoff < ylim && eq(xoff, yoff)) {
+        xoff++;
+        yoff++;
+    }
+    while (xoff < xlim && yoff < ylim && eq(xlim - 1, ylim - 1)) {
+        xlim--;
+        ylim--;
+    }
+    if (xoff == xlim || yoff == ylim) {
+        for (auto x = xoff; x < xlim; x++) {
+            changed_a[x] = true;
+        }
+        for (auto y = yoff; y < ylim; y++) {
+            changed_b[y] = true;
+        }
+        return;
+    }
+    int64_t xmid;
+    int64_t ymid;
+    split(xoff, xlim, yoff, ylim, &xmid, &ymid);
+    if (xmid < xoff || xmid > xlim || ymid < yoff || ymid > ylim ||
+        (xmid == xoff && ymid == yoff) || (xmid == xlim && ymid == ylim)) {
+        // Can't happen, but would recurse forever. Everything changed
+        // is a correct, if not minimal, answer.
+        for (auto x = xoff; x < xlim; x++) {
+            changed_a[x] = true;
+        }
+        for (auto y = yoff; y < ylim; y++) {
+            changed_b[y] = true;
+        }
+        return;
+    }
+    compare(xoff, xmid, yoff, ymid);
+    compare(xmid, xlim, ymid, ylim);
+}
+
+// Find a point (xmid, ymid) where an optimal path from (xoff, yoff) to
+// (xlim, ylim) crosses, by searching from both ends until the searches
+// meet.
+void Myers::split(int64_t xoff,
+                  int64_t xlim,
+                  int64_t yoff,
+                  int64_t ylim,
+                  int64_t* xmid,
+                  int64_t* ymid)
+{
+    int64_t* const fd = fdiag_.data() + diag_off_;
+    int64_t* const bd = bdiag_.data() + diag_off_;
+    const int64_t dmin = xoff - ylim;
+    const int64_t dmax = xlim - yoff;
+    const int64_t fmid = xoff - yoff;
+    const int64_t bmid = xlim - ylim;
+    int64_t fmin = fmid;
+    int64_t fmax = fmid;
+    int64_t bmin = bmid;
+    int64_t bmax = bmid;
+    const bool odd = (fmid - bmid) & 1;
+    constexpr int64_t unreached_back = std::numeric_limits<int64_t>::max();
+
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+
+    for (int64_t cost = 1;; cost++) {
+        // Extend the forward search by one edit in each diagonal.
+        if (fmin > dmin) {
+            fd[--fmin - 1] = -1;
+        } else {
+            fmin++;
+        }
+        if (fmax < dmax) {
+            fd[++fmax + 1] = -1;
+        } else {
+            fmax--;
+        }
+        for (int64_t d = fmax; d >= fmin; d -= 2) {
+            const int64_t tlo = fd[d - 1];
+            const int64_t thi = fd[d + 1];
+            const int64_t x0 = tlo < thi ? thi : tlo + 1;
+            int64_t x = x0;
+            int64_t y = x0 - d;
+            while (x < xlim && y < ylim && eq(x, y)) {
+                x++;
+                y++;
+            }
+            work_ += x - x0 + 1;
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        // Same backwards.
+        if (bmin > dmin) {
+            bd[--bmin - 1] = unreached_back;
+        } else {
+            bmin++;
+        }
+        if (bmax < dmax) {
+            bd[++bmax + 1] = unreached_back;
+        } else {
+            bmax--;
+        }
+        for (int64_t d = bmax; d >= bmin; d -= 2) {
+            const int64_t tlo = bd[d - 1];
+            const int64_t thi = bd[d + 1];
+            const int64_t x0 = tlo < thi ? tlo : thi - 1;
+            int64_t x = x0;
+            int64_t y = x0 - d;
+            while (xoff < x && yoff < y && eq(x - 1, y - 1)) {
+                x--;
+                y--;
+            }
+            work_ += x0 - x + 1;
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        if (cost < too_expensive_ && work_ < max_work_) {
+            continue;
+        }
+
+        // Too expensive. Split where either search got the furthest.
+        int64_t fxybest = -1;
+        int64_t fxbest = xoff;
+        for (int64_t d = fmax; d >= fmin; d -= 2) {
+            int64_t x = std::min(fd[d], xlim);
+            int64_t y = x - d;
+            if (ylim < y) {
+                x = ylim + d;
+                y = ylim;
+            }
+            if (fxybest < x + y) {
+                fxybest = x + y;
+                fxbest = x;
+            }
+        }
+        int64_t bxybest = std::numeric_limits<int64_t>::max();
+        int64_t bxbest = xlim;
+        for (int64_t d = bmax; d >= bmin; d -= 2) {
+            int64_t x = std::max(xoff, bd[d]);
+            int64_t y = x - d;
+            if (y < yoff) {
+                x = yoff + d;
+                y = yoff;
+            }
+            if (x + y < bxybest) {
+                bxybest = x + y;
+                bxbest = x;
+            }
+        }
+        if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+            *xmid = fxbest;
+            *ymid = fxybest - fxbest;
+        } else {
+            *xmid = bxbest;
+            *ymid = bxybest - bxbest;
+        }
+        return;
+    }
+}
+
+// Renders hunks, within the output limits.
+class Renderer
+{
+public:
+    Renderer(const DiffLimits& limits, std::string* out) : limits_(limits), out_(out) {}
+
+    // Add a line, with its prefix character. Once the output is full,
+    // lines are only counted.
+    void line(char prefix, const char* data, const Line& l);
+
+    [[nodiscard]] bool full() const { return out_->size() >= limits_.max_bytes; }
+    [[nodiscard]] size_t omitted() const noexcept { return omitted_; }
+
+private:
+    const DiffLimits& limits_;
+    std::string* out_;
+    size_t omitted_ = 0;
+};
+
+void Renderer::line(char prefix, const char* data, const Line& l)
+{
+    if (full()) {
+        omitted_++;
+        return;
+    }
+    const bool newline = l.len > 0 && data[l.off + l.len - 1] == '\n';
+    const size_t len = l.len - (newline ? 1 : 0);
+    out_->push_back(prefix);
+    if (len > limits_.max_line_bytes) {
+        out_->append(data + l.off, limits_.max_line_bytes);
+        *out_ += "... [" + std::to_string(len - limits_.max_line_bytes) + " more bytes]";
+    } else {
+        out_->append(data + l.off, len);
+    }
+    out_->push_back('\n');
+    if (!newline) {
+        *out_ += "\\ No newline at end of file\n";
+    }
+}
+
+// A run of changed lines, as [begin, end) on each side.
+struct Change {
+    size_t a_begin;
+    size_t a_end;
+    size_t b_begin;
+    size_t b_end;
+};
+
+[[nodiscard]] std::vector<Change> changes(const std::vector<bool>& ca,
+                                          const std::vector<bool>& cb)
+{
+    std::vector<Change> ret;
+    size_t x = 0;
+    size_t y = 0;
+    while (x < ca.size() || y < cb.size()) {
+        if (x < ca.size() && y < cb.size() && !ca[x] && !cb[y]) {
+            x++;
+            y++;
+            continue;
+        }
+        Change c{ x, x, y, y };
+        while (c.a_end < ca.size() && ca[c.a_end]) {
+            c.a_end++;
+        }
+        while (c.b_end < cb.size() && cb[c.b_end]) {
+            c.b_end++;
+        }
+        ret.push_back(c);
+        x = c.a_end;
+        y = c.b_end;
+    }
+    return ret;
+}
+
+// "@@ -l,s +l,s @@" range, 1-based, where an empty range is after
+// line l.
+[[nodiscard]] std::string hunk_range(size_t base, size_t begin, size_t end)
+{
+    const size_t len = end - begin;
+    const size_t start = base + begin + (len ? 1 : 0);
+    return std::to_string(start) + "," + std::to_string(len);
+}
+} // namespace
+
+std::string unified_diff(const char* a,
+                         size_t alen,
+                         const char* b,
+                         size_t blen,
+                         const std::string& name,
+                         const DiffLimits& limits)
+{
+    // Start of the line with the first difference.
+    const size_t prefix = common_prefix(a, b, std::min(alen, blen));
+    if (prefix == alen && prefix == blen) {
+        return "";
+    }
+    size_t start = prefix;
+    if (start > 0) {
+        const void* nl = memrchr(a, '\n', start);
+        start = nl ? static_cast<const char*>(nl) - a + 1 : 0;
+    }
+
+    // End of the line with the last difference. The identical part
+    // after it has to start on a line in both files.
+    const size_t suffix = common_suffix(a + alen, b + blen, std::min(alen, blen) - start);
+    size_t aend = alen - suffix;
+    size_t bend = blen - suffix;
+    const auto at_line = [](const char* data, size_t pos) {
+        return pos == 0 || data[pos - 1] == '\n';
+    };
+    if (!at_line(a, aend) || !at_line(b, bend)) {
+        const size_t skip = lines_forward(a, aend, alen, 1) - aend;
+        aend += skip;
+        bend += skip;
+    }
+
+    // Widen with context.
+    const size_t cstart = lines_back(a, start, limits.context);
+    const size_t skip = lines_forward(a, aend, alen, limits.context) - aend;
+    const size_t cend_a = aend + skip;
+    const size_t cend_b = bend + skip;
+
+    // Line number (0-based) of cstart.
+    const size_t base = count_lines(a, 0, cstart);
+
+    std::string out = "--- " + name + "\n+++ " + name + " (edited)\n";
+    if (memchr(a + cstart, 0, cend_a - cstart) || memchr(b + cstart, 0, cend_b - cstart)) {
+        return out + "Binary files differ\n";
+    }
+    const size_t lines_a = count_lines(a, cstart, cend_a);
+    const size_t lines_b = count_lines(b, cstart, cend_b);
+    if (lines_a > limits.max_lines || lines_b > limits.max_lines) {
+        const size_t first = count_lines(a, 0, start) + 1;
+        const size_t changed_a = count_lines(a, start, aend);
+        const size_t changed_b = count_lines(b, start, bend);
+        return out + "Too large to diff: " + std::to_string(changed_a) +
+               " lines from line " + std::to_string(first) + " replaced with " +
+               std::to_string(changed_b) + " lines\n";
+    }
+
+    const auto la = split_lines(a, cstart, cend_a);
+    const auto lb = split_lines(b, cstart, cend_b);
+    Myers myers(a, la, b, lb, limits.max_work);
+    myers.run();
+
+    // Group changes that are close enough to share context into hunks.
+    const auto chs = changes(myers.changed_a, myers.changed_b);
+    Renderer r(limits, &out);
+    size_t shown = 0;
+    for (size_t first = 0; first < chs.size() && !r.full();) {
+        size_t last = first;
+        while (last + 1 < chs.size() &&
+               chs[last + 1].a_begin - chs[last].a_end <= 2 * limits.context) {
+            last++;
+        }
+        const size_t a_begin = chs[first].a_begin - std::min(chs[first].a_begin, limits.context);
+        const size_t b_begin = chs[first].b_begin - (chs[first].a_begin - a_begin);
+        const size_t a_end = std::min(la.size(), chs[last].a_end + limits.context);
+        const size_t b_end = chs[last].b_end + (a_end - chs[last].a_end);
+        out += "@@ -" + hunk_range(base, a_begin, a_end) + " +" +
+               hunk_range(base, b_begin, b_end) + " @@\n";
+
+        size_t x = a_begin;
+        for (size_t c = first; c <= last; c++) {
+            for (; x < chs[c].a_begin; x++) {
+                r.line(' ', a, la[x]);
+            }
+            for (; x < chs[c].a_end; x++) {
+                r.line('-', a, la[x]);
+            }
+            for (size_t y = chs[c].b_begin; y < chs[c].b_end; y++) {
+                r.line('+', b, lb[y]);
+            }
+        }
+        for (; x < a_end; x++) {
+            r.line(' ', a, la[x]);
+        }
+        shown = last + 1;
+        first = last + 1;
+    }
+    if (r.omitted()) {
+        out += "... " + std::to_string(r.omitted()) + " lines not shown\n";
+    }
+    if (shown < chs.size()) {
+        out += "... " + std::to_string(chs.size() - shown) + " of " +
+               std::to_string(chs.size()) + " changes not shown\n";
+    }
+    return out;
+}
+
+} // namespace Sim
@@ -0,0 +1,61 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Unified diff of a file before and after `sim -e`, for the approver.
+ *
+ * Files can be huge, so this works on mmap()ed data and keeps memory
+ * bounded. The common prefix and suffix are compared byte by byte,
+ * without splitting into lines, so a small change to a large file
+ * only indexes the lines around the change. What's left is diffed
+ * with Myers' linear space algorithm, and the output is capped.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Sim {
+
+// Limits on how much work a diff may do, and how much it may output.
+// Past them the diff degrades to a summary, but never fails.
+struct DiffLimits {
+    // Lines of context around changes.
+    size_t context = 3;
+
+    // Above this many lines left after removing the common prefix and
+    // suffix, only summarize what changed.
+    size_t max_lines = 1 << 20;
+
+    // Give up on finding a minimal diff after this many steps.
+    uint64_t max_work = 100'000'000;
+
+    // Stop printing hunks after this many bytes of output.
+    size_t max_bytes = 256 * 1024;
+
+    // Truncate longer lines.
+    size_t max_line_bytes = 1024;
+};
+
+// Unified diff of `a` and `b`, using `name` in the headers. Empty if
+// they are the same.
+[[nodiscard]] std::string unified_diff(const char* a,
+                                       size_t alen,
+                                       const char* b,
+                                       size_t blen,
+                                       const std::string& name,
+                                       const DiffLimits& limits = DiffLimits());
+
+} // namespace Sim
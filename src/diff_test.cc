@@ -0,0 +1,179 @@
+#include "diff.h"
+
+#include<cassert>
+#include<random>
+#include<sstream>
+#include<string>
+#include<vector>
+
+namespace {
+std::string diff(const std::string& a, const std::string& b,
+                 const Sim::DiffLimits& limits = Sim::DiffLimits())
+{
+  return Sim::unified_diff(a.data(), a.size(), b.data(), b.size(), "f", limits);
+}
+
+std::string join(const std::vector<std::string>& lines)
+{
+  std::string ret;
+  for (const auto& l : lines) {
+    ret += l + "\n";
+  }
+  return ret;
+}
+
+size_t lcs(const std::vector<std::string>& a, const std::vector<std::string>& b)
+{
+  std::vector<std::vector<size_t>> t(a.size() + 1, std::vector<size_t>(b.size() + 1));
+  for (size_t x = 1; x <= a.size(); x++) {
+    for (size_t y = 1; y <= b.size(); y++) {
+      t[x][y] = a[x - 1] == b[y - 1] ? t[x - 1][y - 1] + 1
+                                     : std::max(t[x - 1][y], t[x][y - 1]);
+    }
+  }
+  return t[a.size()][b.size()];
+}
+
+// Check that a diff with enough context to cover both files turns a
+// into b, and return the number of changed lines.
+size_t check_full(const std::vector<std::string>& a, const std::vector<std::string>& b,
+                  const Sim::DiffLimits& limits)
+{
+  const auto d = diff(join(a), join(b), limits);
+  if (a == b) {
+    assert(d.empty());
+    return 0;
+  }
+  std::istringstream in(d);
+  std::string line;
+  std::vector<std::string> got_a;
+  std::vector<std::string> got_b;
+  size_t changed = 0;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 3, "---") == 0 || line.compare(0, 3, "+++") == 0 ||
+        line.compare(0, 2, "@@") == 0) {
+      continue;
+    }
+    const auto text = line.substr(1);
+    switch (line[0]) {
+    case ' ':
+      got_a.push_back(text);
+      got_b.push_back(text);
+      break;
+    case '-':
+      got_a.push_back(text);
+      changed++;
+      break;
+    case '+':
+      got_b.push_back(text);
+      changed++;
+      break;
+    default:
+      assert(false);
+    }
+  }
+  assert(got_a == a);
+  assert(got_b == b);
+  return changed;
+}
+} // namespace
+
+int main()
+{
+  // Same.
+  assert(diff("", "").empty());
+  assert(diff("a\nb\n", "a\nb\n").empty());
+
+  // Simple change, with context.
+  assert(diff("1\n2\n3\n4\n5\n6\n7\n8\n9\n", "1\n2\n3\n4\nfive\n6\n7\n8\n9\n") ==
+         "--- f\n+++ f (edited)\n"
+         "@@ -2,7 +2,7 @@\n 2\n 3\n 4\n-5\n+five\n 6\n 7\n 8\n");
+
+  // Adding to and removing from the ends, and missing final newlines.
+  assert(diff("a\n", "a\nb") == "--- f\n+++ f (edited)\n@@ -1,1 +1,2 @@\n a\n+b\n"
+                                "\\ No newline at end of file\n");
+  assert(diff("a\nb", "a\nb\n") == "--- f\n+++ f (edited)\n@@ -1,2 +1,2 @@\n a\n-b\n"
+                                   "\\ No newline at end of file\n+b\n");
+  assert(diff("", "x\n") == "--- f\n+++ f (edited)\n@@ -0,0 +1,1 @@\n+x\n");
+  assert(diff("x\n", "") == "--- f\n+++ f (edited)\n@@ -1,1 +0,0 @@\n-x\n");
+
+  assert(diff(std::string("a\0b", 3), "a") == "--- f\n+++ f (edited)\nBinary files differ\n");
+
+  // Minimal, for all small inputs.
+  {
+    Sim::DiffLimits full;
+    full.context = 1000;
+    std::vector<std::vector<std::string>> all;
+    for (int len = 0; len <= 6; len++) {
+      for (int bits = 0; bits < (1 << len); bits++) {
+        std::vector<std::string> s;
+        for (int c = 0; c < len; c++) {
+          s.push_back((bits >> c) & 1 ? "a" : "b");
+        }
+        all.push_back(s);
+      }
+    }
+    for (const auto& a : all) {
+      for (const auto& b : all) {
+        assert(check_full(a, b, full) == a.size() + b.size() - 2 * lcs(a, b));
+      }
+    }
+
+    // Myers' example.
+    const std::vector<std::string> a{ "A", "B", "C", "A", "B", "B", "A" };
+    const std::vector<std::string> b{ "C", "B", "A", "B", "A", "C" };
+    assert(check_full(a, b, full) == 5);
+
+    // Still correct when too expensive to be minimal.
+    std::mt19937 rng(1);
+    Sim::DiffLimits cheap = full;
+    cheap.max_work = 1;
+    for (int c = 0; c < 200; c++) {
+      std::vector<std::string> ra(rng() % 200);
+      std::vector<std::string> rb(rng() % 200);
+      for (auto& s : ra) {
+        s = std::string(1, 'a' + rng() % 4);
+      }
+      for (auto& s : rb) {
+        s = std::string(1, 'a' + rng() % 4);
+      }
+      (void)check_full(ra, rb, cheap);
+      assert(check_full(ra, rb, full) == ra.size() + rb.size() - 2 * lcs(ra, rb));
+    }
+  }
+
+  // Big file, small change.
+  {
+    std::string a;
+    for (int c = 0; c < 1000000; c++) {
+      a += "line " + std::to_string(c) + "\n";
+    }
+    auto b = a;
+    const std::string from = "line 500000\n";
+    b.replace(b.find(from), from.size(), "changed\n");
+    assert(diff(a, b) == "--- f\n+++ f (edited)\n"
+                         "@@ -499998,7 +499998,7 @@\n"
+                         " line 499997\n line 499998\n line 499999\n"
+                         "-line 500000\n+changed\n"
+                         " line 500001\n line 500002\n line 500003\n");
+
+    // Limits.
+    Sim::DiffLimits small;
+    small.max_bytes = 100;
+    small.max_lines = 5;
+    assert(diff(a, b, small).find("Too large to diff: 1 lines from line 500001 "
+                                  "replaced with 1 lines") != std::string::npos);
+    small.max_lines = 1 << 20;
+    b = a;
+    for (int c = 0; c < 10; c++) {
+      b[c * 100000] = 'X';
+    }
+    const auto d = diff(a, b, small);
+    assert(d.size() < 300);
+    assert(d.find("changes not shown") != std::string::npos);
+    small.max_line_bytes = 3;
+    assert(diff("abcdef\n", "abcdeg\n", small) ==
+           "--- f\n+++ f (edited)\n@@ -1,1 +1,1 @@\n-abc... [3 more bytes]\n"
+           "+abc... [3 more bytes]\n");
+  }
+}
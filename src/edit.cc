@@ -38,32 +38,49 @@
  *
  * So what this code does is:
  * 1. Copy the original file to /tmp, as a file owned by the calling user.
+ *    The original is opened as the user, so this is no way to read
+ *    files they can't otherwise read, unless sim has had that approved
+ *    first.
  * 2. Open an editor as the user.
- * 3. Copy the file back, into the original file's directory, but a
- *    temporary file called a "rename file".
- * 4. Rename (which is atomic) the "rename file" into the original file,
- *    replacing it.
+ * 3. Copy the file back, into a "staged file" in the original file's
+ *    directory (see StagedFile). It's owned by root, so the user can't
+ *    change it after this point.
+ * 4. Diff the original and the staged file, and get that approved.
+ * 5. Sync it to disk, and rename (which is atomic) it over the
+ *    original file, replacing it.
  *
  * The code is tricky, in order to avoid TOCTOU bugs.
  */
+// Self
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "edit.h"
 
 // Project
+#include "copyfile.h"
+#include "diff.h"
 #include "util.h"
 
 // C++
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 #include <utility>
 
 // POSIX
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -74,6 +91,9 @@ namespace Sim {
 namespace {
 constexpr int temp_filename_len = 32;
 
+// Most threads to copy files with, when editing several.
+constexpr size_t max_copy_threads = 8;
+
 // File descriptor wrapper.
 class FD
 {
@@ -159,15 +179,6 @@ public:
         }
         return fd;
     }
-    [[nodiscard]] FD open_create(const std::string& fn) const
-    {
-        if (fd_ != AT_FDCWD && fn.find('/') != std::string::npos) {
-            throw std::runtime_error("openat(" + str_ + ", " + fn +
-                                     "): can't have slashes in filename");
-        }
-        return FD(openat(fd_, fn.c_str(), O_WRONLY | O_NOFOLLOW | O_CREAT | O_EXCL, 0600),
-                  str_ + "/" + fn);
-    }
 
 private:
     int fd_;
@@ -214,24 +225,31 @@ void drop_privs()
     }
 }
 
-void run_editor(const std::string& editor, const std::string& fn)
+void run_editor(const std::string& editor, const std::vector<std::string>& fns)
 {
-    execlp(editor.c_str(), editor.c_str(), fn.c_str(), nullptr);
-    throw SysError("execlp(" + editor + ")");
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(editor.c_str()));
+    for (const auto& fn : fns) {
+        argv.push_back(const_cast<char*>(fn.c_str()));
+    }
+    argv.push_back(nullptr);
+    execvp(editor.c_str(), argv.data());
+    throw SysError("execvp(" + editor + ")");
 }
 
 // child process main function.
-[[nodiscard]] int editor_main(const std::string& editor, const std::string& fn)
+[[nodiscard]] int editor_main(const std::string& editor,
+                              const std::vector<std::string>& fns)
 {
     try {
-        run_editor(editor, fn);
+        run_editor(editor, fns);
     } catch (const std::exception& e) {
         std::cerr << "Editor failed: " << e.what() << std::endl;
     }
     return EXIT_FAILURE;
 }
 
-void spawn_editor(const std::string& fn)
+void spawn_editor(const std::vector<std::string>& fns)
 {
     const auto editor = get_editor();
 
@@ -241,7 +259,7 @@ void spawn_editor(const std::string& fn)
         throw SysError("failed to fork");
     case 0:
         drop_privs();
-        _exit(editor_main(editor, fn));
+        _exit(editor_main(editor, fns));
     default:
         // parent
         ;
@@ -274,39 +292,28 @@ void spawn_editor(const std::string& fn)
     }
 }
 
-// Helper function for tmpfile(), turning the C API mkstemp() into
+// Helper function for tmpfile(), turning the C API mkstemps() into
 // what we want in nice C++.
-[[nodiscard]] std::string tmpfile_backend(const std::string& s)
+[[nodiscard]] std::string tmpfile_backend(const std::string& s, const std::string& suffix)
 {
     std::vector<char> tmpl(s.begin(), s.end());
+    tmpl.insert(tmpl.end(), suffix.begin(), suffix.end());
     tmpl.push_back(0);
-    int fd = mkstemp(tmpl.data());
+    int fd = mkstemps(tmpl.data(), suffix.size());
     if (-1 == fd) {
-        throw SysError("mkstemp()");
+        throw SysError("mkstemps()");
     }
     ::close(fd);
     tmpl.pop_back(); // remove the null.
     return std::string(tmpl.begin(), tmpl.end());
 }
 
-// Create a temp file that the editor will open.
-[[nodiscard]] std::string tmpfile()
+// Create a temp file that the editor will open. It ends in the name of
+// the original, so that the user can tell them apart, and the editor
+// can tell the file type.
+[[nodiscard]] std::string tmpfile(const std::string& base)
 {
-    return tmpfile_backend(get_tmpdir() + "/sim.XXXXXX");
-}
-
-// In order to atomically replace the original file, we need to create
-// a file in that same directory. We call this file the "rename file".
-[[nodiscard]] std::string renametempfile(const Dir& dir, uid_t uid, const std::string& fn)
-{
-    PushEUID _(uid);
-    for (;;) {
-        const std::string name = "sim." + make_random_filename(temp_filename_len);
-        FD fd = dir.open_create(name);
-        if (!fd.bad()) {
-            return name;
-        }
-    }
+    return tmpfile_backend(get_tmpdir() + "/sim.XXXXXX", "-" + base);
 }
 
 // Split a path into all its components.
@@ -349,61 +356,66 @@ split(const std::string& fn)
     return dir;
 }
 
-// Copy a file by reading a writing.
+// One copy for copy_all(), from an open file to an open file.
 //
-// Optionally set UID to `uid` (root) for opening either file. If the
-// `_priv` bools are set to false, the mere normal mortal user will be
-// used.
-//
-// I.e.:
-// * orig->tempfile will have (src_priv,dst_priv) be (true, false)
-//   It needs to be able to read the source file.
-// * tempfile->renamefile will have (false, true)
-//   It needs to be able to write into the destination directory.
-void copy_file(const uid_t uid,
-               const bool src_priv,
-               const bool dst_priv,
-               const Dir& sdir,
-               const std::string& sfn,
-               const Dir& ddir,
-               const std::string& dfn)
-{
-    FD src = [&sfn, &sdir, uid, src_priv] {
-        std::unique_ptr<PushEUID> priv;
-        if (src_priv) {
-            priv = std::make_unique<PushEUID>(uid);
-        }
-        return sdir.must_open_read(sfn);
-    }();
-    FD dst = [&dfn, &ddir, uid, dst_priv] {
-        std::unique_ptr<PushEUID> priv;
-        if (dst_priv) {
-            priv = std::make_unique<PushEUID>(uid);
-        }
-        return ddir.must_open_write(dfn);
-    }();
+// The files are opened before copying, since which user they're opened
+// as is set per process, not per thread:
+// * orig->tempfile opens the source as `reader`, which is only root
+//   if reading it was approved, and the destination as the normal
+//   mortal user.
+// * tempfile->staged file is the other way around.
+struct CopyJob {
+    FD src;
+    int dst;
+    std::string dst_name;
+};
 
-    for (;;) {
-        char buf[4096];
-        const ssize_t rc = read(src.fd(), buf, sizeof(buf));
-        if (rc == -1) {
-            throw std::runtime_error("read error from " + src.str() + ": " +
-                                     strerror(errno));
-        }
-        if (rc == 0) {
-            break;
-        }
-        const char* p = buf;
-        size_t w = rc;
-        while (w > 0) {
-            const size_t wrc = write(dst.fd(), buf, w);
-            if (wrc == -1) {
-                throw std::runtime_error("write error to " + dst.str() + ": " +
-                                         strerror(errno));
+// Run the copies in parallel, using the cheapest method the filesystem
+// supports. They're mostly reflinks or in-kernel copies, so this is
+// about overlapping the waiting for the disk. Returns the bytes copied.
+uint64_t copy_all(const std::vector<CopyJob>& jobs)
+{
+    std::atomic<size_t> next{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    const auto worker = [&jobs, &next, &bytes] {
+        for (size_t n = next++; n < jobs.size(); n = next++) {
+            const auto& job = jobs[n];
+            try {
+                struct stat st {
+                };
+                if (fstat(job.src.fd(), &st)) {
+                    throw SysError("fstat()");
+                }
+                bytes += st.st_size;
+                (void)copy_data(job.src.fd(), job.dst);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("copying " + job.src.str() + " to " +
+                                         job.dst_name + ": " + e.what());
             }
-            w -= wrc;
-            p += wrc;
         }
+    };
+    std::vector<std::future<void>> threads;
+    for (size_t c = 1; c < std::min(jobs.size(), max_copy_threads); c++) {
+        threads.push_back(std::async(std::launch::async, worker));
+    }
+    worker();
+    for (auto& t : threads) {
+        t.get();
+    }
+    return bytes;
+}
+
+// fsync() a directory, to make renames in it durable.
+void sync_dir(int dirfd, const std::string& dirname)
+{
+    // The directory fd may be O_PATH, which can't be synced.
+    const int dfd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        throw SysError("openat(" + dirname + ")");
+    }
+    Defer _([dfd] { ::close(dfd); });
+    if (fsync(dfd)) {
+        throw SysError("fsync(" + dirname + ")");
     }
 }
 
@@ -437,60 +449,341 @@ struct stat xstat(const Dir& dir, uid_t uid, const std::string& fn)
     return ss.str();
 }
 
+// Read-only view of a whole file, for diffing.
+class Contents
+{
+public:
+    Contents(int fd, const std::string& name);
+
+    // No copy or move.
+    Contents(const Contents&) = delete;
+    Contents(Contents&&) = delete;
+    Contents& operator=(const Contents&) = delete;
+    Contents& operator=(Contents&&) = delete;
+
+    ~Contents();
+
+    [[nodiscard]] const char* data() const noexcept { return data_; }
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+
+private:
+    void* map_ = MAP_FAILED;
+    const char* data_ = "";
+    size_t size_ = 0;
+
+    // Files in /proc and /sys claim to be empty, so can't be mapped.
+    std::string read_;
+};
+
+Contents::Contents(int fd, const std::string& name)
+{
+    struct stat st {
+    };
+    if (fstat(fd, &st)) {
+        throw SysError("fstat(" + name + ")");
+    }
+    if (st.st_size > 0) {
+        map_ = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map_ == MAP_FAILED) {
+            throw SysError("mmap(" + name + ")");
+        }
+        data_ = static_cast<const char*>(map_);
+        size_ = st.st_size;
+        return;
+    }
+    for (;;) {
+        char buf[4096];
+        const ssize_t rc = read(fd, buf, sizeof(buf));
+        if (rc == -1) {
+            throw SysError("read(" + name + ")");
+        }
+        if (rc == 0) {
+            break;
+        }
+        read_.append(buf, rc);
+    }
+    data_ = read_.data();
+    size_ = read_.size();
+}
+
+Contents::~Contents()
+{
+    if (map_ != MAP_FAILED) {
+        munmap(map_, size_);
+    }
+}
+
 } // namespace
 
-// Edit the file.
-[[nodiscard]] int do_edit(uid_t uid, gid_t gid, const std::string& fn)
+StagedFile::StagedFile(int dirfd, std::string dirname)
+    : dirfd_(dirfd), dirname_(std::move(dirname))
 {
-    const Dir dir = open_dir(fn);
-    const std::string base = split(fn).second;
-    const Dir cwd{ AT_FDCWD, "." };
-    const struct stat orig_st = xstat(dir, uid, base);
+#ifdef O_TMPFILE
+    fd_ = openat(dirfd_, ".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd_ != -1) {
+        return;
+    }
+    // Old kernels say EISDIR, and some filesystems don't support it.
+    if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) {
+        throw SysError("openat(" + dirname_ + ", O_TMPFILE)");
+    }
+#endif
+    for (;;) {
+        auto name = "sim." + make_random_filename(temp_filename_len);
+        fd_ = openat(dirfd_,
+                     name.c_str(),
+                     O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                     0600);
+        if (fd_ != -1) {
+            name_ = std::move(name);
+            return;
+        }
+        if (errno != EEXIST) {
+            throw SysError("openat(" + dirname_ + ", " + name + ")");
+        }
+    }
+}
 
-    const auto tmpfn = tmpfile();
-    Defer _([&tmpfn, &cwd] {
-        if (unlinkat(cwd.fd(), tmpfn.c_str(), 0)) {
-            std::cerr << "Failed to unlink " << tmpfn << "\n";
+StagedFile::~StagedFile()
+{
+    ::close(fd_);
+    if (!name_.empty() && unlinkat(dirfd_, name_.c_str(), 0)) {
+        std::cerr << "Failed to unlink " << dirname_ << "/" << name_ << "\n";
+    }
+}
+
+void StagedFile::prepare(uid_t owner, gid_t group, mode_t mode, EditSync sync)
+{
+    // chown() clears setuid and setgid bits, so it goes first.
+    if (fchown(fd_, owner, group)) {
+        throw SysError("fchown(staged file in " + dirname_ + ", " +
+                       std::to_string(owner) + ", " + std::to_string(group) + ")");
+    }
+    if (fchmod(fd_, mode)) {
+        throw SysError("fchmod(staged file in " + dirname_ + ", " + to_oct(mode) + ")");
+    }
+    if (sync != EditSync::none && fdatasync(fd_)) {
+        throw SysError("fdatasync(staged file in " + dirname_ + ")");
+    }
+    if (!name_.empty()) {
+        return;
+    }
+
+    // Give the O_TMPFILE a name, so that it can be renamed.
+    for (;;) {
+        auto name = "sim." + make_random_filename(temp_filename_len);
+        int rc = linkat(fd_, "", dirfd_, name.c_str(), AT_EMPTY_PATH);
+        if (rc == -1 && (errno == EPERM || errno == ENOENT)) {
+            // AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH.
+            const auto proc = "/proc/self/fd/" + std::to_string(fd_);
+            rc = linkat(AT_FDCWD, proc.c_str(), dirfd_, name.c_str(), AT_SYMLINK_FOLLOW);
         }
-    });
-    copy_file(uid, true, false, dir, base, cwd, tmpfn);
-    spawn_editor(tmpfn);
+        if (rc == 0) {
+            name_ = std::move(name);
+            return;
+        }
+        if (errno != EEXIST) {
+            throw SysError("linkat(staged file, " + dirname_ + ", " + name + ")");
+        }
+    }
+}
 
-    const auto renamefn = renametempfile(dir, uid, fn);
-    Defer d2([&renamefn, &dir, uid] {
-        PushEUID _(uid);
-        if (unlinkat(dir.fd(), renamefn.c_str(), 0)) {
-            std::cerr << "Failed to unlink " << renamefn << "\n";
+void StagedFile::rename_over(const std::string& name, EditSync sync)
+{
+    if (name_.empty()) {
+        throw std::logic_error("StagedFile::rename_over() before prepare()");
+    }
+    if (renameat(dirfd_, name_.c_str(), dirfd_, name.c_str())) {
+        throw SysError("renameat(" + dirname_ + ", " + name_ + ", " + name + ")");
+    }
+    name_.clear();
+    if (sync == EditSync::full) {
+        sync_dir(dirfd_, dirname_);
+    }
+}
+
+class FileEdit::Impl
+{
+public:
+    Impl(uid_t uid, uid_t reader, const std::vector<std::string>& fns);
+
+    // No copy or move.
+    Impl(const Impl&) = delete;
+    Impl(Impl&&) = delete;
+    Impl& operator=(const Impl&) = delete;
+    Impl& operator=(Impl&&) = delete;
+
+    ~Impl();
+    [[nodiscard]] const std::vector<Change>& changes() const noexcept { return changes_; }
+    [[nodiscard]] const CopyStats& copy_stats() const noexcept { return copy_stats_; }
+    void commit(EditSync sync);
+
+private:
+    void timed_copy(const std::vector<CopyJob>& jobs);
+
+    struct File {
+        const Dir* dir;
+        std::string base;
+        struct stat orig_st;
+        std::unique_ptr<StagedFile> staged;
+    };
+
+    const uid_t uid_;
+
+    // Directory of each file, opened once per directory.
+    std::map<std::string, Dir> dirs_;
+
+    // The changed files, in the same order as changes_.
+    std::vector<File> files_;
+    std::vector<Change> changes_;
+    CopyStats copy_stats_;
+};
+
+FileEdit::Impl::Impl(uid_t uid, uid_t reader, const std::vector<std::string>& fns)
+    : uid_(uid)
+{
+    const Dir cwd{ AT_FDCWD, "." };
+    std::vector<File> files;
+    std::vector<std::string> tmpfns;
+    Defer _([this, &files, &tmpfns, &cwd] {
+        for (const auto& tmpfn : tmpfns) {
+            if (unlinkat(cwd.fd(), tmpfn.c_str(), 0)) {
+                std::cerr << "Failed to unlink " << tmpfn << "\n";
+            }
         }
+        // Remove staged files of unchanged files, or of all of them
+        // if there was an error.
+        PushEUID _(uid_);
+        files.clear();
     });
-    copy_file(uid, false, true, cwd, tmpfn, dir, renamefn);
+
+    for (const auto& fn : fns) {
+        if (std::count(fns.begin(), fns.end(), fn) > 1) {
+            throw std::runtime_error(fn + " given more than once");
+        }
+        const auto dirname = fn.substr(0, fn.rfind('/'));
+        auto dir = dirs_.find(dirname);
+        if (dir == dirs_.end()) {
+            dir = dirs_.emplace(dirname, open_dir(fn)).first;
+        }
+        File f{};
+        f.dir = &dir->second;
+        f.base = split(fn).second;
+        f.orig_st = xstat(*f.dir, uid, f.base);
+        tmpfns.push_back(tmpfile(f.base));
+        files.push_back(std::move(f));
+    }
 
     {
-        PushEUID _(uid);
-        const auto mode = orig_st.st_mode & 07777;
-        if (fchmodat(dir.fd(), renamefn.c_str(), mode, 0)) {
-            throw SysError("fchmodat(" + dir.str() + ", " + renamefn + ", " +
-                           to_oct(mode) + ")");
+        std::vector<CopyJob> jobs;
+        std::vector<FD> dsts;
+        for (size_t n = 0; n < files.size(); n++) {
+            PushEUID _(reader);
+            const auto& f = files[n];
+            jobs.push_back(CopyJob{ f.dir->must_open_read(f.base), -1, tmpfns[n] });
         }
-        if (fchownat(dir.fd(), renamefn.c_str(), orig_st.st_uid, orig_st.st_gid, 0)) {
-            throw SysError("fchownat(" + dir.str() + ", " + renamefn + ", " +
-                           std::to_string(orig_st.st_uid) + ", " +
-                           std::to_string(orig_st.st_gid) + ")");
+        for (auto& job : jobs) {
+            dsts.push_back(cwd.must_open_write(job.dst_name));
+            job.dst = dsts.back().fd();
         }
+        timed_copy(jobs);
+    }
+
+    spawn_editor(tmpfns);
 
-        // Check if original file changed.
-        const struct stat new_st = xstat(dir, uid, fn);
-        if (diff_stat(orig_st, new_st)) {
+    {
+        std::vector<CopyJob> jobs;
+        for (size_t n = 0; n < files.size(); n++) {
+            auto& f = files[n];
+            {
+                PushEUID _(uid);
+                f.staged = std::make_unique<StagedFile>(f.dir->fd(), f.dir->str());
+            }
+            jobs.push_back(
+                CopyJob{ cwd.must_open_read(tmpfns[n]), f.staged->fd(), "staged file" });
+        }
+        timed_copy(jobs);
+    }
+
+    // Diff against the root owned copies, since that's what will be
+    // installed.
+    for (size_t n = 0; n < files.size(); n++) {
+        auto& f = files[n];
+        std::string diff;
+        {
+            PushEUID _(uid);
+            const FD orig = f.dir->must_open_read(f.base);
+            const Contents a(orig.fd(), orig.str());
+            const Contents b(f.staged->fd(), "staged file");
+            diff = unified_diff(a.data(), a.size(), b.data(), b.size(), fns[n]);
+        }
+        if (!diff.empty()) {
+            changes_.push_back(Change{ fns[n], std::move(diff) });
+            files_.push_back(std::move(f));
+        }
+    }
+}
+
+FileEdit::Impl::~Impl()
+{
+    PushEUID _(uid_);
+    files_.clear();
+}
+
+void FileEdit::Impl::commit(EditSync sync)
+{
+    PushEUID _(uid_);
+    for (auto& f : files_) {
+        f.staged->prepare(
+            f.orig_st.st_uid, f.orig_st.st_gid, f.orig_st.st_mode & 07777, sync);
+    }
+
+    // Check if any original file changed, before replacing any of them.
+    for (size_t n = 0; n < files_.size(); n++) {
+        const auto& f = files_[n];
+        const struct stat new_st = xstat(*f.dir, uid_, f.base);
+        if (diff_stat(f.orig_st, new_st)) {
             // TODO: ask what to do.
-            throw std::runtime_error("race editing file. Try again");
+            throw std::runtime_error("race editing " + changes_[n].filename +
+                                     ". Try again");
         }
+    }
 
-        if (renameat(dir.fd(), renamefn.c_str(), dir.fd(), base.c_str())) {
-            throw SysError("renameat(" + dir.str() + "," + renamefn + ", " + fn + ")");
+    // Each rename is atomic, but the set isn't. Directories are synced
+    // once each, after all renames.
+    for (auto& f : files_) {
+        f.staged->rename_over(f.base, std::min(sync, EditSync::data));
+    }
+    if (sync == EditSync::full) {
+        std::set<const Dir*> synced;
+        for (const auto& f : files_) {
+            if (synced.insert(f.dir).second) {
+                sync_dir(f.dir->fd(), f.dir->str());
+            }
         }
     }
-    d2.defuse();
-    return EXIT_SUCCESS;
 }
 
+void FileEdit::Impl::timed_copy(const std::vector<CopyJob>& jobs)
+{
+    const auto start = std::chrono::steady_clock::now();
+    copy_stats_.bytes += copy_all(jobs);
+    copy_stats_.time += std::chrono::steady_clock::now() - start;
+}
+
+FileEdit::FileEdit(uid_t uid, uid_t reader, const std::vector<std::string>& fns)
+    : impl_(std::make_unique<Impl>(uid, reader, fns))
+{
+}
+FileEdit::~FileEdit() = default;
+const std::vector<FileEdit::Change>& FileEdit::changes() const noexcept
+{
+    return impl_->changes();
+}
+const FileEdit::CopyStats& FileEdit::copy_stats() const noexcept
+{
+    return impl_->copy_stats();
+}
+void FileEdit::commit(EditSync sync) { impl_->commit(sync); }
+
 } // namespace Sim
@@ -0,0 +1,127 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * This file deals with `sim -e`. See edit.cc.
+ */
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace Sim {
+
+// How sure to be that an edit is on disk once sim says it's done.
+enum class EditSync {
+    none, // A crash soon after can leave the file empty.
+    data, // The new contents are on disk before they replace the old.
+    full, // Also the rename.
+};
+
+// A new version of a file, in the same directory but not yet visible.
+//
+// Where supported it's an O_TMPFILE, which has no name until it's
+// ready, and is freed by the kernel if sim dies. Otherwise it's a file
+// with a random name, removed by the destructor unless renamed.
+class StagedFile
+{
+public:
+    // Create an empty file in directory `dirfd`, which is `dirname` in
+    // error messages.
+    StagedFile(int dirfd, std::string dirname);
+
+    // No copy or move.
+    StagedFile(const StagedFile&) = delete;
+    StagedFile(StagedFile&&) = delete;
+    StagedFile& operator=(const StagedFile&) = delete;
+    StagedFile& operator=(StagedFile&&) = delete;
+
+    ~StagedFile();
+
+    [[nodiscard]] int fd() const noexcept { return fd_; }
+
+    // Set owner and mode, sync the data if asked to, and give the file
+    // a temporary name.
+    void prepare(uid_t owner, gid_t group, mode_t mode, EditSync sync);
+
+    // Atomically replace `name` in the directory. prepare() must have
+    // been called.
+    void rename_over(const std::string& name, EditSync sync);
+
+private:
+    const int dirfd_;
+    const std::string dirname_;
+    int fd_ = -1;
+
+    // Current name in the directory, if any.
+    std::string name_;
+};
+
+// An edit of one or more files, in two steps, so that the approver
+// can see the change before it's made.
+//
+// The constructor lets the user edit copies of the files, all in one
+// editor, and stages the results as StagedFiles next to the originals,
+// owned by root. commit() then replaces the originals with the staged
+// files. If not committed, the staged files are removed.
+class FileEdit
+{
+public:
+    // Edit `fns`, absolute paths, using `uid` (root) for accessing
+    // them. The originals are copied into the editor as `reader`,
+    // which is the user unless reading them has been approved.
+    FileEdit(uid_t uid, uid_t reader, const std::vector<std::string>& fns);
+
+    // No copy or move.
+    FileEdit(const FileEdit&) = delete;
+    FileEdit(FileEdit&&) = delete;
+    FileEdit& operator=(const FileEdit&) = delete;
+    FileEdit& operator=(FileEdit&&) = delete;
+
+    ~FileEdit();
+
+    struct Change {
+        std::string filename;
+
+        // Unified diff from the original to the staged file.
+        std::string diff;
+    };
+
+    // The files that the user changed, in the order given. Empty if
+    // nothing changed.
+    [[nodiscard]] const std::vector<Change>& changes() const noexcept;
+
+    // Copying in and out of the editor, for all files.
+    struct CopyStats {
+        uint64_t bytes = 0;
+        std::chrono::nanoseconds time{};
+    };
+    [[nodiscard]] const CopyStats& copy_stats() const noexcept;
+
+    // Replace the changed originals with the staged files. Throws,
+    // without replacing any, if any of them changed since the edit
+    // started.
+    void commit(EditSync sync);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace Sim
@@ -0,0 +1,110 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "edit.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<stdexcept>
+#include<string>
+
+#include<dirent.h>
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+namespace {
+// Number of directory entries, not counting "." and "..".
+int entries(const std::string& dir)
+{
+  DIR* d = opendir(dir.c_str());
+  assert(d);
+  int ret = 0;
+  while (const struct dirent* ent = readdir(d)) {
+    const std::string name = ent->d_name;
+    ret += name != "." && name != "..";
+  }
+  closedir(d);
+  return ret;
+}
+
+std::string read_file(const std::string& fn)
+{
+  const int fd = open(fn.c_str(), O_RDONLY);
+  assert(fd != -1);
+  std::string ret(4096, '\0');
+  const ssize_t rc = read(fd, &ret[0], ret.size());
+  assert(rc >= 0);
+  close(fd);
+  ret.resize(rc);
+  return ret;
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+
+  char tmpl[] = "/tmp/edit_test.XXXXXX";
+  const char* tmp = mkdtemp(tmpl);
+  assert(tmp != nullptr);
+  const std::string dir = tmp;
+  const int dirfd = open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  assert(dirfd != -1);
+
+  const std::string fn = dir + "/file";
+  {
+    const int fd = open(fn.c_str(), O_WRONLY | O_CREAT, 0600);
+    assert(fd != -1);
+    assert(write(fd, "old\n", 4) == 4);
+    close(fd);
+  }
+
+  for (const auto sync : { EditSync::none, EditSync::data, EditSync::full }) {
+    const std::string data = "new " + std::to_string(static_cast<int>(sync)) + "\n";
+    {
+      StagedFile staged(dirfd, dir);
+      assert(write(staged.fd(), data.data(), data.size()) ==
+             static_cast<ssize_t>(data.size()));
+      staged.prepare(getuid(), getgid(), 0640, sync);
+      assert(entries(dir) == 2);
+      assert(read_file(fn) != data);
+      staged.rename_over("file", sync);
+    }
+    assert(entries(dir) == 1);
+    assert(read_file(fn) == data);
+    struct stat st{};
+    assert(!stat(fn.c_str(), &st));
+    assert((st.st_mode & 07777) == 0640);
+  }
+
+  // Not renamed: no trace left, before or after prepare().
+  {
+    StagedFile staged(dirfd, dir);
+    assert(write(staged.fd(), "x", 1) == 1);
+  }
+  assert(entries(dir) == 1);
+  {
+    StagedFile staged(dirfd, dir);
+    staged.prepare(getuid(), getgid(), 0600, EditSync::none);
+    assert(entries(dir) == 2);
+  }
+  assert(entries(dir) == 1);
+
+  // Renaming without a name is a bug.
+  {
+    StagedFile staged(dirfd, dir);
+    bool threw = false;
+    try {
+      staged.rename_over("file", EditSync::none);
+    } catch (const std::logic_error&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+  assert(read_file(fn) == "new 2\n");
+
+  assert(!unlink(fn.c_str()));
+  assert(!rmdir(dir.c_str()));
+  close(dirfd);
+}
@@ -23,10 +23,18 @@
 #include "util.h"
 
 // C++
-#include <vector>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
 
 // POSIX
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -39,8 +47,28 @@ using ucred_t = struct ucred;
 #endif
 
 namespace Sim {
+namespace {
+// Larger messages are sent as a memfd.
+constexpr size_t max_inline_size = 32 * 1024;
+
+// Largest message accepted as a memfd.
+constexpr off_t max_message_size = 64 * 1024 * 1024;
+
+// Payload of a packet carrying a memfd. Never empty, since that
+// means EOF.
+constexpr const char* memfd_marker = "memfd";
+
+// Most fds taken from one packet. Only one is ever sent, but room for
+// a few more means extras are received, and closed, rather than
+// leaving the kernel to drop them.
+constexpr size_t max_received_fds = 8;
+
+// Initial buffer size for SO_PEERGROUPS. Grown if needed.
+constexpr size_t initial_peer_groups = 64;
+} // namespace
+
 FD::FD(int fd) : fd_(fd) {}
-FD::FD(FD&& rhs) noexcept : fd_(rhs.fd_) { rhs.fd_ = -1; }
+FD::FD(FD&& rhs) noexcept : fd_(rhs.fd_), deadline_(rhs.deadline_) { rhs.fd_ = -1; }
 
 void FD::close()
 {
@@ -53,28 +81,107 @@ void FD::close()
 
 FD::~FD() { close(); }
 
-uid_t FD::get_uid() const
+namespace {
+[[nodiscard]] ucred_t get_ucred(int fd)
 {
     ucred_t ucred{};
     socklen_t len = sizeof(ucred_t);
-    if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &ucred, &len) == -1) {
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &len) == -1) {
         throw SysError("getsockopt(,,SO_PEERCRED)");
     }
-    return ucred.uid;
+    return ucred;
 }
 
-gid_t FD::get_gid() const
+#ifdef SO_PEERGROUPS
+// Get the supplementary groups of the peer. Returns false if the
+// kernel doesn't support it.
+[[nodiscard]] bool get_groups(int fd, std::vector<gid_t>* groups)
 {
-    ucred_t ucred{};
-    socklen_t len = sizeof(ucred_t);
-    if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &ucred, &len) == -1) {
-        throw SysError("getsockopt(,,SO_PEERCRED)");
+    groups->resize(initial_peer_groups);
+    for (;;) {
+        socklen_t len = groups->size() * sizeof(gid_t);
+        if (!getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, groups->data(), &len)) {
+            groups->resize(len / sizeof(gid_t));
+            return true;
+        }
+        if (errno == ENOPROTOOPT) {
+            // Before Linux 4.13.
+            groups->clear();
+            return false;
+        }
+        // On ERANGE len is set to the size needed.
+        if (errno != ERANGE || len <= groups->size() * sizeof(gid_t)) {
+            throw SysError("getsockopt(,,SO_PEERGROUPS)");
+        }
+        groups->resize(len / sizeof(gid_t));
+    }
+}
+#endif
+} // namespace
+
+bool PeerCred::member_of(gid_t group_gid,
+                         const std::string& group,
+                         const std::string& user) const
+{
+    if (gid == group_gid) {
+        return true;
+    }
+    if (have_groups) {
+        return std::find(groups.begin(), groups.end(), group_gid) != groups.end();
+    }
+    return user_is_member(user, gid, group);
+}
+
+uid_t FD::get_uid() const { return get_ucred(fd_).uid; }
+
+PeerCred FD::peer_cred() const
+{
+    const auto ucred = get_ucred(fd_);
+    PeerCred ret;
+    ret.uid = ucred.uid;
+    ret.gid = ucred.gid;
+    ret.pid = ucred.pid;
+#ifdef SO_PEERGROUPS
+    ret.have_groups = get_groups(fd_, &ret.groups);
+#endif
+    return ret;
+}
+
+// Wait until the deadline for `events`, if there is a deadline. Like
+// the calls it's guarding, not retried on EINTR.
+void FD::wait(short events, const char* op) const
+{
+    struct pollfd pfd {
+    };
+    pfd.fd = fd_;
+    pfd.events = events;
+    for (;;) {
+        const int timeout = poll_timeout(deadline_);
+        if (timeout == -1) {
+            return;
+        }
+        const int rc = poll(&pfd, 1, timeout);
+        if (rc == -1) {
+            throw SysError("poll");
+        }
+        if (rc > 0) {
+            return;
+        }
+        if (std::chrono::steady_clock::now() >= deadline_) {
+            throw Timeout(op);
+        }
     }
-    return ucred.gid;
 }
 
 void FD::write(const std::string& s)
 {
+    wait(POLLOUT, "write");
+#ifdef HAVE_MEMFD_CREATE
+    if (s.size() > max_inline_size) {
+        write_memfd(s);
+        return;
+    }
+#endif
     const auto rc = ::write(fd_, s.data(), s.size());
     if (rc == -1) {
         throw SysError("write");
@@ -83,14 +190,178 @@ void FD::write(const std::string& s)
         throw std::runtime_error("short write");
     }
 }
+
+#ifdef HAVE_MEMFD_CREATE
+void FD::write_memfd(const std::string& s)
+{
+    const int mfd = memfd_create("sim-message", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mfd == -1) {
+        throw SysError("memfd_create");
+    }
+    Defer _([mfd] { ::close(mfd); });
+    for (size_t ofs = 0; ofs < s.size();) {
+        const auto rc = ::write(mfd, s.data() + ofs, s.size() - ofs);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("write(memfd)");
+        }
+        ofs += rc;
+    }
+    if (fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)) {
+        throw SysError("fcntl(F_ADD_SEALS)");
+    }
+
+    struct iovec iov {
+    };
+    iov.iov_base = const_cast<char*>(memfd_marker);
+    iov.iov_len = strlen(memfd_marker);
+    alignas(struct cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+    struct msghdr msg {
+    };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &mfd, sizeof(int));
+    if (sendmsg(fd_, &msg, MSG_NOSIGNAL) == -1) {
+        throw SysError("sendmsg(SCM_RIGHTS)");
+    }
+}
+#endif
+
 std::string FD::read()
 {
-    constexpr int max_read_size = 1024 * 100; // 100 KiB.
-    std::vector<char> buf(max_read_size);
-    const auto rc = ::read(fd_, buf.data(), buf.size());
+    wait(POLLIN, "read");
+
+    // Find the size of the packet first, so that exactly that much
+    // can be allocated.
+    // Not retried on EINTR, so that a signal interrupts waiting.
+    const ssize_t size = recv(fd_, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+    if (size == -1) {
+        throw SysError("recv(MSG_PEEK)");
+    }
+
+    std::string ret(size, '\0');
+    struct iovec iov {
+    };
+    iov.iov_base = &ret[0];
+    iov.iov_len = ret.size();
+    alignas(struct cmsghdr) std::array<char, CMSG_SPACE(max_received_fds * sizeof(int))>
+        control{};
+    struct msghdr msg {
+    };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    const ssize_t rc = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
     if (rc == -1) {
-        throw SysError("read");
+        throw SysError("recvmsg");
+    }
+    ret.resize(rc);
+
+    // Take every fd received, so that none are leaked whatever the
+    // peer sent.
+    std::vector<int> fds;
+    Defer _([&fds] {
+        for (const auto fd : fds) {
+            ::close(fd);
+        }
+    });
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t c = 0; c < n; c++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + c * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        throw std::runtime_error("received truncated packet");
+    }
+    if (fds.size() > 1) {
+        throw std::runtime_error("received " + std::to_string(fds.size()) +
+                                 " fds, expected at most one");
+    }
+    if (!fds.empty()) {
+        // Otherwise whatever else was sent would be dropped unseen.
+        if (ret != memfd_marker) {
+            throw std::runtime_error("received fd with unexpected payload");
+        }
+        return read_memfd(fds[0]);
+    }
+    return ret;
+}
+
+// Read a message sent as a memfd. It must be sealed, so that it can't
+// change after it's been checked.
+std::string FD::read_memfd(int mfd)
+{
+#ifdef F_GET_SEALS
+    constexpr int required = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+    const int seals = fcntl(mfd, F_GET_SEALS);
+    if (seals == -1) {
+        throw SysError("fcntl(F_GET_SEALS)");
     }
-    return std::string(&buf[0], &buf[rc]);
+    if ((seals & required) != required) {
+        throw std::runtime_error("received memfd is not sealed");
+    }
+    struct stat st {
+    };
+    if (fstat(mfd, &st)) {
+        throw SysError("fstat(memfd)");
+    }
+    if (st.st_size > max_message_size) {
+        throw std::runtime_error("received message of " + std::to_string(st.st_size) +
+                                 " bytes, max is " + std::to_string(max_message_size));
+    }
+    if (st.st_size == 0) {
+        return "";
+    }
+    void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, mfd, 0);
+    if (m == MAP_FAILED) {
+        throw SysError("mmap(memfd)");
+    }
+    Defer _([m, &st] { munmap(m, st.st_size); });
+    return std::string(static_cast<const char*>(m), st.st_size);
+#else
+    (void)mfd;
+    throw std::runtime_error("received memfd, which is not supported on this platform");
+#endif
+}
+
+FD connect(const std::string& fn)
+{
+    // Create socket.
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock == -1) {
+        throw SysError("socket");
+    }
+    Defer defer([&] { ::close(sock); });
+
+    // connect.
+    struct sockaddr_un sa {
+    };
+    sa.sun_family = AF_UNIX;
+    if (fn.size() >= sizeof sa.sun_path) {
+        throw std::runtime_error("socket name too long: " + fn);
+    }
+    strncpy(static_cast<char*>(sa.sun_path), fn.c_str(), sizeof sa.sun_path - 1);
+    if (::connect(sock, reinterpret_cast<struct sockaddr*>(&sa), sizeof sa)) {
+        throw SysError("connect");
+    }
+
+    FD fd(sock);
+    defer.defuse();
+    return fd;
 }
 } // namespace Sim
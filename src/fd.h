@@ -14,9 +14,41 @@
  *    See the License for the specific language governing permissions and
  *    limitations under the License.
  */
+#include <chrono>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <sys/types.h>
 
 namespace Sim {
+
+// Credentials of the process at the other end of a unix socket, as of
+// when it connected (or started listening).
+struct PeerCred {
+    uid_t uid = 0;
+    gid_t gid = 0;
+    pid_t pid = 0;
+
+    // Supplementary groups, as the kernel has them. Only set if
+    // have_groups, i.e. if the platform has SO_PEERGROUPS.
+    bool have_groups = false;
+    std::vector<gid_t> groups;
+
+    // Return true if the peer is in `group`, whose gid is `group_gid`.
+    // Uses the kernel's group list if there is one, and otherwise asks
+    // the group database about `user`.
+    [[nodiscard]] bool
+    member_of(gid_t group_gid, const std::string& group, const std::string& user) const;
+};
+
+// Thrown by FD::read() and FD::write() when the deadline passes first.
+class Timeout : public std::runtime_error
+{
+public:
+    explicit Timeout(const std::string& op) : std::runtime_error(op + ": timed out") {}
+};
+
 class FD
 {
 public:
@@ -31,13 +63,39 @@ public:
     FD& operator=(FD&&) = delete; // Just temporarily not implemented.
 
     ~FD();
+    [[nodiscard]] int get() const noexcept { return fd_; }
+
+    // Make read() and write() throw Timeout if the other end isn't
+    // ready by `deadline`. By default they wait forever.
+    void set_deadline(std::chrono::steady_clock::time_point deadline) noexcept
+    {
+        deadline_ = deadline;
+    }
+
+    // Send one packet. Large messages are written to a sealed memfd
+    // which is passed instead, so there's no size limit and the
+    // receiver knows the message can't change after it's sent.
     void write(const std::string& s);
     void close();
+
+    // Read one packet, or a message passed as a memfd. Empty on EOF.
     [[nodiscard]] std::string read();
     [[nodiscard]] uid_t get_uid() const;
-    [[nodiscard]] gid_t get_gid() const;
+
+    // All the peer credentials, including groups, in as few syscalls
+    // as possible.
+    [[nodiscard]] PeerCred peer_cred() const;
 
 private:
+    void write_memfd(const std::string& s);
+    [[nodiscard]] static std::string read_memfd(int mfd);
+    void wait(short events, const char* op) const;
+
     int fd_;
+    std::chrono::steady_clock::time_point deadline_ =
+        std::chrono::steady_clock::time_point::max();
 };
+
+// Connect to a SOCK_SEQPACKET unix socket.
+[[nodiscard]] FD connect(const std::string& fn);
 } // namespace Sim
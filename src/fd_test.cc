@@ -0,0 +1,149 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "fd.h"
+
+#include<array>
+#include<cassert>
+#include<chrono>
+#include<cstring>
+#include<stdexcept>
+#include<string>
+#include<utility>
+#include<vector>
+
+#include<dirent.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<unistd.h>
+
+namespace {
+size_t count_fds()
+{
+  DIR* dir = opendir("/proc/self/fd");
+  assert(dir != nullptr);
+  size_t n = 0;
+  while (readdir(dir) != nullptr) {
+    n++;
+  }
+  closedir(dir);
+  return n;
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+
+  int sv[2];
+  assert(!socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv));
+  FD a(sv[0]);
+  FD b(sv[1]);
+
+  // Small messages are sent inline, large ones as a memfd. Either way
+  // they arrive whole, and one at a time.
+  const std::string small = "hello";
+  std::string large(3 * 1024 * 1024, '\0');
+  for (size_t c = 0; c < large.size(); c++) {
+    large[c] = static_cast<char>(c * 7);
+  }
+  a.write(small);
+  a.write(large);
+  a.write(small);
+  assert(b.read() == small);
+  assert(b.read() == large);
+  assert(b.read() == small);
+
+  // Peer credentials.
+  {
+    const auto cred = b.peer_cred();
+    assert(cred.uid == getuid());
+    assert(cred.gid == getgid());
+    assert(cred.pid == getpid());
+    assert(cred.member_of(getgid(), "unused", "unused"));
+    if (cred.have_groups) {
+      std::vector<gid_t> groups(getgroups(0, nullptr));
+      assert(getgroups(groups.size(), groups.data()) == static_cast<int>(groups.size()));
+      for (const auto g : groups) {
+        assert(cred.member_of(g, "unused", "unused"));
+      }
+      assert(cred.groups.size() == groups.size());
+    }
+  }
+
+  // Deadlines. Reading with nothing sent times out, but what's already
+  // there is read even after the deadline.
+  {
+    const auto now = std::chrono::steady_clock::now();
+    b.set_deadline(now + std::chrono::milliseconds(50));
+    bool threw = false;
+    try {
+      (void)b.read();
+    } catch (const Timeout&) {
+      threw = true;
+    }
+    assert(threw);
+    assert(std::chrono::steady_clock::now() - now >= std::chrono::milliseconds(50));
+    a.write(small);
+    assert(b.read() == small);
+    b.set_deadline(std::chrono::steady_clock::time_point::max());
+  }
+
+  // More than one fd, or an fd with anything but the memfd marker, is
+  // refused, and none of the fds are kept.
+  for (const auto& test : { std::make_pair(std::string("memfd"), 2),
+                            std::make_pair(std::string("hello"), 1) }) {
+    std::string payload = test.first;
+    const int n = test.second;
+    std::vector<int> fds;
+    for (int c = 0; c < n; c++) {
+      fds.push_back(open("/dev/null", O_RDONLY | O_CLOEXEC));
+      assert(fds.back() != -1);
+    }
+#ifdef HAVE_MEMFD_CREATE
+    if (n == 1) {
+      // A message that would be accepted with the right payload.
+      close(fds[0]);
+      fds[0] = memfd_create("fd_test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      assert(fds[0] != -1);
+      const ssize_t rc = write(fds[0], "x", 1);
+      assert(rc == 1);
+      const int err = fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE);
+      assert(!err);
+    }
+#endif
+    struct iovec iov {};
+    iov.iov_base = &payload[0];
+    iov.iov_len = payload.size();
+    alignas(struct cmsghdr) std::array<char, CMSG_SPACE(2 * sizeof(int))> control{};
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds.data(), n * sizeof(int));
+    assert(sendmsg(sv[0], &msg, 0) == static_cast<ssize_t>(iov.iov_len));
+    for (const auto fd : fds) {
+      close(fd);
+    }
+
+    const auto before = count_fds();
+    bool threw = false;
+    try {
+      (void)b.read();
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+    assert(count_fds() == before);
+  }
+
+  // EOF.
+  a.close();
+  assert(b.read().empty());
+}
@@ -0,0 +1,103 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "identity.h"
+
+// Project
+#include "maptable.h"
+#include "util.h"
+
+// C++
+#include <ctime>
+#include <iostream>
+
+namespace Sim {
+namespace {
+// Longest value: a user name, plus the found/not found marker.
+constexpr uint32_t value_size = 64;
+} // namespace
+
+class IdentityCache::Impl : public LookupCache
+{
+public:
+    explicit Impl(const simproto::SimConfig& config);
+
+    [[nodiscard]] bool get(const std::string& key, bool* found, std::string* value) override;
+    void put(const std::string& key, bool found, const std::string& value) override;
+
+private:
+    MapTable table_;
+    const uint32_t ttl_;
+    const uint32_t negative_ttl_;
+};
+
+IdentityCache::Impl::Impl(const simproto::SimConfig& config)
+    : table_(config.identity_cache(),
+             config.identity_cache_entries(),
+             value_size,
+             MapTable::Access::world_readable),
+      ttl_(config.identity_cache_ttl_seconds()),
+      negative_ttl_(config.identity_cache_negative_ttl_seconds())
+{
+}
+
+bool IdentityCache::Impl::get(const std::string& key, bool* found, std::string* value)
+{
+    std::string entry;
+    if (!table_.get(sha256(key), time(nullptr), &entry) || entry.empty()) {
+        return false;
+    }
+    *found = entry[0] == '+';
+    value->assign(entry, 1, std::string::npos);
+    return true;
+}
+
+void IdentityCache::Impl::put(const std::string& key, bool found, const std::string& value)
+{
+    if (!table_.writable() || value.size() >= value_size) {
+        return;
+    }
+    const auto now = time(nullptr);
+    table_.put(sha256(key),
+               (found ? "+" : "-") + value,
+               now + (found ? ttl_ : negative_ttl_),
+               now);
+}
+
+IdentityCache::IdentityCache(const simproto::SimConfig& config)
+{
+    if (config.identity_cache().empty()) {
+        return;
+    }
+    try {
+        impl_ = std::make_unique<Impl>(config);
+        set_lookup_cache(impl_.get());
+    } catch (const std::exception& e) {
+        std::clog << "Identity cache unavailable: " << e.what() << std::endl;
+    }
+}
+
+IdentityCache::~IdentityCache()
+{
+    if (impl_) {
+        set_lookup_cache(nullptr);
+    }
+}
+
+} // namespace Sim
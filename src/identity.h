@@ -0,0 +1,53 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Cache for user and group lookups, shared between processes.
+ *
+ * With NSS backed by LDAP or similar, every getpwuid(), getgrnam(),
+ * and getgrouplist() can take a network round trip. sim and simd run
+ * as root and fill the cache; approve only reads it.
+ *
+ * Lookups that find nothing are cached too, for a shorter time.
+ * Group membership changes take up to the TTL to have effect.
+ */
+#include "simproto.pb.h"
+
+#include <memory>
+
+namespace Sim {
+
+// Use the identity cache in the config, if any, for lookups for as
+// long as this object lives. If it can't be opened lookups just go to
+// NSS.
+class IdentityCache
+{
+public:
+    explicit IdentityCache(const simproto::SimConfig& config);
+    ~IdentityCache();
+
+    // No copy or move.
+    IdentityCache(const IdentityCache&) = delete;
+    IdentityCache(IdentityCache&&) = delete;
+    IdentityCache& operator=(const IdentityCache&) = delete;
+    IdentityCache& operator=(IdentityCache&&) = delete;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace Sim
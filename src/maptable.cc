@@ -0,0 +1,259 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "maptable.h"
+
+// Project
+#include "util.h"
+
+// C++
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr std::array<char, 8> magic{ 'S', 'I', 'M', 'T', 'A', 'B', 'L', '1' };
+
+// Slots to try for a key before replacing something.
+constexpr uint32_t max_probes = 8;
+
+// Anyone who can open the table can lock it, so don't wait forever on
+// someone who is sitting on the lock.
+constexpr auto max_lock_wait = std::chrono::seconds(1);
+
+[[nodiscard]] std::chrono::steady_clock::time_point lock_deadline()
+{
+    return std::chrono::steady_clock::now() + max_lock_wait;
+}
+
+struct Header {
+    std::array<char, 8> magic;
+    uint32_t slots;
+    uint32_t value_size;
+};
+} // namespace
+
+struct MapTable::Slot {
+    Digest key;
+    int64_t expires; // 0 means empty.
+    uint32_t len;
+    uint32_t pad;
+
+    // Followed by value_size bytes of value.
+    [[nodiscard]] uint8_t* value() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+MapTable::MapTable(const std::string& fn,
+                   uint32_t slots,
+                   uint32_t value_size,
+                   Access access)
+    : fn_(fn),
+      slots_(slots),
+      value_size_(value_size),
+      slot_size_((sizeof(Slot) + value_size + 7) / 8 * 8)
+{
+    if (slots_ == 0) {
+        throw std::runtime_error("table " + fn + " must have at least one slot");
+    }
+    const mode_t mode = access == Access::owner_only ? 0600 : 0644;
+    fd_ = open(fn.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (fd_ == -1 && errno == EACCES && access == Access::world_readable) {
+        fd_ = open(fn.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        writable_ = false;
+    }
+    if (fd_ == -1) {
+        throw SysError("open(" + fn + ")");
+    }
+    Defer defer([this] { ::close(fd_); });
+
+    // Only trust a table that nobody else could have written to.
+    struct stat st {
+    };
+    if (fstat(fd_, &st)) {
+        throw SysError("fstat(" + fn + ")");
+    }
+    const bool owner_ok = st.st_uid == geteuid() || (!writable_ && st.st_uid == 0);
+    const mode_t unsafe = access == Access::owner_only ? 077 : 022;
+    if (!S_ISREG(st.st_mode) || !owner_ok || (st.st_mode & unsafe)) {
+        throw std::runtime_error("table " + fn + " has unsafe owner or permissions");
+    }
+    if (writable_ && (st.st_mode & 0777) != mode && fchmod(fd_, mode)) {
+        // Created with a restrictive umask.
+        throw SysError("fchmod(" + fn + ")");
+    }
+
+    size_ = sizeof(Header) + slots_ * slot_size_;
+    int replaced = -1;
+    {
+        FileLock _(fd_, LOCK_SH, lock_deadline(), "table " + fn_);
+        Header hdr{};
+        const bool ok = fstat(fd_, &st) == 0 && static_cast<size_t>(st.st_size) == size_ &&
+                        pread(fd_, &hdr, sizeof hdr, 0) == sizeof hdr &&
+                        hdr.magic == magic && hdr.slots == slots_ &&
+                        hdr.value_size == value_size_;
+        if (!ok) {
+            if (!writable_) {
+                throw std::runtime_error("table " + fn + " has other dimensions");
+            }
+            // Replace rather than truncate, since other processes may
+            // have the old file mapped.
+            replaced = create(fn, mode);
+        }
+    }
+    if (replaced != -1) {
+        ::close(fd_);
+        fd_ = replaced;
+    }
+
+    map_ = mmap(nullptr,
+                size_,
+                writable_ ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED,
+                fd_,
+                0);
+    if (map_ == MAP_FAILED) {
+        throw SysError("mmap(" + fn + ")");
+    }
+    defer.defuse();
+}
+
+// Create an empty table, and atomically put it in place as `fn`.
+int MapTable::create(const std::string& fn, mode_t mode) const
+{
+    const std::string tmp = fn + ".new";
+    unlink(tmp.c_str());
+    const int fd =
+        open(tmp.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (fd == -1) {
+        throw SysError("open(" + tmp + ")");
+    }
+    Defer defer([fd, &tmp] {
+        ::close(fd);
+        unlink(tmp.c_str());
+    });
+    if (fchmod(fd, mode)) {
+        throw SysError("fchmod(" + tmp + ")");
+    }
+    if (ftruncate(fd, size_)) {
+        throw SysError("ftruncate(" + tmp + ")");
+    }
+    Header hdr{};
+    hdr.magic = magic;
+    hdr.slots = slots_;
+    hdr.value_size = value_size_;
+    if (pwrite(fd, &hdr, sizeof hdr, 0) != sizeof hdr) {
+        throw SysError("pwrite(" + tmp + ")");
+    }
+    if (rename(tmp.c_str(), fn.c_str())) {
+        throw SysError("rename(" + tmp + ", " + fn + ")");
+    }
+    defer.defuse();
+    return fd;
+}
+
+MapTable::~MapTable()
+{
+    munmap(map_, size_);
+    ::close(fd_);
+}
+
+MapTable::Slot* MapTable::slot(const Digest& key, uint32_t probe) const
+{
+    // The key is already a cryptographic hash, so any part of it will
+    // do as the hash.
+    uint64_t h;
+    memcpy(&h, key.data(), sizeof h);
+    const auto n = (h + probe) % slots_;
+    return reinterpret_cast<Slot*>(static_cast<char*>(map_) + sizeof(Header) +
+                                   n * slot_size_);
+}
+
+bool MapTable::get(const Digest& key, int64_t now, std::string* value) const
+{
+    FileLock _(fd_, LOCK_SH, lock_deadline(), "table " + fn_);
+    for (uint32_t probe = 0; probe < std::min(max_probes, slots_); probe++) {
+        const auto s = slot(key, probe);
+        if (s->expires > now && s->key == key) {
+            value->assign(reinterpret_cast<const char*>(s->value()),
+                          std::min(s->len, value_size_));
+            return true;
+        }
+    }
+    return false;
+}
+
+void MapTable::put(const Digest& key, const std::string& value, int64_t expires, int64_t now)
+{
+    if (!writable_) {
+        throw std::logic_error("put() on read only table");
+    }
+    if (value.size() > value_size_) {
+        throw std::runtime_error("table value too large");
+    }
+    FileLock _(fd_, LOCK_EX, lock_deadline(), "table " + fn_);
+    Slot* best = nullptr;
+    for (uint32_t probe = 0; probe < std::min(max_probes, slots_); probe++) {
+        const auto s = slot(key, probe);
+        if (s->key == key) {
+            best = s;
+            break;
+        }
+        if (s->expires <= now) {
+            // Empty or expired. Keep looking for the key itself.
+            if (best == nullptr || best->expires > now) {
+                best = s;
+            }
+            continue;
+        }
+        if (best == nullptr || (best->expires > now && s->expires < best->expires)) {
+            best = s;
+        }
+    }
+    best->key = key;
+    best->expires = expires;
+    best->len = static_cast<uint32_t>(value.size());
+    memcpy(best->value(), value.data(), value.size());
+}
+
+void MapTable::erase(const Digest& key)
+{
+    if (!writable_) {
+        throw std::logic_error("erase() on read only table");
+    }
+    FileLock _(fd_, LOCK_EX, lock_deadline(), "table " + fn_);
+    for (uint32_t probe = 0; probe < std::min(max_probes, slots_); probe++) {
+        const auto s = slot(key, probe);
+        if (s->key == key) {
+            s->expires = 0;
+        }
+    }
+}
+
+} // namespace Sim
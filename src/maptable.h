@@ -0,0 +1,95 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Fixed size hash table in a file, shared between processes.
+ *
+ * The file is mmap()ed, so a lookup is one hash and a few compares no
+ * matter how many entries there are, and no parsing. The table holds at
+ * most `slots` entries, each with an expiry time. When all the slots a
+ * key can go in are taken, the entry that expires first is replaced.
+ */
+#include "sha256.h"
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+namespace Sim {
+
+class MapTable
+{
+public:
+    enum class Access {
+        // Only the owner can read or write.
+        owner_only,
+
+        // Anyone can read, only the owner (which must be root for other
+        // users to trust it) can write.
+        world_readable,
+    };
+
+    // Open or create the table in `fn`. The file must be owned by the
+    // effective user, and not be writable by anyone else. A file
+    // created with other dimensions is replaced.
+    //
+    // Anything that locks the file throws LockBusy if someone else
+    // holds the lock for too long.
+    //
+    // With world_readable, users who can't write the file open it read
+    // only, provided it's owned by root.
+    MapTable(const std::string& fn,
+             uint32_t slots,
+             uint32_t value_size,
+             Access access = Access::owner_only);
+    ~MapTable();
+
+    // No copy or move.
+    MapTable(const MapTable&) = delete;
+    MapTable(MapTable&&) = delete;
+    MapTable& operator=(const MapTable&) = delete;
+    MapTable& operator=(MapTable&&) = delete;
+
+    // Get value for key, if it expires after `now`.
+    [[nodiscard]] bool get(const Digest& key, int64_t now, std::string* value) const;
+
+    // Store value for key until `expires`. `value` must not be larger
+    // than value_size.
+    void put(const Digest& key, const std::string& value, int64_t expires, int64_t now);
+
+    // Remove key, if present.
+    void erase(const Digest& key);
+
+    // False if opened read only. put() and erase() then throw.
+    [[nodiscard]] bool writable() const noexcept { return writable_; }
+
+private:
+    struct Slot;
+    [[nodiscard]] Slot* slot(const Digest& key, uint32_t probe) const;
+    [[nodiscard]] int create(const std::string& fn, mode_t mode) const;
+
+    const std::string fn_;
+    int fd_ = -1;
+    bool writable_ = true;
+    void* map_ = nullptr;
+    size_t size_ = 0;
+    const uint32_t slots_;
+    const uint32_t value_size_;
+    const size_t slot_size_;
+};
+
+} // namespace Sim
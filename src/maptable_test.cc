@@ -0,0 +1,124 @@
+#include "maptable.h"
+#include "util.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<string>
+
+#include<fcntl.h>
+#include<sys/file.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+int main()
+{
+  using namespace Sim;
+
+  char tmpl[] = "/tmp/maptable_test.XXXXXX";
+  const int fd = mkstemp(tmpl);
+  assert(fd != -1);
+  close(fd);
+  const std::string fn = tmpl;
+
+  const auto a = sha256("a");
+  const auto b = sha256("b");
+  std::string v;
+  {
+    MapTable t(fn, 16, 8);
+    assert(!t.get(a, 100, &v));
+    t.put(a, "hello", 200, 100);
+    assert(t.get(a, 100, &v) && v == "hello");
+    assert(!t.get(b, 100, &v));
+
+    // Expiry.
+    assert(t.get(a, 199, &v));
+    assert(!t.get(a, 200, &v));
+
+    // Overwrite.
+    t.put(a, "world", 300, 100);
+    assert(t.get(a, 250, &v) && v == "world");
+
+    t.erase(a);
+    assert(!t.get(a, 100, &v));
+
+    bool threw = false;
+    try {
+      t.put(a, "too long value", 300, 100);
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  // Persisted.
+  {
+    MapTable t(fn, 16, 8);
+    t.put(b, "kept", 1000, 100);
+  }
+  {
+    MapTable t(fn, 16, 8);
+    assert(t.get(b, 100, &v) && v == "kept");
+  }
+
+  // Other dimensions resets.
+  {
+    MapTable t(fn, 32, 8);
+    assert(!t.get(b, 100, &v));
+  }
+
+  // Bounded size: a full table evicts what expires first.
+  {
+    const auto c = sha256("c");
+    MapTable t(fn, 2, 8);
+    t.put(a, "a", 500, 100);
+    t.put(b, "b", 400, 100);
+    t.put(c, "c", 600, 100);
+    assert(t.get(a, 100, &v) && v == "a");
+    assert(!t.get(b, 100, &v));
+    assert(t.get(c, 100, &v) && v == "c");
+  }
+
+  // Refuse files others can read.
+  {
+    chmod(fn.c_str(), 0644);
+    bool threw = false;
+    try {
+      MapTable t(fn, 1, 8);
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  // World readable tables are made readable.
+  {
+    unlink(fn.c_str());
+    const auto old = umask(077);
+    {
+      MapTable t(fn, 4, 8, MapTable::Access::world_readable);
+      assert(t.writable());
+    }
+    umask(old);
+    struct stat st{};
+    assert(!stat(fn.c_str(), &st));
+    assert((st.st_mode & 0777) == 0644);
+  }
+
+  // Someone holding the lock makes it fail, not hang.
+  {
+    MapTable t(fn, 4, 8, MapTable::Access::world_readable);
+    const int lfd = open(fn.c_str(), O_RDONLY);
+    assert(lfd != -1);
+    assert(!flock(lfd, LOCK_EX));
+    bool threw = false;
+    try {
+      (void)t.get(a, 100, &v);
+    } catch (const LockBusy&) {
+      threw = true;
+    }
+    assert(threw);
+    close(lfd);
+    assert(!t.get(a, 100, &v));
+  }
+  unlink(fn.c_str());
+}
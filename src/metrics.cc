@@ -0,0 +1,329 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "metrics.h"
+
+// Project
+#include "util.h"
+
+// C++
+#include <array>
+#include <cerrno>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr std::array<char, 8> magic{ 'S', 'I', 'M', 'M', 'E', 'T', 'R', '1' };
+constexpr const char* data_suffix = ".data";
+constexpr mode_t data_mode = 0660;
+constexpr mode_t text_mode = 0644;
+
+// Longest to wait for the data file's lock, which any approver could
+// be holding.
+constexpr auto max_lock_wait = std::chrono::milliseconds(100);
+
+constexpr size_t counter_count = 5;
+constexpr size_t histogram_count = 5;
+
+// Upper bounds per histogram, not counting +Inf. Changing the layout
+// of Data needs a new magic.
+constexpr size_t max_buckets = 12;
+
+constexpr double ns_per_second = 1e9;
+
+struct CounterInfo {
+    const char* name;
+    const char* help;
+};
+
+const std::array<CounterInfo, counter_count> counters{ {
+    { "sim_approvals_total", "Requests approved by an approver." },
+    { "sim_rejections_total", "Requests rejected by an approver." },
+    { "sim_self_approve_attempts_total",
+      "Users trying to approve their own request." },
+    { "sim_parse_failures_total", "Unparsable answers from approvers or the broker." },
+    { "sim_non_approver_connects_total",
+      "Connections to a request socket from someone not an approver." },
+} };
+
+struct HistogramInfo {
+    const char* name;
+    const char* help;
+
+    // Values are recorded as integers, e.g. nanoseconds. Divided by
+    // this they're in the unit of the name.
+    double scale;
+    std::vector<uint64_t> bounds;
+};
+
+// Approvals take a human, so seconds to hours.
+const std::vector<uint64_t> human_bounds{
+    1000000000ULL,    5000000000ULL,    10000000000ULL,  30000000000ULL,
+    60000000000ULL,   120000000000ULL,  300000000000ULL, 600000000000ULL,
+    1800000000000ULL, 3600000000000ULL, 14400000000000ULL,
+};
+
+// Lookups and loading the config, 100us to 5s.
+const std::vector<uint64_t> local_bounds{
+    100000ULL,   500000ULL,    1000000ULL,   5000000ULL,    10000000ULL,
+    50000000ULL, 100000000ULL, 500000000ULL, 1000000000ULL, 5000000000ULL,
+};
+
+const std::array<HistogramInfo, histogram_count> histograms{ {
+    { "sim_first_approver_connect_seconds",
+      "Time from a request to the first approver connecting to it.",
+      ns_per_second,
+      human_bounds },
+    { "sim_decision_seconds",
+      "Time from a request to it being approved or rejected.",
+      ns_per_second,
+      human_bounds },
+    { "sim_nss_lookup_seconds",
+      "Time of user and group lookups not answered by the identity cache.",
+      ns_per_second,
+      local_bounds },
+    { "sim_config_load_seconds", "Time to load and parse the config.", ns_per_second,
+      local_bounds },
+    { "sim_edit_copy_bytes_per_second",
+      "Throughput of copying files in and out of the editor for sim -e.",
+      1,
+      { 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL } },
+} };
+} // namespace
+
+struct Metrics::Data {
+    std::array<char, 8> magic;
+    std::array<uint64_t, counter_count> counters;
+    struct Buckets {
+        // Not cumulative, and the last is +Inf.
+        std::array<uint64_t, max_buckets + 1> buckets;
+        uint64_t sum;
+    };
+    std::array<Buckets, histogram_count> histograms;
+};
+
+Metrics::Metrics(const std::string& fn, gid_t group) : fn_(fn)
+{
+    const std::string data_fn = fn_ + data_suffix;
+    fd_ = open(data_fn.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, data_mode);
+    if (fd_ == -1) {
+        throw SysError("open(" + data_fn + ")");
+    }
+    Defer defer([this] { ::close(fd_); });
+
+    struct stat st {
+    };
+    if (fstat(fd_, &st)) {
+        throw SysError("fstat(" + data_fn + ")");
+    }
+    const bool own = st.st_uid == geteuid();
+    if (!S_ISREG(st.st_mode) || !(own || st.st_uid == 0) || (st.st_mode & 002)) {
+        throw std::runtime_error("metrics " + data_fn +
+                                 " has unsafe owner or permissions");
+    }
+    if (own && st.st_gid != group && fchown(fd_, -1, group)) {
+        throw SysError("fchown(" + data_fn + ")");
+    }
+    if (own && (st.st_mode & 0777) != data_mode && fchmod(fd_, data_mode)) {
+        // Created with a restrictive umask.
+        throw SysError("fchmod(" + data_fn + ")");
+    }
+
+    int replaced = -1;
+    {
+        FileLock _(fd_,
+                   LOCK_SH,
+                   std::chrono::steady_clock::now() + max_lock_wait,
+                   "metrics " + data_fn);
+        std::array<char, 8> m{};
+        const bool ok = fstat(fd_, &st) == 0 &&
+                        static_cast<size_t>(st.st_size) == sizeof(Data) &&
+                        pread(fd_, m.data(), m.size(), 0) == static_cast<ssize_t>(m.size()) &&
+                        m == magic;
+        if (!ok) {
+            if (!own) {
+                throw std::runtime_error("metrics " + data_fn + " has another layout");
+            }
+            // Replace rather than truncate, since other processes may
+            // have the old file mapped.
+            replaced = create(data_fn, group);
+        }
+    }
+    if (replaced != -1) {
+        ::close(fd_);
+        fd_ = replaced;
+    }
+
+    void* m = mmap(nullptr, sizeof(Data), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (m == MAP_FAILED) {
+        throw SysError("mmap(" + data_fn + ")");
+    }
+    data_ = static_cast<Data*>(m);
+    defer.defuse();
+}
+
+// Create empty data, and atomically put it in place as `fn`.
+int Metrics::create(const std::string& fn, gid_t group) const
+{
+    const std::string tmp = fn + ".new";
+    unlink(tmp.c_str());
+    const int fd =
+        open(tmp.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, data_mode);
+    if (fd == -1) {
+        throw SysError("open(" + tmp + ")");
+    }
+    Defer defer([fd, &tmp] {
+        ::close(fd);
+        unlink(tmp.c_str());
+    });
+    if (fchown(fd, -1, group)) {
+        throw SysError("fchown(" + tmp + ")");
+    }
+    if (fchmod(fd, data_mode)) {
+        throw SysError("fchmod(" + tmp + ")");
+    }
+    if (ftruncate(fd, sizeof(Data))) {
+        throw SysError("ftruncate(" + tmp + ")");
+    }
+    if (pwrite(fd, magic.data(), magic.size(), 0) != static_cast<ssize_t>(magic.size())) {
+        throw SysError("pwrite(" + tmp + ")");
+    }
+    if (rename(tmp.c_str(), fn.c_str())) {
+        throw SysError("rename(" + tmp + ", " + fn + ")");
+    }
+    defer.defuse();
+    return fd;
+}
+
+Metrics::~Metrics()
+{
+    munmap(data_, sizeof(Data));
+    ::close(fd_);
+}
+
+void Metrics::add(Counter c) noexcept
+{
+    __atomic_fetch_add(&data_->counters[static_cast<size_t>(c)], 1, __ATOMIC_RELAXED);
+}
+
+void Metrics::observe(Histogram h, uint64_t value) noexcept
+{
+    const auto n = static_cast<size_t>(h);
+    const auto& bounds = histograms[n].bounds;
+    size_t bucket = 0;
+    while (bucket < bounds.size() && value > bounds[bucket]) {
+        bucket++;
+    }
+    if (bucket == bounds.size()) {
+        bucket = max_buckets;
+    }
+    auto& hist = data_->histograms[n];
+    __atomic_fetch_add(&hist.buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist.sum, value, __ATOMIC_RELAXED);
+}
+
+std::string Metrics::text() const
+{
+    std::ostringstream ss;
+    // Enough for the sums to not lose precision, but not so much that
+    // e.g. 0.0005 comes out as 0.00050000000000000001.
+    ss.precision(15);
+    for (size_t c = 0; c < counter_count; c++) {
+        const auto& info = counters[c];
+        ss << "# HELP " << info.name << " " << info.help << "\n"
+           << "# TYPE " << info.name << " counter\n"
+           << info.name << " "
+           << __atomic_load_n(&data_->counters[c], __ATOMIC_RELAXED) << "\n";
+    }
+    for (size_t c = 0; c < histogram_count; c++) {
+        const auto& info = histograms[c];
+        const auto& hist = data_->histograms[c];
+        ss << "# HELP " << info.name << " " << info.help << "\n"
+           << "# TYPE " << info.name << " histogram\n";
+        // The count is the sum of the buckets read, so that they agree
+        // even while others are adding to them.
+        uint64_t count = 0;
+        for (size_t b = 0; b < info.bounds.size(); b++) {
+            count += __atomic_load_n(&hist.buckets[b], __ATOMIC_RELAXED);
+            ss << info.name << "_bucket{le=\"" << info.bounds[b] / info.scale << "\"} "
+               << count << "\n";
+        }
+        count += __atomic_load_n(&hist.buckets[max_buckets], __ATOMIC_RELAXED);
+        ss << info.name << "_bucket{le=\"+Inf\"} " << count << "\n"
+           << info.name << "_sum "
+           << __atomic_load_n(&hist.sum, __ATOMIC_RELAXED) / info.scale << "\n"
+           << info.name << "_count " << count << "\n";
+    }
+    return ss.str();
+}
+
+// Writers are serialized, so that a slow one can't replace the file
+// with older numbers. If another holds the lock this export is
+// skipped, rather than waiting on what may be an approver holding it
+// forever. The next one catches up.
+void Metrics::write_text() const
+{
+    std::unique_ptr<FileLock> lock;
+    try {
+        lock = std::make_unique<FileLock>(
+            fd_, LOCK_EX, std::chrono::steady_clock::time_point{}, "metrics");
+    } catch (const LockBusy&) {
+        return;
+    }
+    const auto data = text();
+    const std::string tmp = fn_ + ".tmp";
+    const int fd = open(
+        tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, text_mode);
+    if (fd == -1) {
+        throw SysError("open(" + tmp + ")");
+    }
+    Defer undo([&tmp] { unlink(tmp.c_str()); });
+    {
+        Defer close([fd] { ::close(fd); });
+        if (fchmod(fd, text_mode)) {
+            throw SysError("fchmod(" + tmp + ")");
+        }
+        for (size_t ofs = 0; ofs < data.size();) {
+            const ssize_t rc = write(fd, data.data() + ofs, data.size() - ofs);
+            if (rc == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw SysError("write(" + tmp + ")");
+            }
+            ofs += rc;
+        }
+    }
+    if (rename(tmp.c_str(), fn_.c_str())) {
+        throw SysError("rename(" + tmp + ", " + fn_ + ")");
+    }
+    undo.defuse();
+}
+
+} // namespace Sim
@@ -0,0 +1,96 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Counters and histograms shared by all sim and approve processes,
+ * exported for node_exporter's textfile collector.
+ *
+ * The numbers live in a small mmap()ed file next to the exported one,
+ * e.g. "sim.prom.data" for "sim.prom". Updating a metric is an atomic
+ * add on it, with no lock and no system call. write_text() renders the
+ * whole file in the Prometheus text format, and atomically replaces
+ * the exported file with it.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+namespace Sim {
+
+enum class Counter {
+    approved,
+    rejected,
+    self_approve, // Tried to approve their own request.
+    parse_failure, // Unparsable answer from an approver or the broker.
+    not_approver, // Connected to the socket without being an approver.
+};
+
+enum class Histogram {
+    first_connect, // Request to the first approver connecting.
+    decision,      // Request to each approval or rejection.
+    nss_lookup,    // User and group lookups not in the identity cache.
+    config_load,
+    edit_copy, // Bytes per second, copying files in and out of the editor.
+};
+
+class Metrics
+{
+public:
+    // Open the data file for the exported file `fn`, creating it if
+    // needed. It's made writable by `group`, so that approvers can
+    // update it too.
+    //
+    // The data file must be owned by the effective user or by root,
+    // and only writable by its owner and group.
+    Metrics(const std::string& fn, gid_t group);
+    ~Metrics();
+
+    // No copy or move.
+    Metrics(const Metrics&) = delete;
+    Metrics(Metrics&&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+    Metrics& operator=(Metrics&&) = delete;
+
+    void add(Counter c) noexcept;
+
+    // Durations for the time histograms, and bytes per second for
+    // edit_copy.
+    void observe(Histogram h, uint64_t value) noexcept;
+    void observe(Histogram h, std::chrono::nanoseconds d) noexcept
+    {
+        observe(h, static_cast<uint64_t>(std::max<int64_t>(d.count(), 0)));
+    }
+
+    // Replace the exported file with the current numbers. Skipped if
+    // another process is doing it.
+    void write_text() const;
+
+    // The current numbers, in the Prometheus text format.
+    [[nodiscard]] std::string text() const;
+
+private:
+    struct Data;
+    [[nodiscard]] int create(const std::string& fn, gid_t group) const;
+
+    const std::string fn_;
+    int fd_ = -1;
+    Data* data_ = nullptr;
+};
+
+} // namespace Sim
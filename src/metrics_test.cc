@@ -0,0 +1,145 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "metrics.h"
+
+#include<cassert>
+#include<cstdlib>
+#include<fstream>
+#include<sstream>
+#include<string>
+#include<vector>
+
+#include<fcntl.h>
+#include<sys/file.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<unistd.h>
+
+namespace {
+bool has_line(const std::string& text, const std::string& line)
+{
+  return ("\n" + text).find("\n" + line + "\n") != std::string::npos;
+}
+
+std::string read_file(const std::string& fn)
+{
+  std::ifstream f(fn);
+  std::stringstream ss;
+  ss << f.rdbuf();
+  return ss.str();
+}
+} // namespace
+
+int main()
+{
+  using namespace Sim;
+  using namespace std::chrono_literals;
+
+  char tmpl[] = "/tmp/metrics_test.XXXXXX";
+  const char* tmp = mkdtemp(tmpl);
+  assert(tmp != nullptr);
+  const std::string fn = std::string(tmp) + "/sim.prom";
+
+  // Concurrent updates from several processes.
+  constexpr int procs = 4;
+  constexpr int n = 1000;
+  {
+    Metrics m(fn, getegid());
+    std::vector<pid_t> pids;
+    for (int c = 0; c < procs; c++) {
+      const pid_t pid = fork();
+      assert(pid != -1);
+      if (pid == 0) {
+        Metrics child(fn, getegid());
+        for (int i = 0; i < n; i++) {
+          child.add(Counter::approved);
+          child.observe(Histogram::decision, 2s);
+        }
+        _exit(0);
+      }
+      pids.push_back(pid);
+    }
+    for (const auto pid : pids) {
+      int status;
+      assert(waitpid(pid, &status, 0) == pid);
+      assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    m.add(Counter::self_approve);
+    m.observe(Histogram::nss_lookup, 300us);
+    m.observe(Histogram::edit_copy, 1ULL << 40);
+
+    const auto text = m.text();
+    assert(has_line(text, "# TYPE sim_approvals_total counter"));
+    assert(has_line(text, "sim_approvals_total 4000"));
+    assert(has_line(text, "sim_rejections_total 0"));
+    assert(has_line(text, "sim_self_approve_attempts_total 1"));
+    assert(has_line(text, "# TYPE sim_decision_seconds histogram"));
+    assert(has_line(text, "sim_decision_seconds_bucket{le=\"1\"} 0"));
+    assert(has_line(text, "sim_decision_seconds_bucket{le=\"5\"} 4000"));
+    assert(has_line(text, "sim_decision_seconds_bucket{le=\"+Inf\"} 4000"));
+    assert(has_line(text, "sim_decision_seconds_sum 8000"));
+    assert(has_line(text, "sim_decision_seconds_count 4000"));
+    assert(has_line(text, "sim_nss_lookup_seconds_bucket{le=\"0.0001\"} 0"));
+    assert(has_line(text, "sim_nss_lookup_seconds_bucket{le=\"0.0005\"} 1"));
+    assert(has_line(text, "sim_edit_copy_bytes_per_second_bucket{le=\"10000000000\"} 0"));
+    assert(has_line(text, "sim_edit_copy_bytes_per_second_bucket{le=\"+Inf\"} 1"));
+
+    m.write_text();
+    assert(read_file(fn) == text);
+    struct stat st{};
+    assert(!stat(fn.c_str(), &st));
+    assert((st.st_mode & 0777) == 0644);
+    assert(!stat((fn + ".data").c_str(), &st));
+    assert((st.st_mode & 0777) == 0660);
+  }
+
+  // Kept across opens.
+  {
+    Metrics m(fn, getegid());
+    assert(has_line(m.text(), "sim_approvals_total 4000"));
+  }
+
+  // Someone holding the lock doesn't block sim. Exporting is skipped,
+  // and opening gives up.
+  {
+    Metrics m(fn, getegid());
+    const int fd = open((fn + ".data").c_str(), O_RDONLY);
+    assert(fd != -1);
+    assert(!flock(fd, LOCK_EX));
+    assert(!unlink(fn.c_str()));
+    m.write_text();
+    assert(access(fn.c_str(), F_OK) == -1);
+    bool threw = false;
+    try {
+      Metrics m2(fn, getegid());
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+    close(fd);
+    m.write_text();
+    assert(access(fn.c_str(), F_OK) == 0);
+  }
+
+  // A data file with another layout is replaced.
+  assert(!truncate((fn + ".data").c_str(), 100));
+  {
+    Metrics m(fn, getegid());
+    assert(has_line(m.text(), "sim_approvals_total 0"));
+  }
+
+  // Not if anyone can write to it.
+  assert(!chmod((fn + ".data").c_str(), 0666));
+  {
+    bool threw = false;
+    try {
+      Metrics m(fn, getegid());
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  assert(!system(("rm -r " + std::string(tmpl)).c_str()));
+}
@@ -0,0 +1,623 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "policy.h"
+
+// C++
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace Sim {
+namespace {
+constexpr auto regex_flags = std::regex::ECMAScript;
+
+// What glibc execvp() uses if PATH is not set.
+constexpr const char* default_path = "/bin:/usr/bin";
+
+// Above this many stat() calls it's cheaper to list the PATH
+// directories once.
+constexpr size_t max_path_stats = 1024;
+
+// Return true if the regex only matches exactly its own text.
+[[nodiscard]] bool is_literal(const std::string& re)
+{
+    return re.find_first_of("\\^$.|?*+()[]{}") == std::string::npos;
+}
+
+// Return the literal text that any match of the regex must start
+// with. May be empty.
+[[nodiscard]] std::string literal_prefix(const std::string& re)
+{
+    if (re.find('|') != std::string::npos) {
+        return "";
+    }
+    const auto end = re.find_first_of("\\^$.|?*+()[]{}");
+    if (end == std::string::npos) {
+        return re;
+    }
+    std::string ret = re.substr(0, end);
+    // A quantifier that allows zero repetitions applies to the
+    // character before it.
+    if (!ret.empty() && (re[end] == '?' || re[end] == '*' || re[end] == '{')) {
+        ret.pop_back();
+    }
+    return ret;
+}
+
+// Like execvp(), only consider regular files that someone can execute.
+[[nodiscard]] bool is_executable(const struct stat& st, FileID* id)
+{
+    if (!S_ISREG(st.st_mode) || !(st.st_mode & 0111)) {
+        return false;
+    }
+    id->dev = st.st_dev;
+    id->ino = st.st_ino;
+    return true;
+}
+
+[[nodiscard]] bool stat_executable(const std::string& fn, FileID* id)
+{
+    struct stat st {
+    };
+    if (stat(fn.c_str(), &st)) {
+        return false;
+    }
+    return is_executable(st, id);
+}
+
+// Like stat_executable(), but return the file opened, or -1.
+[[nodiscard]] int open_executable(const std::string& fn, FileID* id)
+{
+#ifdef O_PATH
+    // Executing needs no read permission, so neither does opening.
+    const int fd = open(fn.c_str(), O_PATH | O_CLOEXEC);
+#else
+    const int fd = open(fn.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st {
+    };
+    if (fstat(fd, &st) || !is_executable(st, id)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+[[nodiscard]] std::vector<std::string> split_path(const std::string& path)
+{
+    std::vector<std::string> ret;
+    for (size_t start = 0;;) {
+        const auto end = path.find(':', start);
+        auto dir = path.substr(start, end - start);
+        if (dir.empty()) {
+            dir = ".";
+        }
+        ret.push_back(std::move(dir));
+        if (end == std::string::npos) {
+            return ret;
+        }
+        start = end + 1;
+    }
+}
+
+// Names in each PATH directory, for resolving many commands without
+// a failed stat() per directory for each one.
+class PathListing
+{
+public:
+    explicit PathListing(const std::string& path);
+    [[nodiscard]] bool resolve(const std::string& cmd, FileID* id) const;
+
+private:
+    std::vector<std::pair<std::string, std::unordered_set<std::string>>> dirs_;
+};
+
+PathListing::PathListing(const std::string& path)
+{
+    for (auto& dir : split_path(path)) {
+        std::unordered_set<std::string> names;
+        DIR* d = opendir(dir.c_str());
+        if (d != nullptr) {
+            while (const struct dirent* ent = readdir(d)) {
+                names.insert(ent->d_name);
+            }
+            closedir(d);
+        }
+        dirs_.emplace_back(std::move(dir), std::move(names));
+    }
+}
+
+bool PathListing::resolve(const std::string& cmd, FileID* id) const
+{
+    for (const auto& dir : dirs_) {
+        if (dir.second.count(cmd) && stat_executable(dir.first + "/" + cmd, id)) {
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+EnvFilter::EnvFilter(const simproto::SimConfig& config)
+{
+    values_.reserve(config.safe_environment_size());
+    for (const auto& safe : config.safe_environment()) {
+        const size_t n = values_.size();
+        values_.push_back(safe.value_regex());
+
+        const auto& key = safe.key_regex();
+        if (is_literal(key)) {
+            literal_[key].push_back(n);
+        } else {
+            patterns_.push_back(Pattern{ literal_prefix(key), key, n });
+        }
+    }
+}
+
+const std::regex& EnvFilter::compiled(const std::string& re) const
+{
+    auto& ret = cache_[re];
+    if (!ret) {
+        ret = std::make_unique<std::regex>(re, regex_flags);
+    }
+    return *ret;
+}
+
+bool EnvFilter::allowed(const std::string& key, const std::string& value) const
+{
+    const auto lit = literal_.find(key);
+    if (lit != literal_.end()) {
+        for (const auto n : lit->second) {
+            if (std::regex_match(value, compiled(values_[n]))) {
+                return true;
+            }
+        }
+    }
+    for (const auto& p : patterns_) {
+        if (key.compare(0, p.prefix.size(), p.prefix) != 0) {
+            continue;
+        }
+        if (std::regex_match(key, compiled(p.key)) &&
+            std::regex_match(value, compiled(values_[p.rule]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::map<std::string, std::string>
+EnvFilter::filter(const std::map<std::string, std::string>& env) const
+{
+    std::map<std::string, std::string> ret;
+    for (const auto& ev : env) {
+        if (allowed(ev.first, ev.second)) {
+            ret.insert(ret.end(), ev);
+        }
+    }
+    return ret;
+}
+
+std::map<std::string, std::string> environ_map(const char* const* env)
+{
+    std::map<std::string, std::string> ret;
+    if (env == nullptr) {
+        return ret;
+    }
+    for (auto cur = env; *cur; cur++) {
+        const std::string entry(*cur);
+        const auto equal_pos = entry.find('=');
+        if (equal_pos == std::string::npos) {
+            std::clog << "Invalid env data: " << entry << std::endl;
+            continue;
+        }
+        ret[entry.substr(0, equal_pos)] = entry.substr(equal_pos + 1);
+    }
+    return ret;
+}
+
+std::map<std::string, std::string>
+filter_environment(const simproto::SimConfig& config,
+                   const std::map<std::string, std::string>& env)
+{
+    return EnvFilter(config).filter(env);
+}
+
+std::string exec_path(const std::map<std::string, std::string>& env)
+{
+    const auto p = env.find("PATH");
+    if (p == env.end()) {
+        return default_path;
+    }
+    return p->second;
+}
+
+bool resolve_command(const std::string& cmd, const std::string& path, FileID* id)
+{
+    if (cmd.empty()) {
+        return false;
+    }
+    if (cmd.find('/') != std::string::npos) {
+        return stat_executable(cmd, id);
+    }
+    for (const auto& dir : split_path(path)) {
+        if (stat_executable(dir + "/" + cmd, id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Executable::Executable(const std::string& cmd, const std::string& path)
+{
+    if (cmd.empty()) {
+        return;
+    }
+    if (cmd.find('/') != std::string::npos) {
+        fd_ = open_executable(cmd, &id_);
+        return;
+    }
+    for (const auto& dir : split_path(path)) {
+        fd_ = open_executable(dir + "/" + cmd, &id_);
+        if (fd_ != -1) {
+            return;
+        }
+    }
+}
+
+Executable::Executable(Executable&& rhs) noexcept : fd_(rhs.fd_), id_(rhs.id_)
+{
+    rhs.fd_ = -1;
+}
+
+Executable::~Executable()
+{
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+const FileID* Executable::id() const noexcept
+{
+#ifdef HAVE_FEXECVE
+    return found() ? &id_ : nullptr;
+#else
+    // exec() would look the path up again, so what it runs may not be
+    // what was matched.
+    return nullptr;
+#endif
+}
+
+void Executable::exec(char* const* argv) const
+{
+#ifdef HAVE_FEXECVE
+    if (fd_ == -1) {
+        errno = ENOENT;
+        return;
+    }
+    // After clearenv() environ may be null, which execvp() takes as
+    // empty but fexecve() doesn't.
+    char* empty[] = { nullptr };
+    char* const* env = environ != nullptr ? environ : empty;
+    fexecve(fd_, argv, env);
+
+    // A script is run by its interpreter opening /dev/fd/<fd>, which
+    // fails with ENOENT if the fd is close-on-exec. Only then is it
+    // left open for the interpreter.
+    if (errno != ENOENT || fcntl(fd_, F_SETFD, 0) == -1) {
+        return;
+    }
+    fexecve(fd_, argv, env);
+#else
+    execvp(argv[0], argv);
+#endif
+}
+
+CommandMatcher::CommandMatcher(const Definitions& defs, std::string path)
+    : path_(std::move(path))
+{
+    size_t count = 0;
+    for (const auto& def : defs) {
+        count += def.command_size();
+    }
+    std::unique_ptr<PathListing> listing;
+    if (count * split_path(path_).size() > max_path_stats) {
+        listing = std::make_unique<PathListing>(path_);
+    }
+
+    for (const auto& def : defs) {
+        for (const auto& cmd : def.command()) {
+            auto name = names_.find(cmd);
+            if (name == names_.end()) {
+                name = names_.emplace(cmd, new_node()).first;
+            }
+            add(name->second, def);
+
+            FileID id{};
+            const bool found = (listing && cmd.find('/') == std::string::npos)
+                                   ? listing->resolve(cmd, &id)
+                                   : resolve_command(cmd, path_, &id);
+            if (found) {
+                auto file = files_.find(id);
+                if (file == files_.end()) {
+                    file = files_.emplace(id, new_node()).first;
+                }
+                add(file->second, def);
+            }
+        }
+    }
+}
+
+size_t CommandMatcher::new_node()
+{
+    nodes_.emplace_back();
+    return nodes_.size() - 1;
+}
+
+// Add the argument specs of a definition to the trie at root.
+void CommandMatcher::add(size_t root, const simproto::CommandDefinition& def)
+{
+    if (def.args_size() == 0) {
+        nodes_[root].rest = true;
+        return;
+    }
+    for (const auto& spec : def.args()) {
+        size_t node = root;
+        for (int c = 0; c < spec.arg_size(); c++) {
+            const auto& m = spec.arg(c);
+            if (m.has_rest() && !m.rest()) {
+                throw std::runtime_error("argument spec for <" + def.command(0) +
+                                         ">: rest: false is not allowed");
+            }
+            if (m.rest()) {
+                if (c != spec.arg_size() - 1) {
+                    throw std::runtime_error("argument spec for <" + def.command(0) +
+                                             ">: rest must be the last argument");
+                }
+                break;
+            }
+            node = add_match(node, m);
+        }
+        if (spec.arg_size() && spec.arg(spec.arg_size() - 1).rest()) {
+            nodes_[node].rest = true;
+        } else {
+            nodes_[node].end = true;
+        }
+    }
+}
+
+// Return the node following `node` when matching `m`, creating it if
+// needed.
+size_t CommandMatcher::add_match(size_t node, const simproto::ArgumentMatch& m)
+{
+    const int set = m.has_literal() + m.has_prefix() + m.has_glob() + m.has_regex() +
+                    m.has_rest();
+    if (set != 1) {
+        throw std::runtime_error("argument match must have exactly one of "
+                                 "literal, prefix, glob, regex, or rest");
+    }
+    if (m.has_literal()) {
+        const auto found = nodes_[node].literal.find(m.literal());
+        if (found != nodes_[node].literal.end()) {
+            return found->second;
+        }
+        const auto next = new_node();
+        nodes_[node].literal[m.literal()] = next;
+        return next;
+    }
+
+    Pattern p{};
+    std::string prefix;
+    if (m.has_prefix()) {
+        p.type = Pattern::Type::prefix;
+        p.str = m.prefix();
+        prefix = p.str;
+    } else if (m.has_glob()) {
+        p.type = Pattern::Type::glob;
+        p.str = m.glob();
+        prefix = p.str.substr(0, p.str.find_first_of("*?[\\"));
+    } else {
+        p.type = Pattern::Type::regex;
+        p.str = m.regex();
+        prefix = literal_prefix(p.str);
+        // Compile now only to report errors while loading the config.
+        const std::regex check(p.str, regex_flags);
+    }
+    for (const auto n : nodes_[node].by_prefix[prefix]) {
+        const auto& existing = nodes_[node].patterns[n];
+        if (existing.type == p.type && existing.str == p.str) {
+            return existing.next;
+        }
+    }
+    p.next = new_node();
+    const auto next = p.next;
+    auto& cur = nodes_[node];
+    cur.by_prefix[prefix].push_back(cur.patterns.size());
+    cur.max_prefix = std::max(cur.max_prefix, prefix.size());
+    cur.patterns.push_back(std::move(p));
+    return next;
+}
+
+bool CommandMatcher::match_pattern(const Pattern& p, const std::string& arg) const
+{
+    switch (p.type) {
+    case Pattern::Type::prefix:
+        return arg.compare(0, p.str.size(), p.str) == 0;
+    case Pattern::Type::glob:
+        return fnmatch(p.str.c_str(), arg.c_str(), 0) == 0;
+    case Pattern::Type::regex:
+        if (!p.re) {
+            p.re = std::make_unique<std::regex>(p.str, regex_flags);
+        }
+        return std::regex_match(arg, *p.re);
+    }
+    return false;
+}
+
+bool CommandMatcher::match(const std::vector<std::string>& args) const
+{
+    if (args.empty()) {
+        return false;
+    }
+    FileID id{};
+    const bool found = !files_.empty() && resolve_command(args[0], path_, &id);
+    return match(args, found ? &id : nullptr);
+}
+
+bool CommandMatcher::match(const std::vector<std::string>& args, const FileID* file) const
+{
+    if (args.empty()) {
+        return false;
+    }
+
+    std::vector<size_t> cur;
+    const auto name = names_.find(args[0]);
+    if (name != names_.end()) {
+        if (nodes_[name->second].rest) {
+            return true;
+        }
+        cur.push_back(name->second);
+    }
+    if (file != nullptr) {
+        const auto found = files_.find(*file);
+        if (found != files_.end()) {
+            cur.push_back(found->second);
+        }
+    }
+
+    std::vector<size_t> next;
+    for (size_t c = 1; !cur.empty(); c++) {
+        for (const auto n : cur) {
+            if (nodes_[n].rest || (c == args.size() && nodes_[n].end)) {
+                return true;
+            }
+        }
+        if (c == args.size()) {
+            return false;
+        }
+        next.clear();
+        for (const auto n : cur) {
+            const auto& node = nodes_[n];
+            const auto lit = node.literal.find(args[c]);
+            if (lit != node.literal.end()) {
+                next.push_back(lit->second);
+            }
+            const auto& arg = args[c];
+            for (size_t len = 0; len <= std::min(arg.size(), node.max_prefix); len++) {
+                const auto cand = node.by_prefix.find(arg.substr(0, len));
+                if (cand == node.by_prefix.end()) {
+                    continue;
+                }
+                for (const auto pn : cand->second) {
+                    const auto& p = node.patterns[pn];
+                    if (match_pattern(p, arg)) {
+                        next.push_back(p.next);
+                    }
+                }
+            }
+        }
+        std::sort(next.begin(), next.end());
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        std::swap(cur, next);
+    }
+    return false;
+}
+
+uint32_t required_approvals(const simproto::SimConfig& config,
+                            const std::vector<std::vector<std::string>>& cmds,
+                            const std::string& path)
+{
+    std::vector<Executable> exes;
+    for (const auto& cmd : cmds) {
+        exes.emplace_back(cmd.empty() ? "" : cmd[0], path);
+    }
+    return required_approvals(config, cmds, exes, path);
+}
+
+uint32_t required_approvals(const simproto::SimConfig& config,
+                            const std::vector<std::vector<std::string>>& cmds,
+                            const std::vector<Executable>& exes,
+                            const std::string& path)
+{
+    // Zero would mean running without asking, which is what
+    // safe_command is for.
+    uint32_t ret = std::max(config.approvals_required(), 1U);
+    for (const auto& rule : config.quorum()) {
+        if (rule.approvals() <= ret) {
+            continue;
+        }
+        const CommandMatcher m(rule.command(), path);
+        for (size_t c = 0; c < cmds.size(); c++) {
+            if (m.match(cmds[c], exes[c].id())) {
+                ret = rule.approvals();
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+Quorum::Quorum(uint32_t needed) : needed_(std::max(needed, 1U)) {}
+
+bool Quorum::answer(uid_t uid,
+                    const std::string& user,
+                    const simproto::ApproveResponse& resp)
+{
+    const auto found = std::find_if(
+        votes_.begin(), votes_.end(), [uid](const Vote& v) { return v.uid == uid; });
+    if (found == votes_.end()) {
+        votes_.push_back(Vote{ uid, user, resp });
+    } else {
+        found->response = resp;
+    }
+    return met();
+}
+
+uint32_t Quorum::approvals() const noexcept
+{
+    return std::count_if(votes_.begin(), votes_.end(), [](const Vote& v) {
+        return v.response.approved();
+    });
+}
+
+std::vector<const Quorum::Vote*> Quorum::approvers() const
+{
+    std::vector<const Vote*> ret;
+    for (const auto& v : votes_) {
+        if (v.response.approved()) {
+            ret.push_back(&v);
+        }
+    }
+    return ret;
+}
+
+} // namespace Sim
@@ -0,0 +1,256 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Compiled forms of the policy parts of SimConfig.
+ *
+ * The config is parsed once per invocation, and everything that's
+ * expensive to set up (regexes, lookup tables) is built once here
+ * instead of once per environment variable or command lookup.
+ */
+#include "simproto.pb.h"
+
+#include <map>
+#include <memory>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace Sim {
+
+// Filter for the environment passed through to the command, built
+// from `safe_environment` in the config.
+//
+// A variable is kept if any rule matches both its key and its value.
+// Rules with a literal key (the common case, e.g. "TERM") are found
+// with a hash lookup. Key patterns are indexed by their literal prefix
+// (e.g. "LC_" for "LC_[A-Z]+"), so that most variables are rejected
+// by a string compare without ever running a regex.
+//
+// Compiling a std::regex is far more expensive than matching one, so
+// regexes are only compiled the first time they're needed, and
+// identical patterns share one compiled regex. A value regex is only
+// needed once a key matched.
+class EnvFilter
+{
+public:
+    explicit EnvFilter(const simproto::SimConfig& config);
+
+    [[nodiscard]] bool allowed(const std::string& key, const std::string& value) const;
+
+    [[nodiscard]] std::map<std::string, std::string>
+    filter(const std::map<std::string, std::string>& env) const;
+
+private:
+    [[nodiscard]] const std::regex& compiled(const std::string& re) const;
+
+    // Value regex per rule, indexed by rule number.
+    std::vector<std::string> values_;
+
+    // Literal key -> rules with that key.
+    std::unordered_map<std::string, std::vector<size_t>> literal_;
+
+    // Rules whose key is a pattern.
+    struct Pattern {
+        std::string prefix;
+        std::string key;
+        size_t rule;
+    };
+    std::vector<Pattern> patterns_;
+
+    mutable std::unordered_map<std::string, std::unique_ptr<std::regex>> cache_;
+};
+
+// Variables of an environment such as `environ`. Entries without a
+// '=' are skipped.
+[[nodiscard]] std::map<std::string, std::string> environ_map(const char* const* env);
+
+// The variables of `env` that may be passed through to the command.
+[[nodiscard]] std::map<std::string, std::string>
+filter_environment(const simproto::SimConfig& config,
+                   const std::map<std::string, std::string>& env);
+
+// The PATH that execvp() will use to find the command, once the
+// environment has been replaced with `env`.
+[[nodiscard]] std::string exec_path(const std::map<std::string, std::string>& env);
+
+// Identity of a file on disk.
+struct FileID {
+    dev_t dev;
+    ino_t ino;
+    bool operator==(const FileID& rhs) const { return dev == rhs.dev && ino == rhs.ino; }
+};
+
+struct FileIDHash {
+    size_t operator()(const FileID& id) const
+    {
+        return std::hash<uint64_t>()(id.ino) * 31 + std::hash<uint64_t>()(id.dev);
+    }
+};
+
+// Find the file that execvp() would run for `cmd`, given `path` as
+// PATH. Returns false if there is none.
+[[nodiscard]] bool resolve_command(const std::string& cmd,
+                                   const std::string& path,
+                                   FileID* id);
+
+// The file that execvp() would run for a command, held open so that
+// running it runs the file that was checked, even if the path has
+// since been pointed somewhere else.
+class Executable
+{
+public:
+    Executable(const std::string& cmd, const std::string& path);
+
+    // Move only.
+    Executable(const Executable&) = delete;
+    Executable(Executable&& rhs) noexcept;
+    Executable& operator=(const Executable&) = delete;
+    Executable& operator=(Executable&&) = delete;
+
+    ~Executable();
+
+    [[nodiscard]] bool found() const noexcept { return fd_ != -1; }
+
+    // The opened file, or -1 if not found.
+    [[nodiscard]] int fd() const noexcept { return fd_; }
+
+    // Identity to match the command by, or null if it wasn't found, or
+    // can't be run by fd on this platform.
+    [[nodiscard]] const FileID* id() const noexcept;
+
+    // Replace this process with the file, with the current environment.
+    // Only returns on error, with errno set.
+    void exec(char* const* argv) const;
+
+private:
+    int fd_ = -1;
+    FileID id_{};
+};
+
+// Index over a list of CommandDefinitions, i.e. `safe_command` or
+// `deny_command`.
+//
+// A command matches if args[0] is listed literally, or if args[0]
+// resolves to the same file as something listed. So "/bin/ls" and
+// "ls" match the same rule, no matter which one the config uses.
+// Building the index costs one PATH search per listed command, but
+// finding the command is constant time no matter the size of the list.
+//
+// The argument specs of all definitions for a command are compiled
+// into one trie, with literal arguments as hash lookups and other
+// argument matches looked up by their literal prefix. The argument
+// list is then matched in a single pass, tracking the set of trie nodes
+// that are still matching.
+class CommandMatcher
+{
+public:
+    using Definitions = google::protobuf::RepeatedPtrField<simproto::CommandDefinition>;
+
+    CommandMatcher(const Definitions& defs, std::string path);
+
+    [[nodiscard]] bool match(const std::vector<std::string>& args) const;
+
+    // Match with args[0] resolved to `file`, or only by name if null.
+    [[nodiscard]] bool match(const std::vector<std::string>& args,
+                             const FileID* file) const;
+
+private:
+    // Argument match other than literal.
+    struct Pattern {
+        enum class Type { prefix, glob, regex } type;
+        std::string str;
+        size_t next;
+        mutable std::unique_ptr<std::regex> re;
+    };
+
+    struct Node {
+        bool end = false;  // Arguments may end here.
+        bool rest = false; // Any remaining arguments match.
+        std::unordered_map<std::string, size_t> literal;
+        std::vector<Pattern> patterns;
+
+        // Patterns indexed by the literal text that a matching argument
+        // must start with, so that only candidates are tried.
+        std::unordered_map<std::string, std::vector<size_t>> by_prefix;
+        size_t max_prefix = 0;
+    };
+
+    [[nodiscard]] size_t new_node();
+    void add(size_t root, const simproto::CommandDefinition& def);
+    [[nodiscard]] size_t add_match(size_t node, const simproto::ArgumentMatch& m);
+    [[nodiscard]] bool match_pattern(const Pattern& p, const std::string& arg) const;
+
+    const std::string path_;
+    std::vector<Node> nodes_;
+
+    // Trie roots for each command.
+    std::unordered_map<std::string, size_t> names_;
+    std::unordered_map<FileID, size_t, FileIDHash> files_;
+};
+
+// Distinct approvers that must approve running `cmds`, given `path` as
+// PATH: approvals_required, or more if a `quorum` rule matches.
+[[nodiscard]] uint32_t
+required_approvals(const simproto::SimConfig& config,
+                   const std::vector<std::vector<std::string>>& cmds,
+                   const std::string& path);
+
+// As above, with each command's args[0] already resolved, one entry in
+// `exes` per command.
+[[nodiscard]] uint32_t
+required_approvals(const simproto::SimConfig& config,
+                   const std::vector<std::vector<std::string>>& cmds,
+                   const std::vector<Executable>& exes,
+                   const std::string& path);
+
+// Answers to a request, counted until enough distinct approvers have
+// approved. An approver's latest answer replaces any earlier one, so
+// approving twice counts once, and a rejection withdraws an approval.
+class Quorum
+{
+public:
+    struct Vote {
+        uid_t uid;
+        std::string user;
+        simproto::ApproveResponse response;
+    };
+
+    explicit Quorum(uint32_t needed);
+
+    // Record an answer. Returns true once the quorum is met.
+    bool
+    answer(uid_t uid, const std::string& user, const simproto::ApproveResponse& resp);
+
+    [[nodiscard]] bool met() const noexcept { return approvals() >= needed_; }
+    [[nodiscard]] uint32_t needed() const noexcept { return needed_; }
+    [[nodiscard]] uint32_t approvals() const noexcept;
+
+    // Current approvals, in the order the approvers first answered.
+    [[nodiscard]] std::vector<const Vote*> approvers() const;
+
+private:
+    const uint32_t needed_;
+
+    // Latest answer per approver, in order of first answer.
+    std::vector<Vote> votes_;
+};
+
+} // namespace Sim
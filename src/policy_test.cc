@@ -0,0 +1,216 @@
+#include "policy.h"
+
+#include<cassert>
+#include<cstdlib>
+
+#include<unistd.h>
+
+int main()
+{
+  using namespace Sim;
+
+  // Environment filter.
+  {
+    simproto::SimConfig config;
+    auto add = [&config](const std::string& k, const std::string& v) {
+      auto e = config.add_safe_environment();
+      e->set_key_regex(k);
+      e->set_value_regex(v);
+    };
+    add("TERM", "[0-9A-Za-z]+");
+    add("LC_[A-Z]+", "[A-Za-z_.-]+");
+    add("X?Y", ".*");
+    add("A|B", "ok");
+    add("DUP", "a");
+    add("DUP", "b");
+    const EnvFilter f(config);
+
+    assert(f.allowed("TERM", "xterm"));
+    assert(!f.allowed("TERM", "x term"));
+    assert(!f.allowed("TERMX", "xterm"));
+    assert(f.allowed("LC_ALL", "C"));
+    assert(!f.allowed("LC_", "C"));
+    assert(!f.allowed("LC_all", "C"));
+    assert(f.allowed("Y", ""));
+    assert(f.allowed("XY", "anything"));
+    assert(f.allowed("A", "ok"));
+    assert(f.allowed("B", "ok"));
+    assert(!f.allowed("B", "nok"));
+    assert(f.allowed("DUP", "a"));
+    assert(f.allowed("DUP", "b"));
+    assert(!f.allowed("DUP", "c"));
+    assert(!f.allowed("PATH", "/bin"));
+
+    const auto env = f.filter({ { "TERM", "xterm" }, { "PATH", "/bin" } });
+    assert(env.size() == 1);
+    assert(env.at("TERM") == "xterm");
+  }
+
+  // Command matching.
+  {
+    simproto::SimConfig config;
+    config.add_safe_command()->add_command("ls");
+    auto def = config.add_safe_command();
+    def->add_command("/bin/true");
+    def->add_command("no-such-command");
+    const CommandMatcher m(config.safe_command(), "/usr/bin:/bin");
+
+    assert(m.match({ "ls" }));
+    assert(m.match({ "ls", "-l" }));
+    assert(m.match({ "/bin/ls" }));
+    assert(m.match({ "/usr/bin/ls" }));
+    assert(m.match({ "true" }));
+    assert(m.match({ "no-such-command" }));
+    assert(!m.match({ "cat" }));
+    assert(!m.match({ "/bin/cat" }));
+    assert(!m.match({}));
+  }
+
+  // A resolved command stays the file it was resolved to.
+  {
+    simproto::SimConfig config;
+    config.add_safe_command()->add_command("true");
+    const CommandMatcher m(config.safe_command(), "/usr/bin:/bin");
+
+    char tmpl[] = "/tmp/policy_test.XXXXXX";
+    const char* dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    const std::string link = std::string(dir) + "/cmd";
+    assert(!symlink("/bin/true", link.c_str()));
+    const Executable exe(link, "/usr/bin:/bin");
+    assert(exe.found());
+    assert(!unlink(link.c_str()));
+    assert(!symlink("/bin/sh", link.c_str()));
+    if (exe.id() != nullptr) {
+      assert(m.match({ link }, exe.id()));
+    }
+    assert(!m.match({ link }));
+    assert(!m.match({ link }, nullptr));
+    assert(!unlink(link.c_str()));
+    assert(!rmdir(dir));
+    assert(!Executable("no-such-command-hopefully", "/usr/bin:/bin").found());
+  }
+
+  // Argument specs.
+  {
+    simproto::SimConfig config;
+    auto def = config.add_safe_command();
+    def->add_command("systemctl");
+    auto spec = def->add_args();
+    spec->add_arg()->set_literal("status");
+    spec->add_arg()->set_rest(true);
+    spec = def->add_args();
+    spec->add_arg()->set_literal("list-units");
+    spec = def->add_args();
+    spec->add_arg()->set_prefix("--user");
+    spec->add_arg()->set_glob("show-*");
+    spec->add_arg()->set_regex("[a-z]+\\.service");
+
+    def = config.add_safe_command();
+    def->add_command("true");
+    def->add_args();
+
+    const CommandMatcher m(config.safe_command(), "/usr/bin:/bin");
+    assert(m.match({ "systemctl", "status" }));
+    assert(m.match({ "systemctl", "status", "foo", "bar" }));
+    assert(!m.match({ "systemctl", "stop", "foo" }));
+    assert(!m.match({ "systemctl" }));
+    assert(m.match({ "systemctl", "list-units" }));
+    assert(!m.match({ "systemctl", "list-units", "--all" }));
+    assert(m.match({ "systemctl", "--user=me", "show-environment", "a.service" }));
+    assert(!m.match({ "systemctl", "--user=me", "show-environment", "a.socket" }));
+    assert(!m.match({ "systemctl", "--user=me", "hide", "a.service" }));
+    assert(m.match({ "true" }));
+    assert(m.match({ "/bin/true" }));
+    assert(!m.match({ "true", "x" }));
+  }
+
+  // Bad argument specs.
+  {
+    simproto::SimConfig config;
+    auto spec = config.add_deny_command();
+    spec->add_command("x");
+    auto arg = spec->add_args()->add_arg();
+    arg->set_literal("a");
+    arg->set_prefix("b");
+    bool thrown = false;
+    try {
+      const CommandMatcher m(config.deny_command(), "/bin");
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    assert(thrown);
+
+    // rest: false would otherwise match only an empty argument.
+    simproto::SimConfig config2;
+    spec = config2.add_deny_command();
+    spec->add_command("y");
+    spec->add_args()->add_arg()->set_rest(false);
+    thrown = false;
+    try {
+      const CommandMatcher m(config2.deny_command(), "/bin");
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+
+  // Environment parsing.
+  {
+    const char* env[] = { "A=1", "B=x=y", "junk", "C=", "A=2", nullptr };
+    const auto m = environ_map(env);
+    assert(m.size() == 3);
+    assert(m.at("A") == "2");
+    assert(m.at("B") == "x=y");
+    assert(m.at("C").empty());
+    assert(environ_map(nullptr).empty());
+  }
+
+  // Approvers needed.
+  {
+    simproto::SimConfig config;
+    assert(required_approvals(config, { { "true" } }, "/usr/bin:/bin") == 1);
+    config.set_approvals_required(0);
+    assert(required_approvals(config, { { "true" } }, "/usr/bin:/bin") == 1);
+    auto rule = config.add_quorum();
+    rule->add_command()->add_command("rm");
+    auto big = config.add_quorum();
+    big->set_approvals(3);
+    auto def = big->add_command();
+    def->add_command("shutdown");
+    def->add_args();
+    assert(required_approvals(config, { { "true" } }, "/usr/bin:/bin") == 1);
+    assert(required_approvals(config, { { "/bin/rm", "x" } }, "/usr/bin:/bin") == 2);
+    assert(required_approvals(config, { { "rm" }, { "shutdown" } }, "/bin") == 3);
+    assert(required_approvals(config, { { "shutdown", "-h" } }, "/bin") == 1);
+    assert(required_approvals(config, {}, "/bin") == 1);
+  }
+
+  // Counting distinct approvers.
+  {
+    simproto::ApproveResponse yes;
+    yes.set_approved(true);
+    yes.set_cache_seconds(60);
+    simproto::ApproveResponse no;
+    no.set_approved(false);
+
+    Quorum q(2);
+    assert(!q.met());
+    assert(!q.answer(1001, "alice", yes));
+    assert(!q.answer(1001, "alice", yes));
+    assert(q.approvals() == 1);
+    assert(!q.answer(1002, "bob", no));
+    assert(q.answer(1003, "carol", yes));
+    assert(q.approvals() == 2);
+    assert(!q.answer(1001, "alice", no));
+    assert(q.approvals() == 1);
+    assert(q.answer(1002, "bob", yes));
+    const auto a = q.approvers();
+    assert(a.size() == 2);
+    assert(a[0]->user == "bob" && a[1]->user == "carol");
+
+    Quorum one(0);
+    assert(one.needed() == 1);
+    assert(one.answer(1001, "alice", yes));
+  }
+}
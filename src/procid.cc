@@ -0,0 +1,169 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "procid.h"
+
+// C++
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// POSIX
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr const char* boot_id_file = "/proc/sys/kernel/random/boot_id";
+
+// Hex digits of the boot id kept. Enough to tell boots apart, while
+// keeping socket names short.
+constexpr size_t boot_len = 8;
+
+// Fields of /proc/<pid>/stat, counting from 1.
+constexpr int state_field = 3;
+constexpr int start_field = 22;
+
+[[nodiscard]] bool read_file(const std::string& fn, std::string* data)
+{
+    std::ifstream f(fn);
+    if (!f) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    *data = ss.str();
+    return true;
+}
+
+[[nodiscard]] bool boot_id(std::string* boot)
+{
+    std::string data;
+    if (!read_file(boot_id_file, &data)) {
+        return false;
+    }
+    boot->clear();
+    for (const char ch : data) {
+        if (isxdigit(static_cast<unsigned char>(ch)) && boot->size() < boot_len) {
+            boot->push_back(static_cast<char>(tolower(ch)));
+        }
+    }
+    return boot->size() == boot_len;
+}
+
+// Start time of `pid`, and whether it has exited but not been reaped.
+// Returns false if there is no such process.
+[[nodiscard]] bool start_time(pid_t pid, uint64_t* start, bool* zombie = nullptr)
+{
+    std::string data;
+    if (!read_file("/proc/" + std::to_string(pid) + "/stat", &data)) {
+        return false;
+    }
+    // The command name is in parens, and may contain anything,
+    // including spaces and parens.
+    const auto paren = data.rfind(')');
+    if (paren == std::string::npos) {
+        return false;
+    }
+    std::istringstream ss(data.substr(paren + 1));
+    std::string field;
+    for (int c = 3; c <= start_field; c++) {
+        if (!(ss >> field)) {
+            return false;
+        }
+        if (c == state_field && zombie != nullptr) {
+            *zombie = field == "Z" || field == "X";
+        }
+    }
+    char* end = nullptr;
+    *start = strtoull(field.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+[[nodiscard]] bool parse_number(const std::string& s, uint64_t* n)
+{
+    if (s.empty() || !std::all_of(s.begin(), s.end(), [](char ch) {
+            return ch >= '0' && ch <= '9';
+        })) {
+        return false;
+    }
+    errno = 0;
+    *n = strtoull(s.c_str(), nullptr, 10);
+    return errno == 0;
+}
+} // namespace
+
+bool self_process_id(ProcessID* id)
+{
+    id->pid = getpid();
+    return start_time(id->pid, &id->start) && boot_id(&id->boot);
+}
+
+std::string to_string(const ProcessID& id)
+{
+    return std::to_string(id.pid) + "-" + std::to_string(id.start) + "-" + id.boot;
+}
+
+bool parse_process_id(const std::string& s, ProcessID* id)
+{
+    const auto a = s.find('-');
+    const auto b = s.find('-', a == std::string::npos ? a : a + 1);
+    if (a == std::string::npos || b == std::string::npos) {
+        return false;
+    }
+    uint64_t pid = 0;
+    if (!parse_number(s.substr(0, a), &pid) || pid == 0 ||
+        pid > static_cast<uint64_t>(INT32_MAX) ||
+        !parse_number(s.substr(a + 1, b - a - 1), &id->start)) {
+        return false;
+    }
+    id->pid = static_cast<pid_t>(pid);
+    id->boot = s.substr(b + 1);
+    return id->boot.size() == boot_len &&
+           std::all_of(id->boot.begin(), id->boot.end(), [](char ch) {
+               return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f');
+           });
+}
+
+Liveness liveness(const ProcessID& id)
+{
+    std::string boot;
+    if (!boot_id(&boot)) {
+        return Liveness::unknown;
+    }
+    if (boot != id.boot) {
+        return Liveness::dead;
+    }
+    uint64_t start = 0;
+    bool zombie = false;
+    if (!start_time(id.pid, &start, &zombie)) {
+        // It may only be hidden from us, e.g. by mounting /proc with
+        // hidepid.
+        if (kill(id.pid, 0) == -1 && errno == ESRCH) {
+            return Liveness::dead;
+        }
+        return Liveness::unknown;
+    }
+    return start == id.start && !zombie ? Liveness::alive : Liveness::dead;
+}
+
+} // namespace Sim
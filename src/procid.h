@@ -0,0 +1,58 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Identity of a process that survives pid reuse and reboots.
+ *
+ * sim puts its own in the names of request sockets, so that approve
+ * can tell that a socket left behind by a killed sim is dead without
+ * connecting to it. A pid alone could have been reused, so the start
+ * time (in clock ticks since boot) is checked too, and the boot it's
+ * from, since ticks start over.
+ *
+ * This needs /proc, i.e. Linux. Elsewhere there is no identity, and
+ * liveness is unknown. Pids are only comparable within one pid
+ * namespace, so anything destructive should double check.
+ */
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+namespace Sim {
+
+struct ProcessID {
+    pid_t pid = 0;
+    uint64_t start = 0;
+
+    // Start of this boot's boot_id, as hex.
+    std::string boot;
+};
+
+// Identity of this process. Returns false if it can't be found.
+[[nodiscard]] bool self_process_id(ProcessID* id);
+
+// As "<pid>-<start>-<boot>", and back. parse_process_id() returns
+// false if `s` isn't one.
+[[nodiscard]] std::string to_string(const ProcessID& id);
+[[nodiscard]] bool parse_process_id(const std::string& s, ProcessID* id);
+
+enum class Liveness { alive, dead, unknown };
+
+// Whether the process `id` is still running.
+[[nodiscard]] Liveness liveness(const ProcessID& id);
+
+} // namespace Sim
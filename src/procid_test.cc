@@ -0,0 +1,86 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "procid.h"
+
+#include<cassert>
+#include<string>
+
+#include<sys/wait.h>
+#include<unistd.h>
+
+int main()
+{
+  using namespace Sim;
+
+  ProcessID self;
+  if (!self_process_id(&self)) {
+    // No /proc.
+    return 0;
+  }
+  assert(self.pid == getpid());
+  assert(liveness(self) == Liveness::alive);
+
+  // Round trip.
+  {
+    ProcessID id;
+    assert(parse_process_id(to_string(self), &id));
+    assert(id.pid == self.pid && id.start == self.start && id.boot == self.boot);
+  }
+
+  // Same pid, other start or boot.
+  {
+    auto other = self;
+    other.start++;
+    assert(liveness(other) == Liveness::dead);
+    other = self;
+    other.boot = other.boot == "00000000" ? "11111111" : "00000000";
+    assert(liveness(other) == Liveness::dead);
+  }
+
+  // A process that has exited, before and after being reaped.
+  {
+    int fds[2];
+    assert(!pipe(fds));
+    const pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+      ProcessID child;
+      if (!self_process_id(&child)) {
+        _exit(1);
+      }
+      const auto s = to_string(child);
+      _exit(write(fds[1], s.data(), s.size()) == static_cast<ssize_t>(s.size()) ? 0 : 1);
+    }
+    close(fds[1]);
+    char buf[64];
+    const auto n = read(fds[0], buf, sizeof buf);
+    assert(n > 0);
+    close(fds[0]);
+    ProcessID child;
+    assert(parse_process_id(std::string(buf, n), &child));
+    assert(child.pid == pid);
+    siginfo_t info;
+    assert(!waitid(P_PID, pid, &info, WEXITED | WNOWAIT));
+    assert(liveness(child) == Liveness::dead);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(liveness(child) == Liveness::dead);
+  }
+
+  // Not identities.
+  {
+    ProcessID id;
+    assert(!parse_process_id("", &id));
+    assert(!parse_process_id("123", &id));
+    assert(!parse_process_id("123-456", &id));
+    assert(!parse_process_id("0-456-0123abcd", &id));
+    assert(!parse_process_id("x-456-0123abcd", &id));
+    assert(!parse_process_id("123-456-0123ABCD", &id));
+    assert(!parse_process_id("123-456-0123abc", &id));
+    assert(!parse_process_id("123--0123abcd", &id));
+    assert(parse_process_id("123-456-0123abcd", &id));
+    assert(id.pid == 123 && id.start == 456 && id.boot == "0123abcd");
+  }
+}
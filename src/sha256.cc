@@ -0,0 +1,165 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+// Self
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "sha256.h"
+
+// C++
+#include <algorithm>
+#include <cstring>
+
+namespace Sim {
+namespace {
+constexpr std::array<uint32_t, 64> k = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2,
+};
+
+[[nodiscard]] constexpr uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+} // namespace
+
+SHA256::SHA256()
+    : h_{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+{
+}
+
+void SHA256::block(const uint8_t* p)
+{
+    std::array<uint32_t, 64> w;
+    for (int c = 0; c < 16; c++) {
+        w[c] = (uint32_t(p[c * 4]) << 24) | (uint32_t(p[c * 4 + 1]) << 16) |
+               (uint32_t(p[c * 4 + 2]) << 8) | uint32_t(p[c * 4 + 3]);
+    }
+    for (int c = 16; c < 64; c++) {
+        const auto s0 = rotr(w[c - 15], 7) ^ rotr(w[c - 15], 18) ^ (w[c - 15] >> 3);
+        const auto s1 = rotr(w[c - 2], 17) ^ rotr(w[c - 2], 19) ^ (w[c - 2] >> 10);
+        w[c] = w[c - 16] + s0 + w[c - 7] + s1;
+    }
+    auto a = h_[0];
+    auto b = h_[1];
+    auto c = h_[2];
+    auto d = h_[3];
+    auto e = h_[4];
+    auto f = h_[5];
+    auto g = h_[6];
+    auto h = h_[7];
+    for (int i = 0; i < 64; i++) {
+        const auto s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        const auto ch = (e & f) ^ (~e & g);
+        const auto t1 = h + s1 + ch + k[i] + w[i];
+        const auto s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        const auto maj = (a & b) ^ (a & c) ^ (b & c);
+        const auto t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h_[0] += a;
+    h_[1] += b;
+    h_[2] += c;
+    h_[3] += d;
+    h_[4] += e;
+    h_[5] += f;
+    h_[6] += g;
+    h_[7] += h;
+}
+
+void SHA256::update(const void* data, size_t len)
+{
+    auto p = static_cast<const uint8_t*>(data);
+    total_ += len;
+    if (buf_len_) {
+        const auto n = std::min(len, buf_.size() - buf_len_);
+        memcpy(&buf_[buf_len_], p, n);
+        buf_len_ += n;
+        p += n;
+        len -= n;
+        if (buf_len_ < buf_.size()) {
+            return;
+        }
+        block(buf_.data());
+        buf_len_ = 0;
+    }
+    for (; len >= buf_.size(); p += buf_.size(), len -= buf_.size()) {
+        block(p);
+    }
+    memcpy(buf_.data(), p, len);
+    buf_len_ = len;
+}
+
+Digest SHA256::final()
+{
+    const uint64_t bits = total_ * 8;
+    const uint8_t pad = 0x80;
+    update(&pad, 1);
+    const uint8_t zero = 0;
+    while (buf_len_ != 56) {
+        update(&zero, 1);
+    }
+    std::array<uint8_t, 8> len;
+    for (int c = 0; c < 8; c++) {
+        len[c] = static_cast<uint8_t>(bits >> (56 - c * 8));
+    }
+    update(len.data(), len.size());
+
+    Digest ret;
+    for (int c = 0; c < 8; c++) {
+        ret[c * 4] = static_cast<uint8_t>(h_[c] >> 24);
+        ret[c * 4 + 1] = static_cast<uint8_t>(h_[c] >> 16);
+        ret[c * 4 + 2] = static_cast<uint8_t>(h_[c] >> 8);
+        ret[c * 4 + 3] = static_cast<uint8_t>(h_[c]);
+    }
+    return ret;
+}
+
+Digest sha256(const std::string& data)
+{
+    SHA256 h;
+    h.update(data);
+    return h.final();
+}
+
+std::string to_hex(const Digest& d)
+{
+    constexpr const char* digits = "0123456789abcdef";
+    std::string ret;
+    for (const auto b : d) {
+        ret.push_back(digits[b >> 4]);
+        ret.push_back(digits[b & 0xf]);
+    }
+    return ret;
+}
+
+} // namespace Sim
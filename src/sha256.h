@@ -0,0 +1,48 @@
+// -*- c++ -*-
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * SHA-256, for keying things on the content of a request.
+ */
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace Sim {
+
+using Digest = std::array<uint8_t, 32>;
+
+class SHA256
+{
+public:
+    SHA256();
+    void update(const void* data, size_t len);
+    void update(const std::string& data) { update(data.data(), data.size()); }
+    [[nodiscard]] Digest final();
+
+private:
+    void block(const uint8_t* p);
+
+    std::array<uint32_t, 8> h_;
+    std::array<uint8_t, 64> buf_{};
+    size_t buf_len_ = 0;
+    uint64_t total_ = 0;
+};
+
+[[nodiscard]] Digest sha256(const std::string& data);
+[[nodiscard]] std::string to_hex(const Digest& d);
+
+} // namespace Sim
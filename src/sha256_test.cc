@@ -0,0 +1,29 @@
+#include "sha256.h"
+
+#include<cassert>
+
+int main()
+{
+  using namespace Sim;
+
+  // FIPS 180-2 test vectors.
+  assert(to_hex(sha256("")) ==
+         "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  assert(to_hex(sha256("abc")) ==
+         "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  assert(to_hex(sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")) ==
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+  assert(to_hex(sha256(std::string(1000000, 'a'))) ==
+         "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+  // Split updates give the same result.
+  {
+    const std::string s(200, 'x');
+    for (size_t split = 0; split <= s.size(); split += 7) {
+      SHA256 h;
+      h.update(s.substr(0, split));
+      h.update(s.substr(split));
+      assert(h.final() == sha256(s));
+    }
+  }
+}
@@ -16,7 +16,15 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "auditlog.h"
+#include "batch.h"
+#include "edit.h"
 #include "fd.h"
+#include "identity.h"
+#include "maptable.h" // Also sha256.h.
+#include "metrics.h"
+#include "policy.h"
+#include "procid.h"
 #include "simproto.pb.h"
 #include "util.h"
 
@@ -30,44 +38,60 @@
 #include "google/protobuf/text_format.h"
 
 // C++
+#include <algorithm>
 #include <array>
 #include <cerrno>
+#include <chrono>
 #include <climits>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <exception>
 #include <fstream>
 #include <iostream>
-#include <regex>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 // POSIX
+#include <fcntl.h>
+#include <getopt.h>
 #include <grp.h>
+#include <poll.h>
 #include <pwd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/utsname.h>
+#include <syslog.h>
 #include <unistd.h>
 
 extern char** environ;
 
 namespace Sim {
 
-int do_edit(uid_t uid, gid_t gid, const std::string& fn);
-
-
 namespace {
 constexpr int max_backlog = 10;
+
+// Approvers that can be deciding on one request at the same time.
+// More wait in the listen backlog.
+constexpr size_t max_approvers = 64;
+
+// Sending the request to an approver, who has just connected and is
+// waiting for it, shouldn't take anywhere near this long.
+constexpr auto approver_write_timeout = std::chrono::seconds(5);
 constexpr mode_t sock_dir_mode = 0755;
 constexpr mode_t sock_file_mode = 0660;
 constexpr int sock_filename_len = 32; // 32*4=128 bits.
 
+// Room for "<uid> <username>" of the approver. For a quorum, the names
+// of all approvers, cut short if need be.
+constexpr uint32_t approval_cache_value_size = 64;
+
 volatile sig_atomic_t sigint = 0;
 
 void sighandler(int) { sigint = 1; }
@@ -109,14 +133,17 @@ public:
 
     // No copy or move.
     SimSocket(const SimSocket&) = delete;
-    SimSocket(SimSocket&&) noexcept;
+    SimSocket(SimSocket&&) = delete;
     SimSocket& operator=(const SimSocket&) = delete;
     SimSocket& operator=(SimSocket&&) noexcept = delete;
 
     ~SimSocket();
 
     void close();
-    [[nodiscard]] FD accept();
+    [[nodiscard]] int get() const noexcept { return sock_; }
+
+    // Accept a connection, or return null if there is none waiting.
+    [[nodiscard]] std::unique_ptr<FD> accept();
 
 private:
     int sock_;
@@ -134,37 +161,58 @@ SimSocket::SimSocket(std::string fn, uid_t suid, gid_t gid)
     }
     Defer defer([&] { close(); });
 
-    // Bind socket.
+    // Bind socket under a hidden name, and only move it into place
+    // once it's ready to accept connections. Otherwise `approve -w`
+    // could see it before it can connect.
+    const auto slash = fn_.rfind('/');
+    const std::string tmp = fn_.substr(0, slash + 1) + "." + fn_.substr(slash + 1);
     {
         PushEUID _(suid);
         struct sockaddr_un sa {
         };
         sa.sun_family = AF_UNIX;
-        strncpy(static_cast<char*>(sa.sun_path), fn_.c_str(), sizeof sa.sun_path);
+        // The name includes our process identity, so a long sock_dir
+        // may not leave room for it.
+        if (tmp.size() >= sizeof sa.sun_path) {
+            throw std::runtime_error("socket name <" + tmp + "> is " +
+                                     std::to_string(tmp.size()) + " bytes, max is " +
+                                     std::to_string(sizeof sa.sun_path - 1) +
+                                     "; sock_dir needs to be shorter");
+        }
+        strncpy(static_cast<char*>(sa.sun_path), tmp.c_str(), sizeof sa.sun_path - 1);
         if (bind(sock_, reinterpret_cast<struct sockaddr*>(&sa), sizeof sa)) {
-            throw SysError("bind(" + fn_ + ")");
+            throw SysError("bind(" + tmp + ")");
         }
-        if (chown(fn_.c_str(), getuid(), gid)) {
+        if (chown(tmp.c_str(), getuid(), gid)) {
             throw SysError("fchmod");
         }
     }
-    if (chmod(fn_.c_str(), sock_file_mode)) {
+    Defer undo([&] {
+        PushEUID _(suid);
+        unlink(tmp.c_str());
+    });
+    if (chmod(tmp.c_str(), sock_file_mode)) {
         throw SysError("fchmod");
     }
 
-    // Listen.
+    // Listen. Nonblocking, since a connection that poll() reported
+    // may be gone by the time it's accepted.
     if (listen(sock_, max_backlog)) {
         throw SysError("listen");
     }
+    if (fcntl(sock_, F_SETFL, fcntl(sock_, F_GETFL) | O_NONBLOCK)) {
+        throw SysError("fcntl(O_NONBLOCK)");
+    }
+    {
+        PushEUID _(suid);
+        if (rename(tmp.c_str(), fn_.c_str())) {
+            throw SysError("rename(" + tmp + ", " + fn_ + ")");
+        }
+    }
+    undo.defuse();
     defer.defuse();
 }
 
-SimSocket::SimSocket(SimSocket&& rhs) noexcept
-    : sock_(rhs.sock_), suid_(rhs.suid_), fn_(rhs.fn_)
-{
-    rhs.sock_ = -1;
-}
-
 void SimSocket::close()
 {
     if (sock_ != -1) {
@@ -186,27 +234,106 @@ SimSocket::~SimSocket()
     }
 }
 
-FD SimSocket::accept()
+std::unique_ptr<FD> SimSocket::accept()
 {
     struct sockaddr_storage sa {
     };
     socklen_t len = sizeof sa;
+    // Accepted sockets don't inherit O_NONBLOCK.
     int ret = ::accept(sock_, reinterpret_cast<struct sockaddr*>(&sa), &len);
     if (ret == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+            return nullptr;
+        }
         throw SysError("accept");
     }
-    return FD(ret);
+    return std::make_unique<FD>(ret);
+}
+
+// A record for the audit log, with who, where, and when filled in.
+[[nodiscard]] simproto::AuditRecord audit_record(simproto::AuditRecord::Type type)
+{
+    simproto::AuditRecord rec;
+    rec.set_type(type);
+    rec.set_time_us(std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count());
+    struct utsname u {
+    };
+    if (!uname(&u)) {
+        rec.set_host(u.nodename);
+    }
+    rec.set_user(uid_to_username(getuid()));
+    rec.set_uid(getuid());
+    rec.set_pid(getpid());
+    return rec;
 }
 
+// Append to the audit log, if there is one. It's only writable by
+// root.
+void audit(AuditLog* log, uid_t suid, const simproto::AuditRecord& rec)
+{
+    if (log == nullptr) {
+        return;
+    }
+    PushEUID _(suid);
+    log->append(rec);
+}
+
+// An approver that has been sent the request, and is deciding.
+struct Approver {
+    std::unique_ptr<FD> fd;
+    uid_t uid;
+    std::string user;
+};
+
 class Checker
 {
 public:
     void set_justification(std::string j);
 
-    // Only returns if check approves action. Otherwise loops forever or
-    // throws.
+    // Require approval by `n` distinct approvers, instead of one.
+    void set_quorum(uint32_t n);
+
+    // Give up on approval after `timeout`, instead of waiting forever.
+    // Approvers are told when that is.
+    void set_timeout(std::chrono::seconds timeout);
+
+    // Record the request and the answers in `log`.
+    void set_audit_log(AuditLog* log) noexcept { audit_ = log; }
+
+    // Count and time the answers in `m`.
+    void set_metrics(Metrics* m) noexcept { metrics_ = m; }
+
+    // Send the request through the simd broker at `fn`, instead of
+    // creating a socket in sock_dir. Returns false if the broker can't
+    // be reached.
+    [[nodiscard]] bool use_broker(const std::string& fn);
+
+    // Only returns if check approves action. Otherwise loops until the
+    // timeout, if any, or throws.
     void check();
 
+    // Instead of check(), accept an earlier approval of the same
+    // request by `user`, from the approval cache.
+    void approve_cached(uid_t uid, const std::string& user);
+
+    [[nodiscard]] const simproto::ApproveRequest& request() const noexcept
+    {
+        return req_;
+    }
+
+    // The approval, once check() has returned. With a quorum its
+    // cache_seconds is the least that any of the approvers granted,
+    // the uid is that of the first approver, and the name lists all of
+    // them, comma separated.
+    [[nodiscard]] const simproto::ApproveResponse& approval() const noexcept
+    {
+        return approval_;
+    }
+    [[nodiscard]] uid_t approver_uid() const noexcept { return approver_uid_; }
+    [[nodiscard]] const std::string& approver() const noexcept { return approver_; }
+
     [[nodiscard]] static Checker
     make_command(const std::string& socks_dir,
                  uid_t suid,
@@ -214,10 +341,23 @@ public:
                  const std::vector<std::string>& args,
                  const std::map<std::string, std::string>& env);
 
+    [[nodiscard]] static Checker
+    make_batch(const std::string& socks_dir,
+               uid_t suid,
+               std::string approver,
+               const std::vector<std::vector<std::string>>& cmds,
+               const std::map<std::string, std::string>& env);
+
     [[nodiscard]] static Checker make_edit(const std::string& socks_dir,
                                            uid_t suid,
                                            std::string approver,
-                                           std::string filename);
+                                           const std::vector<FileEdit::Change>& changes);
+
+    // Ask to read files the user can't, to edit them.
+    [[nodiscard]] static Checker make_read(const std::string& socks_dir,
+                                           uid_t suid,
+                                           std::string approver,
+                                           const std::vector<std::string>& filenames);
 
 
 private:
@@ -226,36 +366,79 @@ private:
             std::string approver,
             simproto::ApproveRequest req);
 
+    void check_socket(const std::string& data, Quorum* quorum);
+    void check_broker(Quorum* quorum);
+    [[nodiscard]] std::unique_ptr<Approver> admit(const std::string& data);
+    [[nodiscard]] bool read_answer(const Approver& a, Quorum* quorum);
+    [[nodiscard]] bool answered(const simproto::ApproveResponse& resp,
+                                uid_t uid,
+                                const std::string& user,
+                                Quorum* quorum);
+    void settle(const Quorum& quorum);
+    void count(Counter c);
+    void observe_elapsed(Histogram h);
+
     simproto::ApproveRequest req_;
     const std::string fn_;
     const std::string approver_group_;
     const gid_t approver_gid_;
-    SimSocket sock_;
+    const std::string socks_dir_;
+    const uid_t suid_;
+    std::unique_ptr<SimSocket> sock_;
+    std::unique_ptr<FD> broker_;
     std::string justification_;
+    AuditLog* audit_ = nullptr;
+    Metrics* metrics_ = nullptr;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::seconds timeout_{ 0 };
+    std::chrono::steady_clock::time_point deadline_ = no_deadline;
+    simproto::ApproveResponse approval_;
+    uid_t approver_uid_ = 0;
+    std::string approver_;
 };
 
+// Name of the request socket: random, and then who we are, if known,
+// so that approve can tell if we've gone away without connecting.
+[[nodiscard]] std::string request_filename()
+{
+    auto ret = make_random_filename(sock_filename_len);
+    ProcessID self;
+    if (self_process_id(&self)) {
+        ret += "-" + to_string(self);
+    }
+    return ret;
+}
+
 // Shared constructor.
 Checker::Checker(const std::string& socks_dir,
                  uid_t suid,
                  std::string approver,
                  simproto::ApproveRequest req)
     : req_(std::move(req)),
+      fn_(request_filename()),
       approver_group_(std::move(approver)),
       approver_gid_(group_to_gid(approver_group_)),
-      fn_(make_random_filename(sock_filename_len)),
-      sock_(socks_dir + "/" + fn_, suid, approver_gid_)
+      socks_dir_(socks_dir),
+      suid_(suid)
 {
+    req_.set_user(uid_to_username(getuid()));
 }
 
-Checker Checker::make_command(const std::string& socks_dir,
-                              uid_t suid,
-                              std::string approver,
-                              const std::vector<std::string>& args,
-                              const std::map<std::string, std::string>& env)
+void set_host(simproto::ApproveRequest* req)
 {
-    simproto::ApproveRequest req;
+    struct utsname u {
+    };
+    if (uname(&u)) {
+        std::cerr << "sim: failed to get hostname: " << strerror(errno) << "\n";
+    } else {
+        req->set_host(u.nodename);
+    }
+}
 
-    auto cmd = req.mutable_command();
+void set_command(simproto::Command* cmd,
+                 const std::vector<std::string>& args,
+                 const std::map<std::string, std::string>& env)
+{
     {
         std::array<char, PATH_MAX> buf{};
         const char* s = getcwd(buf.data(), buf.size());
@@ -265,15 +448,6 @@ Checker Checker::make_command(const std::string& socks_dir,
         cmd->set_cwd(s);
     }
     cmd->set_command(args[0]);
-    {
-        struct utsname u {
-        };
-        if (uname(&u)) {
-            std::cerr << "sim: failed to get hostname: " << strerror(errno) << "\n";
-        } else {
-            req.set_host(u.nodename);
-        }
-    }
     for (const auto& a : args) {
         *cmd->add_args() = a;
     }
@@ -282,188 +456,601 @@ Checker Checker::make_command(const std::string& socks_dir,
         t->set_key(e.first);
         t->set_value(e.second);
     }
-    return Checker(socks_dir, suid, std::move(approver), std::move(req));
+}
+
+[[nodiscard]] simproto::ApproveRequest
+command_request(const std::vector<std::string>& args,
+                const std::map<std::string, std::string>& env)
+{
+    simproto::ApproveRequest req;
+    set_host(&req);
+    set_command(req.mutable_command(), args, env);
+    return req;
+}
+
+[[nodiscard]] simproto::ApproveRequest
+batch_request(const std::vector<std::vector<std::string>>& cmds,
+              const std::map<std::string, std::string>& env)
+{
+    simproto::ApproveRequest req;
+    set_host(&req);
+    for (const auto& args : cmds) {
+        set_command(req.add_batch(), args, env);
+    }
+    return req;
+}
+
+[[nodiscard]] simproto::ApproveRequest
+edit_request(const std::vector<FileEdit::Change>& changes)
+{
+    simproto::ApproveRequest req;
+    set_host(&req);
+    for (const auto& change : changes) {
+        auto pb = changes.size() == 1 ? req.mutable_edit() : req.add_edits();
+        pb->set_filename(change.filename);
+        pb->set_diff(change.diff);
+    }
+    return req;
+}
+
+[[nodiscard]] simproto::ApproveRequest
+read_request(const std::vector<std::string>& filenames)
+{
+    simproto::ApproveRequest req;
+    set_host(&req);
+    for (const auto& fn : filenames) {
+        auto pb = filenames.size() == 1 ? req.mutable_edit() : req.add_edits();
+        pb->set_filename(fn);
+        pb->set_read(true);
+    }
+    return req;
+}
+
+Checker Checker::make_command(const std::string& socks_dir,
+                              uid_t suid,
+                              std::string approver,
+                              const std::vector<std::string>& args,
+                              const std::map<std::string, std::string>& env)
+{
+    return Checker(socks_dir, suid, std::move(approver), command_request(args, env));
+}
+
+Checker Checker::make_batch(const std::string& socks_dir,
+                            uid_t suid,
+                            std::string approver,
+                            const std::vector<std::vector<std::string>>& cmds,
+                            const std::map<std::string, std::string>& env)
+{
+    return Checker(socks_dir, suid, std::move(approver), batch_request(cmds, env));
 }
 
 Checker Checker::make_edit(const std::string& socks_dir,
                            uid_t suid,
                            std::string approver,
-                           std::string filename)
+                           const std::vector<FileEdit::Change>& changes)
 
 {
-    simproto::ApproveRequest req;
-    struct utsname u {
-    };
-    if (uname(&u)) {
-        std::cerr << "sim: failed to get hostname: " << strerror(errno) << "\n";
-    } else {
-        req.set_host(u.nodename);
-    }
+    return Checker(socks_dir, suid, std::move(approver), edit_request(changes));
+}
 
-    auto pb = req.mutable_edit();
-    pb->set_filename(std::move(filename));
-    return Checker(socks_dir, suid, std::move(approver), std::move(req));
+Checker Checker::make_read(const std::string& socks_dir,
+                           uid_t suid,
+                           std::string approver,
+                           const std::vector<std::string>& filenames)
+{
+    return Checker(socks_dir, suid, std::move(approver), read_request(filenames));
 }
 
 void Checker::set_justification(std::string j) { justification_ = std::move(j); }
 
+void Checker::set_timeout(std::chrono::seconds timeout) { timeout_ = timeout; }
+
+void Checker::set_quorum(uint32_t n)
+{
+    if (n > 1) {
+        req_.set_approvals_required(n);
+    } else {
+        req_.clear_approvals_required();
+    }
+}
+
+bool Checker::use_broker(const std::string& fn)
+{
+    try {
+        auto fd = connect(fn);
+        // The broker decides what we run as root, so it had better be
+        // root itself.
+        const auto uid = fd.get_uid();
+        if (uid != suid_) {
+            throw std::runtime_error("broker <" + fn + "> is running as uid " +
+                                     std::to_string(uid));
+        }
+        broker_ = std::make_unique<FD>(std::move(fd));
+        return true;
+    } catch (const SysError& e) {
+        std::cerr << "sim: Broker unavailable, using sock_dir: " << e.what() << "\n";
+        return false;
+    }
+}
+
 void Checker::check()
 {
+    start_ = std::chrono::steady_clock::now();
+
     // Construct proto.
     req_.set_id(fn_);
-    req_.set_user(uid_to_username(getuid()));
+    if (timeout_.count() > 0) {
+        deadline_ = start_ + timeout_;
+        req_.set_deadline_us(std::chrono::duration_cast<std::chrono::microseconds>(
+                                 (std::chrono::system_clock::now() + timeout_)
+                                     .time_since_epoch())
+                                 .count());
+    }
 
     if (!justification_.empty()) {
         req_.set_justification(justification_);
     }
 
-    // Serialize.
-    std::string data;
-    if (!req_.SerializeToString(&data)) {
-        throw std::runtime_error("failed to serialize approval request");
+    {
+        auto rec = audit_record(simproto::AuditRecord::REQUEST);
+        rec.set_id(req_.id());
+        *rec.mutable_request() = req_;
+        audit(audit_, suid_, rec);
     }
 
-    // Try to get it approved.
-    for (;;) {
-        auto fd = sock_.accept();
-        const auto uid = fd.get_uid();
-        if (uid == getuid()) {
-            std::cerr << "sim: Can't approve our own command\n";
-            continue;
+    Quorum quorum(req_.approvals_required());
+    if (broker_) {
+        broker_->set_deadline(deadline_);
+        check_broker(&quorum);
+        // Lets simd forget a request that needed several approvers.
+        broker_.reset();
+    } else {
+        // Serialize.
+        std::string data;
+        if (!req_.SerializeToString(&data)) {
+            throw std::runtime_error("failed to serialize approval request");
         }
+        check_socket(data, &quorum);
+    }
+    settle(quorum);
+}
 
-        // Check that they are an approver.
-        {
-            const auto user = uid_to_username(uid);
-            const auto gid = fd.get_gid();
-            if (!user_is_member(user, gid, approver_group_)) {
-                throw std::runtime_error("user <" + user +
-                                         "> is not part of approver group <" +
-                                         approver_group_ + ">");
-            }
+// Report the answer from an approver. Return true if approved.
+[[nodiscard]] bool approved(const simproto::ApproveResponse& resp,
+                            uid_t uid,
+                            const std::string& user)
+{
+    if (resp.approved()) {
+        std::cerr << "sim: Approved by <" << user << "> (" << uid << ")\n";
+        return true;
+    }
+    const auto comment = [&] {
+        // TODO: filter to only show safe characters.
+        if (resp.has_comment()) {
+            return ": " + resp.comment();
         }
+        return std::string("");
+    }();
+    std::cerr << "sim: Rejected by <" << user << "> (" << uid << ")" << comment << "\n";
+    return false;
+}
 
-        fd.write(data);
-        simproto::ApproveResponse resp;
-        const auto autos = fd.read();
-        if (autos.empty()) {
-            // Just a probe or async approve request.
-            continue;
+// Report and log the answer from an approver, and count it towards
+// `quorum`. Return true once the quorum is met.
+bool Checker::answered(const simproto::ApproveResponse& resp,
+                       uid_t uid,
+                       const std::string& user,
+                       Quorum* quorum)
+{
+    const bool ok = approved(resp, uid, user);
+    count(ok ? Counter::approved : Counter::rejected);
+    observe_elapsed(Histogram::decision);
+    auto rec = audit_record(ok ? simproto::AuditRecord::APPROVED
+                               : simproto::AuditRecord::REJECTED);
+    rec.set_id(req_.id());
+    rec.set_approver(user);
+    rec.set_approver_uid(uid);
+    if (resp.has_comment()) {
+        rec.set_comment(resp.comment());
+    }
+    audit(audit_, suid_, rec);
+    const bool met = quorum->answer(uid, user, resp);
+    if (quorum->needed() > 1) {
+        std::cerr << "sim: " << quorum->approvals() << " of " << quorum->needed()
+                  << " approvals\n";
+    }
+    return met;
+}
+
+void Checker::approve_cached(uid_t uid, const std::string& user)
+{
+    req_.set_id(fn_);
+    if (!justification_.empty()) {
+        req_.set_justification(justification_);
+    }
+    approver_uid_ = uid;
+    approver_ = user;
+    auto rec = audit_record(simproto::AuditRecord::APPROVED);
+    rec.set_id(req_.id());
+    *rec.mutable_request() = req_;
+    rec.set_approver(user);
+    rec.set_approver_uid(uid);
+    rec.set_cached(true);
+    audit(audit_, suid_, rec);
+}
+
+// Record the approval, once the quorum is met.
+void Checker::settle(const Quorum& quorum)
+{
+    const auto votes = quorum.approvers();
+    approval_ = votes.back()->response;
+    approver_uid_ = votes.front()->uid;
+    approver_.clear();
+    for (const auto v : votes) {
+        approval_.set_cache_seconds(
+            std::min(approval_.cache_seconds(), v->response.cache_seconds()));
+        approver_ += (approver_.empty() ? "" : ",") + v->user;
+    }
+}
+
+void Checker::count(Counter c)
+{
+    if (metrics_ != nullptr) {
+        metrics_->add(c);
+    }
+}
+
+// Record the time since check() started.
+void Checker::observe_elapsed(Histogram h)
+{
+    if (metrics_ != nullptr) {
+        metrics_->observe(h, std::chrono::steady_clock::now() - start_);
+    }
+}
+
+// Wait for approvers, serving any number of them at once so that one
+// taking its time, or never answering, doesn't hold up the others.
+void Checker::check_socket(const std::string& data, Quorum* quorum)
+{
+    sock_ = std::make_unique<SimSocket>(socks_dir_ + "/" + fn_, suid_, approver_gid_);
+
+    std::vector<std::unique_ptr<Approver>> approvers;
+    std::vector<struct pollfd> fds;
+    for (bool first = true;;) {
+        fds.clear();
+        fds.push_back({ sock_->get(),
+                        static_cast<short>(approvers.size() < max_approvers ? POLLIN : 0),
+                        0 });
+        for (const auto& a : approvers) {
+            fds.push_back({ a->fd->get(), POLLIN, 0 });
         }
-        if (!resp.ParseFromString(autos)) {
-            std::clog << "sim: Failed to parse approval request of size " << autos.size()
-                      << "\n";
-            continue;
+        const int rc = poll(fds.data(), fds.size(), poll_timeout(deadline_));
+        if (rc == -1) {
+            throw SysError("poll");
         }
-        auto user = uid_to_username(uid);
-        if (resp.approved()) {
-            std::cerr << "sim: Approved by <" << user << "> (" << uid << ")\n";
-            break;
+        if (rc == 0 && std::chrono::steady_clock::now() >= deadline_) {
+            // Closing the connections tells the approvers.
+            throw Timeout("waiting for approval");
         }
-        const auto comment = [&] {
-            // TODO: filter to only show safe characters.
-            if (resp.has_comment()) {
-                return ": " + resp.comment();
+
+        // Each approver answers once, and is then done.
+        for (size_t c = approvers.size(); c-- > 0;) {
+            if (!fds[c + 1].revents) {
+                continue;
             }
-            return std::string("");
-        }();
-        std::cerr << "sim: Rejected by <" << user << "> (" << uid << ")" << comment
+            const auto a = std::move(approvers[c]);
+            approvers.erase(approvers.begin() + c);
+            if (read_answer(*a, quorum)) {
+                return;
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            auto a = admit(data);
+            if (first && a) {
+                observe_elapsed(Histogram::first_connect);
+                first = false;
+            }
+            if (a) {
+                approvers.push_back(std::move(a));
+            }
+        }
+    }
+}
+
+// Accept a connection, and send the request if it's from an approver.
+// Returns null if there was no connection, or it was dropped.
+std::unique_ptr<Approver> Checker::admit(const std::string& data)
+{
+    auto fd = sock_->accept();
+    if (!fd) {
+        return nullptr;
+    }
+
+    // Check that they are an approver. If not, or if that can't be
+    // found out, only they are turned away, not the request.
+    uid_t uid;
+    std::string user;
+    try {
+        const auto cred = fd->peer_cred();
+        uid = cred.uid;
+        if (uid == getuid()) {
+            std::cerr << "sim: Can't approve our own command\n";
+            count(Counter::self_approve);
+            return nullptr;
+        }
+        user = uid_to_username(uid);
+        if (!cred.member_of(approver_gid_, approver_group_, user)) {
+            count(Counter::not_approver);
+            std::clog << "sim: Dropping <" << user << "> (" << uid
+                      << "), not part of approver group <" << approver_group_ << ">\n";
+            return nullptr;
+        }
+    } catch (const std::exception& e) {
+        count(Counter::not_approver);
+        std::clog << "sim: Dropping connection, failed to check approver: " << e.what()
                   << "\n";
+        return nullptr;
     }
+
+    try {
+        fd->set_deadline(std::chrono::steady_clock::now() + approver_write_timeout);
+        fd->write(data);
+        fd->set_deadline(no_deadline);
+    } catch (const std::exception& e) {
+        std::clog << "sim: Sending request to <" << user << ">: " << e.what() << "\n";
+        return nullptr;
+    }
+    return std::make_unique<Approver>(Approver{ std::move(fd), uid, user });
 }
 
-template <typename T>
-[[nodiscard]] std::vector<T> repeated_to_vector(std::function<T(int)> get, int count)
+// Read the answer of an approver that poll() says has one, or has gone
+// away. Return true once the quorum is met.
+bool Checker::read_answer(const Approver& a, Quorum* quorum)
 {
-    std::vector<T> ret(count);
-    for (int c = 0; c < ret.size(); c++) {
-        ret[c] = get(c);
+    std::string autos;
+    try {
+        autos = a.fd->read();
+    } catch (const std::exception& e) {
+        std::clog << "sim: Reading answer from <" << a.user << ">: " << e.what() << "\n";
+        return false;
     }
-    return ret;
+    if (autos.empty()) {
+        // Just a probe or async approve request.
+        return false;
+    }
+    simproto::ApproveResponse resp;
+    if (!resp.ParseFromString(autos)) {
+        std::clog << "sim: Failed to parse approval request of size " << autos.size()
+                  << "\n";
+        count(Counter::parse_failure);
+        return false;
+    }
+    return answered(resp, a.uid, a.user, quorum);
 }
 
-[[nodiscard]] bool is_matched_command(std::function<simproto::CommandDefinition(int)> get,
-                                      int count,
-                                      const std::vector<std::string>& args)
+// The broker has already checked that approvers are in the approver
+// group, and are not us.
+void Checker::check_broker(Quorum* quorum)
 {
-    for (const auto& safe : repeated_to_vector<simproto::CommandDefinition>(
-             [&](int index) { return get(index); }, count)) {
-        for (const auto& cmd : repeated_to_vector<std::string>(
-                 [&](int index) { return safe.command(index); }, safe.command_size())) {
-            if (cmd == args[0]) {
-                return true;
+    {
+        simproto::BrokerRequest breq;
+        *breq.mutable_request() = req_;
+        std::string bdata;
+        if (!breq.SerializeToString(&bdata)) {
+            throw std::runtime_error("failed to serialize broker request");
+        }
+        broker_->write(bdata);
+    }
+
+    for (;;) {
+        const auto autos = [this] {
+            try {
+                return broker_->read();
+            } catch (const Timeout&) {
+                // Hanging up tells the broker, which tells approvers.
+                throw Timeout("waiting for approval");
             }
+        }();
+        if (autos.empty()) {
+            throw std::runtime_error("broker closed the connection");
+        }
+        simproto::BrokerReply reply;
+        if (!reply.ParseFromString(autos)) {
+            std::clog << "sim: Failed to parse broker reply of size " << autos.size()
+                      << "\n";
+            count(Counter::parse_failure);
+            continue;
+        }
+        if (reply.has_error()) {
+            throw std::runtime_error("broker: " + reply.error());
+        }
+        if (!reply.has_response()) {
+            continue;
+        }
+        if (reply.uid() == getuid()) {
+            std::cerr << "sim: Can't approve our own command\n";
+            count(Counter::self_approve);
+            continue;
+        }
+        if (answered(reply.response(), reply.uid(), reply.user(), quorum)) {
+            break;
         }
     }
-    return false;
 }
 
-[[nodiscard]] bool is_safe_command(const simproto::SimConfig& config,
-                                   const std::vector<std::string>& args)
+// Which version of a file this is, so that a cached approval doesn't
+// carry over to a file that's been changed or replaced.
+[[nodiscard]] std::string file_version(const struct stat& st)
 {
-    return is_matched_command([&](int index) { return config.safe_command(index); },
-                              config.safe_command_size(),
-                              args);
+    return std::to_string(st.st_dev) + " " + std::to_string(st.st_ino) + " " +
+           std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) + "." +
+           std::to_string(st.st_mtim.tv_nsec) + " " + std::to_string(st.st_ctim.tv_sec) +
+           "." + std::to_string(st.st_ctim.tv_nsec);
 }
 
-[[nodiscard]] bool is_deny_command(const simproto::SimConfig& config,
-                                   const std::vector<std::string>& args)
+// Digest of what a cached approval has to match. Everything but the
+// ID and justification, in an encoding that's unambiguous and doesn't
+// depend on protobuf serialization details.
+//
+// Also the version of each file run, and of any argument that is a
+// file, such as the script in `sh deploy.sh`, so that editing them
+// needs a new approval.
+[[nodiscard]] Digest request_digest(const simproto::ApproveRequest& req,
+                                    const std::vector<std::vector<std::string>>& cmds,
+                                    const std::vector<Executable>& exes)
 {
-    return is_matched_command([&](int index) { return config.deny_command(index); },
-                              config.deny_command_size(),
-                              args);
+    SHA256 h;
+    const auto add = [&h](const std::string& s) {
+        const uint64_t len = s.size();
+        std::array<uint8_t, 8> buf;
+        for (int c = 0; c < 8; c++) {
+            buf[c] = static_cast<uint8_t>(len >> (56 - c * 8));
+        }
+        h.update(buf.data(), buf.size());
+        h.update(s);
+    };
+    const auto add_command = [&add](const simproto::Command& cmd) {
+        add(cmd.cwd());
+        add(cmd.command());
+        add(std::to_string(cmd.args_size()));
+        for (const auto& a : cmd.args()) {
+            add(a);
+        }
+        add(std::to_string(cmd.environ_size()));
+        for (const auto& e : cmd.environ()) {
+            add(e.key());
+            add(e.value());
+        }
+    };
+    add("sim approval v2");
+    add(req.user());
+    add(req.host());
+    add_command(req.command());
+    add(std::to_string(req.batch_size()));
+    for (const auto& cmd : req.batch()) {
+        add_command(cmd);
+    }
+    // So that one approver's approval isn't reused once the config
+    // asks for more. Only added then, to keep older entries valid.
+    if (req.approvals_required() > 1) {
+        add("approvals " + std::to_string(req.approvals_required()));
+    }
+    for (size_t c = 0; c < cmds.size(); c++) {
+        struct stat st {
+        };
+        if (exes[c].fd() == -1 || fstat(exes[c].fd(), &st)) {
+            add("not found");
+        } else {
+            add(file_version(st));
+        }
+        for (size_t n = 1; n < cmds[c].size(); n++) {
+            if (!stat(cmds[c][n].c_str(), &st) && S_ISREG(st.st_mode)) {
+                add("arg " + std::to_string(n) + " " + file_version(st));
+            }
+        }
+    }
+    return h.final();
 }
 
-[[nodiscard]] std::map<std::string, std::string>
-filter_environment(const simproto::SimConfig& config,
-                   const std::map<std::string, std::string>& env)
+// Open the approval cache, if configured. Failing to is not fatal,
+// it just means asking for approval.
+[[nodiscard]] std::unique_ptr<MapTable> open_approval_cache(const simproto::SimConfig& config,
+                                                            uid_t suid)
 {
-    std::map<std::string, std::string> ret;
-    for (const auto& ev : env) {
-        for (const auto& safe : repeated_to_vector<simproto::EnvironmentDefinition>(
-                 [&](int index) { return config.safe_environment(index); },
-                 config.safe_environment_size())) {
-            const std::regex key_re(safe.key_regex());
-            const std::regex value_re(safe.value_regex());
+    if (config.approval_cache().empty()) {
+        return nullptr;
+    }
+    PushEUID _(suid);
+    try {
+        return std::make_unique<MapTable>(config.approval_cache(),
+                                          config.approval_cache_entries(),
+                                          approval_cache_value_size);
+    } catch (const std::exception& e) {
+        std::cerr << "sim: Approval cache unavailable: " << e.what() << "\n";
+        return nullptr;
+    }
+}
 
-            if (!std::regex_match(ev.first, key_re)) {
-                continue;
-            }
-            if (!std::regex_match(ev.second, value_re)) {
-                continue;
-            }
-            ret[ev.first] = ev.second;
+// Parse an approval cache entry, "<uid> <user>" of the original
+// approver. Returns false if it isn't one.
+[[nodiscard]] bool
+parse_cached_approval(const std::string& entry, uid_t* uid, std::string* user)
+{
+    const auto space = entry.find(' ');
+    if (space == 0 || space == std::string::npos || space > 10 ||
+        space + 1 == entry.size()) {
+        return false;
+    }
+    uint64_t n = 0;
+    for (size_t i = 0; i < space; i++) {
+        if (entry[i] < '0' || entry[i] > '9') {
+            return false;
         }
+        n = n * 10 + (entry[i] - '0');
     }
-    return ret;
+    // -1 is not a uid.
+    if (n >= static_cast<uid_t>(-1)) {
+        return false;
+    }
+    *uid = static_cast<uid_t>(n);
+    *user = entry.substr(space + 1);
+    return true;
 }
 
+// Open the audit log, if configured. Unlike the cache, failing to is
+// fatal.
+[[nodiscard]] std::unique_ptr<AuditLog> open_audit_log(const simproto::SimConfig& config,
+                                                       uid_t suid)
+{
+    if (config.audit_log().empty()) {
+        return nullptr;
+    }
+    PushEUID _(suid);
+    try {
+        return std::make_unique<AuditLog>(
+            config.audit_log(), config.audit_segment_bytes(), config.audit_sync());
+    } catch (const std::exception& e) {
+        throw std::runtime_error(std::string("audit log: ") + e.what());
+    }
+}
 
-[[nodiscard]] std::map<std::string, std::string> environ_map()
+// Open the metrics, if configured. Failing to is not fatal.
+[[nodiscard]] std::unique_ptr<Metrics> open_metrics(const simproto::SimConfig& config,
+                                                    uid_t suid)
 {
-    std::map<std::string, std::string> ret;
-    if (environ == nullptr) {
-        return ret;
+    if (config.metrics_file().empty()) {
+        return nullptr;
     }
-    for (char** cur = environ; *cur; cur++) {
-        const std::string entry(*cur);
-        const auto equal_pos = entry.find('=');
-        if (equal_pos == std::string::npos) {
-            std::clog << "Invalid env data: " << entry << std::endl;
-            continue;
-        }
-        const std::string key(entry.substr(0, equal_pos));
-        const std::string value(entry.substr(equal_pos + 1));
-        ret[key] = value;
+    PushEUID _(suid);
+    try {
+        return std::make_unique<Metrics>(config.metrics_file(),
+                                         group_to_gid(config.approve_group()));
+    } catch (const std::exception& e) {
+        std::cerr << "sim: Metrics unavailable: " << e.what() << "\n";
+        return nullptr;
     }
-    return ret;
+}
+
+[[nodiscard]] EditSync edit_sync(const simproto::SimConfig& config)
+{
+    switch (config.edit_sync()) {
+    case simproto::SimConfig::NONE:
+        return EditSync::none;
+    case simproto::SimConfig::DATA:
+        return EditSync::data;
+    case simproto::SimConfig::FULL:
+        return EditSync::full;
+    }
+    return EditSync::full;
 }
 
 
 [[noreturn]] void usage(const char* av0, int err)
 {
     std::cout << av0
-              << ": Usage [ -h ] [ -j <justification> ] command... | -e /path/file\n";
+              << ": Usage [ -h ] [ -j <justification> ] [ -t <seconds> ] command... | "
+                 "-e /path/file... | --batch <file> [ -P <parallel> ]\n";
     exit(err);
 }
 
@@ -509,19 +1096,48 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
     std::string justification;
     int verbose = 0;
     bool edit = false;
+    std::string batch_file;
+    int parallel = 1;
+    long timeout = -1;
     {
+        const std::array<struct option, 4> longopts{ {
+            { "batch", required_argument, nullptr, 'b' },
+            { "help", no_argument, nullptr, 'h' },
+            { "timeout", required_argument, nullptr, 't' },
+            { nullptr, 0, nullptr, 0 },
+        } };
         int opt;
-        while ((opt = getopt(argc, argv, "+ehj:v")) != -1) {
+        while ((opt = getopt_long(
+                    argc, argv, "+b:ehj:P:t:v", longopts.data(), nullptr)) != -1) {
             switch (opt) {
+            case 'b':
+                batch_file = optarg;
+                break;
             case 'e':
                 edit = true;
                 break;
+            case 'P': {
+                char* end = nullptr;
+                parallel = static_cast<int>(strtol(optarg, &end, 10));
+                if (*end != '\0' || parallel < 1) {
+                    usage(argv[0], EXIT_FAILURE);
+                }
+                break;
+            }
             case 'h':
                 usage(argv[0], EXIT_SUCCESS);
                 break;
             case 'j':
                 justification = optarg;
                 break;
+            case 't': {
+                char* end = nullptr;
+                timeout = strtol(optarg, &end, 10);
+                if (*end != '\0' || timeout < 0) {
+                    usage(argv[0], EXIT_FAILURE);
+                }
+                break;
+            }
             case 'v':
                 verbose++;
                 break;
@@ -537,6 +1153,7 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
 
     // Load config.
     simproto::SimConfig config;
+    const auto config_start = std::chrono::steady_clock::now();
     {
         PushEUID _(nuid);
         std::ifstream f(config_file);
@@ -547,6 +1164,39 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
         }
     }
 
+    const auto config_time = std::chrono::steady_clock::now() - config_start;
+
+    // Opened as root, so that it can be created and updated.
+    std::unique_ptr<IdentityCache> identities;
+    {
+        PushEUID _(nuid);
+        identities = std::make_unique<IdentityCache>(config);
+    }
+
+    const auto metrics = open_metrics(config, nuid);
+    const auto export_metrics = [&metrics, nuid] {
+        if (!metrics) {
+            return;
+        }
+        try {
+            PushEUID _(nuid);
+            metrics->write_text();
+        } catch (const std::exception& e) {
+            std::cerr << "sim: Failed to export metrics: " << e.what() << "\n";
+        }
+    };
+    // Also when giving up, or on errors. Exec doesn't run this.
+    const Defer export_on_exit([&export_metrics] {
+        export_metrics();
+        set_lookup_timer(nullptr);
+    });
+    if (metrics) {
+        metrics->observe(Histogram::config_load, config_time);
+        set_lookup_timer([m = metrics.get()](std::chrono::nanoseconds d) {
+            m->observe(Histogram::nss_lookup, d);
+        });
+    }
+
     const gid_t admin_gid = group_to_gid(config.admin_group());
 
     // Check that we are admin.
@@ -566,7 +1216,23 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
         }
     }
 
-    if (optind == argc) {
+    // Commands to run with --batch.
+    std::vector<std::vector<std::string>> batch;
+    if (!batch_file.empty()) {
+        if (edit || optind != argc) {
+            usage(argv[0], EXIT_FAILURE);
+        }
+        std::ifstream f(batch_file);
+        if (!f) {
+            throw std::runtime_error("failed to open batch file " + batch_file);
+        }
+        const std::string str((std::istreambuf_iterator<char>(f)),
+                              std::istreambuf_iterator<char>());
+        batch = parse_batch(str);
+        if (batch.empty()) {
+            throw std::runtime_error("no commands in batch file " + batch_file);
+        }
+    } else if (optind == argc) {
         usage(argv[0], EXIT_FAILURE);
     }
 
@@ -575,51 +1241,228 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
     sigact.sa_handler = sighandler;
 
     const auto args = args_to_vector(argc - optind, &argv[optind]);
-    if (is_deny_command(config, args)) {
-        std::cerr << "sim: That command is blocked\n";
-        return EXIT_FAILURE;
-    }
+    const auto envs = filter_environment(config, environ_map(environ));
+    const auto path = exec_path(envs);
+    // The commands to run. None for an edit, whose arguments are files,
+    // not a command line.
+    const auto cmds = [&] {
+        if (edit) {
+            return std::vector<std::vector<std::string>>{};
+        }
+        return batch.empty() ? std::vector<std::vector<std::string>>{ args } : batch;
+    }();
 
-    std::string edit_filename;
-    if (edit) {
-        if (args.size() != 1) {
-            std::cerr << "sim: Edit requires exactly one arg, the filename\n";
-            return EXIT_FAILURE;
+    // Resolve each command once, and run what was resolved, so that
+    // what's matched below is what's run. As root, like execvp() will,
+    // so that commands only root can reach are found.
+    std::vector<Executable> exes;
+    {
+        PushEUID _(nuid);
+        for (const auto& cmd : cmds) {
+            exes.emplace_back(cmd[0], path);
         }
-        std::vector<char> buf(PATH_MAX);
-        const char* rc = realpath(args[0].c_str(), buf.data());
-        if (rc == nullptr) {
-            throw SysError("realpath(" + args[0] + ")");
+    }
+    {
+        const CommandMatcher deny(config.deny_command(), path);
+        for (size_t c = 0; c < cmds.size(); c++) {
+            if (deny.match(cmds[c], exes[c].id())) {
+                std::cerr << "sim: That command is blocked: " << cmds[c][0] << "\n";
+                return EXIT_FAILURE;
+            }
         }
-        edit_filename = rc;
     }
 
-    const auto envs = filter_environment(config, environ_map());
-    if (!is_safe_command(config, args)) {
-        // If the sock dir doesn't exist, create it.
-        create_sock_dir(config, nuid);
-        if (sigaction(SIGINT, &sigact, nullptr)) {
+    const auto audit_log = open_audit_log(config, nuid);
+
+    // Edits always need approval.
+    const bool safe = !edit && [&] {
+        const CommandMatcher m(config.safe_command(), path);
+        for (size_t c = 0; c < cmds.size(); c++) {
+            if (!m.match(cmds[c], exes[c].id())) {
+                return false;
+            }
+        }
+        return true;
+    }();
+
+    // Wait for `check` to be approved.
+    const auto wait_for_approval = [&](Checker* check) {
+        // Interrupt waiting, instead of dying, so that a staged edit is
+        // cleaned up.
+        if (sigaction(SIGINT, &sigact, nullptr) || sigaction(SIGTERM, &sigact, nullptr) ||
+            sigaction(SIGHUP, &sigact, nullptr)) {
             throw SysError("sigaction");
         }
+        if (config.broker_socket().empty() || !check->use_broker(config.broker_socket())) {
+            // If the sock dir doesn't exist, create it.
+            create_sock_dir(config, nuid);
+        }
+        if (!justification.empty()) {
+            check->set_justification(justification);
+        }
+        std::cerr << "sim: Waiting for MPA approval...\n";
+        check->check();
+    };
+
+    std::unique_ptr<FileEdit> file_edit;
+    if (edit) {
+        std::vector<std::string> filenames;
+        for (const auto& arg : args) {
+            std::vector<char> buf(PATH_MAX);
+            const char* rc = realpath(arg.c_str(), buf.data());
+            if (rc == nullptr) {
+                throw SysError("realpath(" + arg + ")");
+            }
+            filenames.emplace_back(rc);
+        }
+
+        // Files the user can't read are only copied into the editor
+        // once that's approved, so that editing isn't a way to read
+        // them.
+        uid_t reader = getuid();
+        std::vector<std::string> unreadable;
+        for (const auto& fn : filenames) {
+            if (faccessat(AT_FDCWD, fn.c_str(), R_OK, 0)) {
+                unreadable.push_back(fn);
+            }
+        }
+        if (!unreadable.empty()) {
+            Checker check = Checker::make_read(
+                config.sock_dir(), nuid, config.approve_group(), unreadable);
+            check.set_audit_log(audit_log.get());
+            check.set_metrics(metrics.get());
+            check.set_quorum(required_approvals(config, {}, path));
+            check.set_timeout(std::chrono::seconds(
+                timeout >= 0 ? timeout : config.request_timeout_seconds()));
+            std::cerr << "sim: Reading "
+                      << (unreadable.size() == 1 ? unreadable[0]
+                                                 : std::to_string(unreadable.size()) +
+                                                       " files")
+                      << " needs approval too\n";
+            wait_for_approval(&check);
+            reader = nuid;
+        }
+
+        // Edit first, so that the approver sees the change.
+        file_edit = std::make_unique<FileEdit>(nuid, reader, filenames);
+        const auto& copied = file_edit->copy_stats();
+        if (metrics && copied.time.count() > 0) {
+            metrics->observe(Histogram::edit_copy,
+                             static_cast<uint64_t>(copied.bytes * 1e9 /
+                                                   copied.time.count()));
+        }
+        if (file_edit->changes().empty()) {
+            std::cerr << "sim: No changes"
+                      << (filenames.size() == 1 ? " to " + filenames[0] : "") << "\n";
+            return EXIT_SUCCESS;
+        }
+    }
+
+    // What's run, for the audit log.
+    simproto::ApproveRequest executed;
+    if (!safe) {
         Checker check = [&] {
             if (edit) {
-                return Checker::make_edit(
-                    config.sock_dir(), nuid, config.approve_group(), edit_filename);
+                return Checker::make_edit(config.sock_dir(),
+                                          nuid,
+                                          config.approve_group(),
+                                          file_edit->changes());
+            }
+            if (!batch.empty()) {
+                return Checker::make_batch(
+                    config.sock_dir(), nuid, config.approve_group(), batch, envs);
             }
             return Checker::make_command(
                 config.sock_dir(), nuid, config.approve_group(), args, envs);
         }();
-        if (!justification.empty()) {
-            check.set_justification(justification);
+        check.set_audit_log(audit_log.get());
+        check.set_metrics(metrics.get());
+        check.set_quorum(required_approvals(config, cmds, exes, path));
+        check.set_timeout(std::chrono::seconds(
+            timeout >= 0 ? timeout : config.request_timeout_seconds()));
+        const auto cache = edit ? nullptr : open_approval_cache(config, nuid);
+        const auto digest = request_digest(check.request(), cmds, exes);
+        const auto what =
+            batch.empty() ? args[0] : "batch of " + std::to_string(batch.size());
+        std::string cached;
+        bool hit = false;
+        uid_t cached_uid = 0;
+        std::string cached_user;
+        if (cache) {
+            // Like failing to open it, this just means asking.
+            try {
+                hit = cache->get(digest, time(nullptr), &cached);
+            } catch (const std::exception& e) {
+                std::cerr << "sim: Approval cache unavailable: " << e.what() << "\n";
+            }
+            if (hit && !parse_cached_approval(cached, &cached_uid, &cached_user)) {
+                std::cerr << "sim: Ignoring bad approval cache entry\n";
+                hit = false;
+            }
         }
-        std::cerr << "sim: Waiting for MPA approval...\n";
-        check.check();
+        if (hit) {
+            std::cerr << "sim: Approved by <" << cached_user << "> (" << cached_uid
+                      << "), cached\n";
+            syslog(LOG_AUTHPRIV | LOG_NOTICE,
+                   "user <%s> ran <%s> with cached approval by <%s> (%d) (digest %s)",
+                   check.request().user().c_str(),
+                   what.c_str(),
+                   cached_user.c_str(),
+                   cached_uid,
+                   to_hex(digest).c_str());
+            check.approve_cached(cached_uid, cached_user);
+        } else {
+            wait_for_approval(&check);
+
+            const auto secs = std::min(check.approval().cache_seconds(),
+                                       config.approval_cache_max_seconds());
+            if (cache && secs) {
+                const auto now = time(nullptr);
+                try {
+                    cache->put(digest,
+                               std::to_string(check.approver_uid()) + " " +
+                                   check.approver().substr(0, approval_cache_value_size - 16),
+                               now + secs,
+                               now);
+                    syslog(LOG_AUTHPRIV | LOG_NOTICE,
+                           "<%s> (%d) approved reuse of <%s> by <%s> for %u seconds (digest %s)",
+                           check.approver().c_str(),
+                           check.approver_uid(),
+                           what.c_str(),
+                           check.request().user().c_str(),
+                           secs,
+                           to_hex(digest).c_str());
+                } catch (const std::exception& e) {
+                    std::cerr << "sim: Approval cache unavailable: " << e.what() << "\n";
+                }
+            }
+        }
+        executed = check.request();
+    } else if (audit_log) {
+        executed = [&] {
+            if (edit) {
+                return edit_request(file_edit->changes());
+            }
+            if (!batch.empty()) {
+                return batch_request(batch, envs);
+            }
+            return command_request(args, envs);
+        }();
+    }
+    if (audit_log) {
+        auto rec = audit_record(simproto::AuditRecord::EXECUTED);
+        if (executed.has_id()) {
+            rec.set_id(executed.id());
+        }
+        *rec.mutable_request() = std::move(executed);
+        audit(audit_log.get(), nuid, rec);
     }
 
     const gid_t ngid = get_primary_group(nuid);
 
     if (edit) {
-        return do_edit(nuid, ngid, edit_filename);
+        file_edit->commit(edit_sync(config));
+        return EXIT_SUCCESS;
     }
 
     // std::cerr << "sim: command approved!\n";
@@ -641,6 +1484,10 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
                   << std::endl;
     }
 
+    if (!batch.empty()) {
+        return run_batch(batch, exes, envs, parallel);
+    }
+
     // Clear environment.
     if (clearenv()) {
         throw SysError("clearenv()");
@@ -650,8 +1497,9 @@ void create_sock_dir(const simproto::SimConfig& config, gid_t suid)
     }
 
     // Execute command.
-    execvp(argv[optind], &argv[optind]);
-    throw SysError("execvp()");
+    export_metrics();
+    exes[0].exec(&argv[optind]);
+    throw SysError("exec(" + args[0] + ")");
 }
 } // namespace Sim
 
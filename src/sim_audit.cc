@@ -0,0 +1,317 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Query and maintain the audit log. See auditindex.h.
+ *
+ *   sim-audit query -u alice -H db1 -s 2026-07-01 -e 2026-10-01
+ *   sim-audit verify
+ *   sim-audit maintain -a 30
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+// Project
+#include "auditindex.h"
+#include "simproto.pb.h"
+#include "util.h"
+
+// Libraries
+#include "google/protobuf/text_format.h"
+
+// C++
+#include <array>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// POSIX
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr int64_t us_per_second = 1000000;
+constexpr int default_compress_days = 30;
+
+// ioprio_set() has no glibc wrapper.
+constexpr int ioprio_who_process = 1;
+constexpr int ioprio_class_idle = 3;
+constexpr int ioprio_class_shift = 13;
+
+[[noreturn]] void usage(const char* av0, int err)
+{
+    std::cout << av0 << ": Usage [ -h ] [ -d <dir> ] <command>\n"
+              << "  query [ -u <user> ] [ -H <host> ] [ -c <command> ]\n"
+              << "        [ -s <since> ] [ -e <until> ] [ -v ]\n"
+              << "  verify\n"
+              << "  maintain [ -a <days> ]\n"
+              << "Times are UTC, as \"YYYY-MM-DD\", \"YYYY-MM-DD HH:MM:SS\", or "
+                 "seconds since the epoch.\n";
+    exit(err);
+}
+
+[[nodiscard]] int64_t parse_time(const std::string& s)
+{
+    for (const char* fmt : { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d" }) {
+        struct tm tm {
+        };
+        const char* end = strptime(s.c_str(), fmt, &tm);
+        if (end != nullptr && *end == '\0') {
+            return static_cast<int64_t>(timegm(&tm)) * us_per_second;
+        }
+    }
+    char* end;
+    const long long secs = strtoll(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0') {
+        throw std::runtime_error("bad time <" + s + ">");
+    }
+    return secs * us_per_second;
+}
+
+[[nodiscard]] std::string format_time(int64_t us)
+{
+    const time_t t = us / us_per_second;
+    struct tm tm {
+    };
+    gmtime_r(&t, &tm);
+    std::array<char, 32> buf{};
+    strftime(buf.data(), buf.size(), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf.data();
+}
+
+// What the record is about, in one line.
+[[nodiscard]] std::string summary(const simproto::AuditRecord& r)
+{
+    const auto& req = r.request();
+    std::string ret;
+    const auto add_command = [&ret](const simproto::Command& cmd) {
+        if (!ret.empty()) {
+            ret += "; ";
+        }
+        // args is the whole argv.
+        for (int c = 0; c < cmd.args_size(); c++) {
+            ret += (c ? " " : "") + cmd.args(c);
+        }
+    };
+    if (req.has_command()) {
+        add_command(req.command());
+    }
+    for (const auto& cmd : req.batch()) {
+        add_command(cmd);
+    }
+    // Reading to edit is approved before the edit itself.
+    if (req.has_edit()) {
+        ret += (req.edit().read() ? "read " : "edit ") + req.edit().filename();
+    }
+    for (const auto& e : req.edits()) {
+        ret += (ret.empty() ? (e.read() ? "read " : "edit ") : " ") + e.filename();
+    }
+    if (r.has_approver()) {
+        ret += (ret.empty() ? "by " : " by ") + r.approver();
+    }
+    if (r.cached()) {
+        ret += " (cached)";
+    }
+    return ret;
+}
+
+void print_record(const simproto::AuditRecord& r, bool verbose)
+{
+    if (verbose) {
+        std::string str;
+        google::protobuf::TextFormat::PrintToString(r, &str);
+        std::cout << str << "\n";
+        return;
+    }
+    std::cout << format_time(r.time_us()) << " seq=" << r.seq() << " "
+              << simproto::AuditRecord::Type_Name(r.type()) << " " << r.user() << "@"
+              << r.host();
+    if (r.has_id()) {
+        std::cout << " [" << r.id() << "]";
+    }
+    std::cout << " " << summary(r) << "\n";
+}
+
+[[nodiscard]] int query(const AuditIndex& index, int argc, char** argv)
+{
+    AuditQuery q;
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "hu:H:c:s:e:v")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage(argv[0], EXIT_SUCCESS);
+            break;
+        case 'u':
+            q.user = optarg;
+            break;
+        case 'H':
+            q.host = optarg;
+            break;
+        case 'c':
+            q.command = optarg;
+            break;
+        case 's':
+            q.since_us = parse_time(optarg);
+            break;
+        case 'e':
+            q.until_us = parse_time(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default: /* '?' */
+            usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (argc != optind) {
+        throw std::runtime_error("Trailing args on command line");
+    }
+    uint64_t found = 0;
+    const auto stats = index.query(q, [&](const simproto::AuditRecord& r) {
+        print_record(r, verbose);
+        found++;
+    });
+    std::cerr << found << " records. Segments: " << stats.segments_skipped
+              << " skipped, " << stats.segments_indexed << " indexed, "
+              << stats.segments_read << " read. " << stats.records_read
+              << " records read.\n";
+    return EXIT_SUCCESS;
+}
+
+// Meant to be run from cron or a timer, so stay out of the way of
+// everything else on the machine.
+void lower_priority()
+{
+    if (setpriority(PRIO_PROCESS, 0, 19)) {
+        throw SysError("setpriority()");
+    }
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set,
+                ioprio_who_process,
+                0,
+                ioprio_class_idle << ioprio_class_shift)) {
+        throw SysError("ioprio_set()");
+    }
+#endif
+}
+
+[[nodiscard]] int maintain(AuditIndex* index, int argc, char** argv)
+{
+    int days = default_compress_days;
+    int opt;
+    while ((opt = getopt(argc, argv, "ha:")) != -1) {
+        switch (opt) {
+        case 'h':
+            usage(argv[0], EXIT_SUCCESS);
+            break;
+        case 'a':
+            days = std::stoi(optarg);
+            break;
+        default: /* '?' */
+            usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (argc != optind) {
+        throw std::runtime_error("Trailing args on command line");
+    }
+    lower_priority();
+    const int indexed = index->update();
+    const int64_t before =
+        (static_cast<int64_t>(time(nullptr)) - int64_t{ days } * 86400) * us_per_second;
+    const int compressed = index->compress(before);
+    std::cerr << "Indexed " << indexed << " segments, compressed " << compressed << "\n";
+    return EXIT_SUCCESS;
+}
+
+[[nodiscard]] std::string default_dir()
+{
+    simproto::SimConfig config;
+    std::ifstream f(config_file);
+    const std::string str((std::istreambuf_iterator<char>(f)),
+                          std::istreambuf_iterator<char>());
+    if (!google::protobuf::TextFormat::ParseFromString(str, &config)) {
+        throw std::runtime_error("error parsing config " + std::string(config_file));
+    }
+    if (config.audit_log().empty()) {
+        throw std::runtime_error("no audit_log in " + std::string(config_file));
+    }
+    return config.audit_log();
+}
+
+[[nodiscard]] int mainwrap(int argc, char** argv)
+{
+    // Parse options up to the command.
+    std::string dir;
+    {
+        int opt;
+        while ((opt = getopt(argc, argv, "+hd:")) != -1) {
+            switch (opt) {
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            default: /* '?' */
+                usage(argv[0], EXIT_FAILURE);
+            }
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (dir.empty()) {
+        dir = default_dir();
+    }
+    AuditIndex index(dir);
+
+    const std::string cmd = argv[optind];
+    argc -= optind;
+    argv += optind;
+    optind = 1;
+    if (cmd == "query") {
+        return query(index, argc, argv);
+    }
+    if (cmd == "maintain") {
+        return maintain(&index, argc, argv);
+    }
+    if (cmd == "verify") {
+        if (argc != 1) {
+            throw std::runtime_error("Trailing args on command line");
+        }
+        std::cout << "OK, " << index.verify() << " records\n";
+        return EXIT_SUCCESS;
+    }
+    throw std::runtime_error("unknown command <" + cmd + ">");
+}
+
+} // namespace
+} // namespace Sim
+
+int main(int argc, char** argv)
+{
+    try {
+        return Sim::mainwrap(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,794 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Benchmarks for the per-invocation costs of sim.
+ *
+ * Run with `make bench`. Every result is one line:
+ *
+ *   BENCH <name> <key>=<value>... ns_per_op=<n>
+ *
+ * With -j, every result is instead a JSON object on its own line:
+ *
+ *   {"name":"<name>","params":{"<key>":"<value>",...},"iterations":<n>,"ns_per_op":<n>}
+ *
+ * Names and params identify a result across versions, so to compare
+ * them between releases they are only ever added, not changed. An
+ * optional regex argument only runs benchmarks whose name matches it.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "auditindex.h"
+#include "auditlog.h"
+#include "copyfile.h"
+#include "diff.h"
+#include "edit.h"
+#include "fd.h"
+#include "identity.h"
+#include "metrics.h"
+#include "policy.h"
+#include "simproto.pb.h"
+#include "util.h"
+
+// Libraries
+#include "google/protobuf/text_format.h"
+
+// C++
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Sim {
+extern std::chrono::microseconds slow_nss_delay;
+
+namespace {
+constexpr auto min_bench_time = std::chrono::milliseconds(200);
+
+volatile size_t sink;
+
+// Print results as JSON lines, instead of BENCH lines.
+bool json_output = false;
+
+// Only run benchmarks with a name matching this, if set.
+std::unique_ptr<std::regex> only;
+
+// Only what's needed for the names and params, which are plain ASCII.
+[[nodiscard]] std::string json_string(const std::string& s)
+{
+    std::string ret = "\"";
+    for (const char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            ret += '\\';
+        }
+        ret += ch;
+    }
+    return ret + "\"";
+}
+
+[[nodiscard]] bool selected(const std::string& name)
+{
+    return !only || std::regex_search(name, *only);
+}
+
+// Print one result.
+void report(const std::string& name,
+            const std::vector<std::pair<std::string, std::string>>& params,
+            uint64_t iterations,
+            uint64_t ns)
+{
+    if (json_output) {
+        std::cout << "{\"name\":" << json_string(name) << ",\"params\":{";
+        for (size_t c = 0; c < params.size(); c++) {
+            std::cout << (c ? "," : "") << json_string(params[c].first) << ":"
+                      << json_string(params[c].second);
+        }
+        std::cout << "},\"iterations\":" << iterations
+                  << ",\"ns_per_op\":" << ns / iterations << "}" << std::endl;
+        return;
+    }
+    std::cout << "BENCH " << name;
+    for (const auto& p : params) {
+        std::cout << " " << p.first << "=" << p.second;
+    }
+    std::cout << " ns_per_op=" << ns / iterations << std::endl;
+}
+
+// Run `f` until at least min_bench_time has passed, and print the
+// average time per call.
+void bench(const std::string& name,
+           const std::vector<std::pair<std::string, std::string>>& params,
+           const std::function<void()>& f)
+{
+    if (!selected(name)) {
+        return;
+    }
+    using clock = std::chrono::steady_clock;
+    f(); // Warm up.
+    uint64_t iterations = 0;
+    const auto start = clock::now();
+    auto now = start;
+    for (uint64_t batch = 1; now - start < min_bench_time; batch *= 2) {
+        for (uint64_t c = 0; c < batch; c++) {
+            f();
+        }
+        iterations += batch;
+        now = clock::now();
+    }
+    report(name,
+           params,
+           iterations,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+}
+
+// The environment of a typical CI runner: mostly junk that no rule
+// will let through.
+[[nodiscard]] std::map<std::string, std::string> make_env(int vars)
+{
+    std::map<std::string, std::string> ret{
+        { "TERM", "xterm" },
+        { "LANG", "en_US.UTF-8" },
+        { "LC_ALL", "C" },
+    };
+    for (int c = 0; ret.size() < static_cast<size_t>(vars); c++) {
+        ret["CI_JOB_VARIABLE_" + std::to_string(c)] = "value-" + std::to_string(c);
+    }
+    return ret;
+}
+
+// Half literal keys, half patterns, like a real config.
+[[nodiscard]] simproto::SimConfig make_env_config(int rules)
+{
+    simproto::SimConfig config;
+    for (int c = 0; c < rules; c++) {
+        auto e = config.add_safe_environment();
+        if (c % 2) {
+            e->set_key_regex("APP" + std::to_string(c) + "_[A-Z]+");
+        } else {
+            e->set_key_regex("VAR_" + std::to_string(c));
+        }
+        e->set_value_regex("[0-9A-Za-z._-]+");
+    }
+    auto e = config.add_safe_environment();
+    e->set_key_regex("TERM");
+    e->set_value_regex("[0-9A-Za-z]+");
+    e = config.add_safe_environment();
+    e->set_key_regex("LC_[A-Z]+");
+    e->set_value_regex("[0-9A-Za-z._-]+");
+    return config;
+}
+
+// What filter_environment() used to do: build every regex for every
+// variable.
+[[nodiscard]] std::map<std::string, std::string>
+filter_uncompiled(const simproto::SimConfig& config,
+                  const std::map<std::string, std::string>& env)
+{
+    std::map<std::string, std::string> ret;
+    for (const auto& ev : env) {
+        for (const auto& safe : config.safe_environment()) {
+            const std::regex key_re(safe.key_regex());
+            const std::regex value_re(safe.value_regex());
+            if (std::regex_match(ev.first, key_re) &&
+                std::regex_match(ev.second, value_re)) {
+                ret[ev.first] = ev.second;
+            }
+        }
+    }
+    return ret;
+}
+
+void bench_env_filter()
+{
+    for (const int vars : { 10, 100, 300, 1000 }) {
+        for (const int rules : { 1, 10, 40, 100 }) {
+            const auto env = make_env(vars);
+            const auto config = make_env_config(rules);
+            const std::vector<std::pair<std::string, std::string>> params{
+                { "vars", std::to_string(vars) }, { "rules", std::to_string(rules) }
+            };
+            // Per invocation cost, i.e. including compiling the rules.
+            bench("env_filter", params, [&] {
+                sink = EnvFilter(config).filter(env).size();
+            });
+            if (vars * rules <= 300 * 40) {
+                bench("env_filter_uncompiled", params, [&] {
+                    sink = filter_uncompiled(config, env).size();
+                });
+            }
+        }
+    }
+}
+void bench_command_matcher()
+{
+    for (const int entries : { 10, 100, 1000, 10000 }) {
+        simproto::SimConfig config;
+        for (int c = 0; c < entries; c++) {
+            config.add_safe_command()->add_command("generated-command-" +
+                                                   std::to_string(c));
+        }
+        config.add_safe_command()->add_command("ls");
+        const std::vector<std::pair<std::string, std::string>> params{
+            { "entries", std::to_string(entries) }
+        };
+        const std::string path = "/usr/local/bin:/usr/bin:/bin";
+        bench("command_index_build", params, [&] {
+            sink = CommandMatcher(config.safe_command(), path).match({ "ls" });
+        });
+        const CommandMatcher m(config.safe_command(), path);
+        bench("command_match_literal", params, [&] { sink = m.match({ "ls" }); });
+        bench("command_match_resolved", params, [&] { sink = m.match({ "/bin/ls" }); });
+        bench("command_match_miss", params, [&] { sink = m.match({ "cat" }); });
+    }
+}
+void bench_argspec()
+{
+    for (const int patterns : { 10, 100, 1000, 10000 }) {
+        simproto::SimConfig config;
+        auto def = config.add_safe_command();
+        def->add_command("systemctl");
+        for (int c = 0; c < patterns; c++) {
+            auto spec = def->add_args();
+            if (c % 2) {
+                spec->add_arg()->set_literal("verb" + std::to_string(c));
+                spec->add_arg()->set_rest(true);
+            } else {
+                spec->add_arg()->set_literal("restart");
+                spec->add_arg()->set_glob("unit" + std::to_string(c) + "-*.service");
+            }
+        }
+        const std::vector<std::pair<std::string, std::string>> params{
+            { "patterns", std::to_string(patterns) }
+        };
+        const std::string path = "/usr/local/bin:/usr/bin:/bin";
+        const CommandMatcher m(config.safe_command(), path);
+        bench("argspec_match_literal", params, [&] {
+            sink = m.match({ "systemctl", "verb1", "a", "b" });
+        });
+        bench("argspec_match_glob", params, [&] {
+            sink = m.match({ "systemctl", "restart", "unit0-foo.service" });
+        });
+        bench("argspec_match_miss", params, [&] {
+            sink = m.match({ "systemctl", "stop", "foo.service" });
+        });
+    }
+}
+// What sim and approve look up for each approver connection.
+void bench_identity()
+{
+    const auto user = uid_to_username(getuid());
+    // Exists everywhere, and isn't our primary group, so
+    // getgrouplist() is needed.
+    const std::string group = "daemon";
+    const gid_t gid = getgid();
+    for (const int delay_ms : { 0, 1, 10 }) {
+        slow_nss_delay = std::chrono::milliseconds(delay_ms);
+        const auto run = [&] {
+            sink = uid_to_username(getuid()).size() + user_is_member(user, gid, group);
+        };
+        bench("identity_lookup",
+              { { "nss_delay_ms", std::to_string(delay_ms) }, { "cache", "0" } },
+              run);
+
+        char fn[] = "/tmp/sim_bench_identity.XXXXXX";
+        const int fd = mkstemp(fn);
+        if (fd == -1) {
+            throw std::runtime_error("mkstemp failed");
+        }
+        close(fd);
+        simproto::SimConfig config;
+        config.set_identity_cache(fn);
+        {
+            const IdentityCache cache(config);
+            bench("identity_lookup",
+                  { { "nss_delay_ms", std::to_string(delay_ms) }, { "cache", "1" } },
+                  run);
+        }
+        unlink(fn);
+    }
+    slow_nss_delay = std::chrono::microseconds(0);
+}
+
+// Create an unlinked temp file of `size` bytes. If sparse, there's 1
+// MiB of data every 64 MiB, and the rest is holes.
+[[nodiscard]] int make_copy_source(uint64_t size, bool sparse)
+{
+    char fn[] = "/tmp/sim_bench_copy.XXXXXX";
+    const int fd = mkstemp(fn);
+    if (fd == -1) {
+        throw std::runtime_error("mkstemp failed");
+    }
+    unlink(fn);
+    const std::vector<char> chunk(std::min<uint64_t>(size, 1024 * 1024), 'x');
+    const uint64_t stride = sparse ? 64 * 1024 * 1024 : chunk.size();
+    for (uint64_t ofs = 0; ofs < size; ofs += stride) {
+        const auto len = std::min<uint64_t>(chunk.size(), size - ofs);
+        if (pwrite(fd, chunk.data(), len, ofs) != static_cast<ssize_t>(len)) {
+            throw std::runtime_error("pwrite failed");
+        }
+    }
+    if (ftruncate(fd, size)) {
+        throw std::runtime_error("ftruncate failed");
+    }
+    return fd;
+}
+
+// What `sim -e` used to do.
+void copy_4k(int src, int dst)
+{
+    char buf[4096];
+    for (;;) {
+        const ssize_t rc = read(src, buf, sizeof(buf));
+        if (rc <= 0) {
+            return;
+        }
+        if (write(dst, buf, rc) != rc) {
+            throw std::runtime_error("write failed");
+        }
+    }
+}
+
+void bench_copy()
+{
+    if (!selected("file_copy")) {
+        return;
+    }
+    constexpr uint64_t KiB = 1024;
+    constexpr uint64_t MiB = 1024 * KiB;
+    constexpr uint64_t GiB = 1024 * MiB;
+    const std::vector<std::pair<uint64_t, bool>> files{
+        { KiB, false },  { MiB, false },    { 64 * MiB, false },
+        { GiB, false },  { GiB, true },     { 10 * GiB, true },
+    };
+    char fn[] = "/tmp/sim_bench_copy_dst.XXXXXX";
+    const int dst = mkstemp(fn);
+    if (dst == -1) {
+        throw std::runtime_error("mkstemp failed");
+    }
+    unlink(fn);
+    for (const auto& file : files) {
+        const int src = make_copy_source(file.first, file.second);
+        const auto reset = [src, dst] {
+            if (ftruncate(dst, 0) || lseek(src, 0, SEEK_SET) || lseek(dst, 0, SEEK_SET)) {
+                throw std::runtime_error("resetting files failed");
+            }
+        };
+        for (const auto m : { CopyMethod::clone,
+                              CopyMethod::copy_file_range,
+                              CopyMethod::sendfile,
+                              CopyMethod::readwrite }) {
+            reset();
+            const auto used = copy_data(src, dst, m);
+            bench("file_copy",
+                  { { "bytes", std::to_string(file.first) },
+                    { "sparse", std::to_string(file.second) },
+                    { "method", to_string(m) },
+                    { "used", to_string(used) } },
+                  [&] {
+                      reset();
+                      sink = static_cast<size_t>(copy_data(src, dst, m));
+                  });
+        }
+        // Fills in the holes, so don't write 10 GiB of zeroes.
+        if (file.first <= GiB) {
+            bench("file_copy",
+                  { { "bytes", std::to_string(file.first) },
+                    { "sparse", std::to_string(file.second) },
+                    { "method", "read_4k" },
+                    { "used", "read_4k" } },
+                  [&] {
+                      reset();
+                      copy_4k(src, dst);
+                  });
+        }
+        close(src);
+    }
+    close(dst);
+}
+
+void bench_diff()
+{
+    if (!selected("diff")) {
+        return;
+    }
+    for (const size_t lines : { 1000, 100000, 10000000 }) {
+        std::string a;
+        for (size_t c = 0; c < lines; c++) {
+            a += "config line " + std::to_string(c) + "\n";
+        }
+        // One changed line in the middle.
+        auto b = a;
+        b[a.size() / 2] = '#';
+        bench("diff",
+              { { "bytes", std::to_string(a.size()) }, { "changes", "1" } },
+              [&] { sink = unified_diff(a.data(), a.size(), b.data(), b.size(), "f").size(); });
+
+        // Changes spread out, so that everything has to be diffed.
+        b = a;
+        for (size_t c = 0; c < 100; c++) {
+            b[a.size() / 100 * c] = '#';
+        }
+        bench("diff",
+              { { "bytes", std::to_string(a.size()) }, { "changes", "100" } },
+              [&] { sink = unified_diff(a.data(), a.size(), b.data(), b.size(), "f").size(); });
+    }
+}
+
+// Write back an edited file, as `sim -e` does once approved.
+void bench_staged()
+{
+    if (!selected("staged_write")) {
+        return;
+    }
+    char tmpl[] = "/tmp/sim_bench_staged.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        throw std::runtime_error("mkdtemp failed");
+    }
+    const std::string dir = tmpl;
+    const int dirfd = open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1) {
+        throw std::runtime_error("open failed");
+    }
+    for (const size_t size : { 4096, 1024 * 1024, 64 * 1024 * 1024 }) {
+        const std::string data(size, 'x');
+        for (const auto sync : { EditSync::none, EditSync::data, EditSync::full }) {
+            bench("staged_write",
+                  { { "bytes", std::to_string(size) },
+                    { "sync", std::to_string(static_cast<int>(sync)) } },
+                  [&] {
+                      StagedFile staged(dirfd, dir);
+                      if (write(staged.fd(), data.data(), data.size()) !=
+                          static_cast<ssize_t>(data.size())) {
+                          throw std::runtime_error("write failed");
+                      }
+                      staged.prepare(getuid(), getgid(), 0600, sync);
+                      staged.rename_over("file", sync);
+                  });
+        }
+    }
+    unlink((dir + "/file").c_str());
+    rmdir(dir.c_str());
+    close(dirfd);
+}
+
+// A burst of sims appending to the audit log at the same time. With
+// sync, the processes share fdatasync()s.
+void bench_audit()
+{
+    if (!selected("audit_append")) {
+        return;
+    }
+    using clock = std::chrono::steady_clock;
+    constexpr int records = 200;
+    for (const bool sync : { false, true }) {
+        for (const int procs : { 1, 8, 64 }) {
+            char tmpl[] = "/tmp/sim_bench_audit.XXXXXX";
+            if (!mkdtemp(tmpl)) {
+                throw std::runtime_error("mkdtemp failed");
+            }
+            const std::string dir = std::string(tmpl) + "/log";
+            simproto::AuditRecord rec;
+            rec.set_type(simproto::AuditRecord::EXECUTED);
+            rec.set_seq(0);
+            rec.set_prev_hash("");
+            rec.mutable_request()->mutable_command()->set_cwd("/home/user");
+            rec.mutable_request()->mutable_command()->set_command("systemctl");
+            const auto start = clock::now();
+            std::vector<pid_t> pids;
+            for (int c = 0; c < procs; c++) {
+                const pid_t pid = fork();
+                if (pid == -1) {
+                    throw std::runtime_error("fork failed");
+                }
+                if (pid == 0) {
+                    AuditLog log(dir, 64 << 20, sync);
+                    for (int r = 0; r < records; r++) {
+                        log.append(rec);
+                    }
+                    _exit(0);
+                }
+                pids.push_back(pid);
+            }
+            for (const auto pid : pids) {
+                int status;
+                if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+                    WEXITSTATUS(status)) {
+                    throw std::runtime_error("audit log writer failed");
+                }
+            }
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                clock::now() - start)
+                                .count();
+            report("audit_append",
+                   { { "procs", std::to_string(procs) },
+                     { "sync", std::to_string(sync) } },
+                   procs * records,
+                   ns);
+            if (system(("rm -r " + std::string(tmpl)).c_str())) {
+                throw std::runtime_error("rm failed");
+            }
+        }
+    }
+}
+
+// A quarter of one user's commands on one host, out of years of log.
+void bench_audit_query()
+{
+    if (!selected("audit_query")) {
+        return;
+    }
+    constexpr int records = 50000;
+    constexpr int64_t hour_us = 3600LL * 1000000;
+    char tmpl[] = "/tmp/sim_bench_audit.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        throw std::runtime_error("mkdtemp failed");
+    }
+    const std::string dir = std::string(tmpl) + "/log";
+    {
+        AuditLog log(dir, 256 << 10, false);
+        for (int c = 0; c < records; c++) {
+            simproto::AuditRecord rec;
+            rec.set_type(simproto::AuditRecord::EXECUTED);
+            rec.set_seq(0);
+            rec.set_prev_hash("");
+            rec.set_time_us(c * hour_us);
+            rec.set_user("user" + std::to_string(c % 50));
+            rec.set_host("host" + std::to_string(c % 20));
+            auto cmd = rec.mutable_request()->mutable_command();
+            cmd->set_cwd("/home/user");
+            cmd->set_command("cmd" + std::to_string(c % 100));
+            log.append(rec);
+        }
+    }
+    AuditIndex index(dir);
+    AuditQuery q;
+    q.user = "user7";
+    q.host = "host17";
+    q.since_us = records / 2 * hour_us;
+    q.until_us = q.since_us + 90 * 24 * hour_us;
+    for (const bool indexed : { false, true }) {
+        if (indexed) {
+            (void)index.update();
+        }
+        bench("audit_query",
+              { { "records", std::to_string(records) },
+                { "indexed", std::to_string(indexed) } },
+              [&] {
+                  sink = index.query(q, [](const simproto::AuditRecord&) {})
+                             .records_read;
+              });
+    }
+    if (system(("rm -r " + std::string(tmpl)).c_str())) {
+        throw std::runtime_error("rm failed");
+    }
+}
+
+// What Checker::check() pays per metric update.
+void bench_metrics()
+{
+    char tmpl[] = "/tmp/sim_bench_metrics.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        throw std::runtime_error("mkdtemp failed");
+    }
+    {
+        Metrics m(std::string(tmpl) + "/sim.prom", getegid());
+        bench("metrics_add", {}, [&m] { m.add(Counter::approved); });
+        bench("metrics_observe", {}, [&m] {
+            m.observe(Histogram::decision, std::chrono::seconds(42));
+        });
+        bench("metrics_write_text", {}, [&m] { m.write_text(); });
+    }
+    if (system(("rm -r " + std::string(tmpl)).c_str())) {
+        throw std::runtime_error("rm failed");
+    }
+}
+
+// Turning environ into a map, before any filtering.
+void bench_environ_map()
+{
+    for (const int vars : { 10, 100, 1000 }) {
+        std::vector<std::string> entries;
+        for (const auto& kv : make_env(vars)) {
+            entries.push_back(kv.first + "=" + kv.second);
+        }
+        std::vector<const char*> env;
+        for (const auto& e : entries) {
+            env.push_back(e.c_str());
+        }
+        env.push_back(nullptr);
+        bench("environ_map", { { "vars", std::to_string(vars) } }, [&env] {
+            sink = environ_map(env.data()).size();
+        });
+    }
+}
+
+// A request for a command with `args` arguments, and as many
+// environment variables.
+[[nodiscard]] simproto::ApproveRequest make_request(int args)
+{
+    simproto::ApproveRequest req;
+    req.set_id(make_random_filename(32));
+    req.set_host("host.example.com");
+    req.set_user("someadmin");
+    req.set_justification("Rolling out the fix for the outage");
+    auto cmd = req.mutable_command();
+    cmd->set_cwd("/home/someadmin/src/project");
+    cmd->set_command("/usr/bin/rsync");
+    for (int c = 0; c < args; c++) {
+        cmd->add_args("/var/lib/project/data/file-" + std::to_string(c));
+    }
+    for (const auto& kv : make_env(args)) {
+        auto e = cmd->add_environ();
+        e->set_key(kv.first);
+        e->set_value(kv.second);
+    }
+    return req;
+}
+
+// What sim and approve do with every request.
+void bench_proto()
+{
+    for (const int args : { 1, 10, 100, 1000 }) {
+        const auto req = make_request(args);
+        std::string data;
+        if (!req.SerializeToString(&data)) {
+            throw std::runtime_error("failed to serialize");
+        }
+        const std::vector<std::pair<std::string, std::string>> params{
+            { "args", std::to_string(args) }, { "bytes", std::to_string(data.size()) }
+        };
+        bench("request_serialize", params, [&req] {
+            std::string out;
+            if (!req.SerializeToString(&out)) {
+                throw std::runtime_error("failed to serialize");
+            }
+            sink = out.size();
+        });
+        bench("request_parse", params, [&data] {
+            simproto::ApproveRequest r;
+            if (!r.ParseFromString(data)) {
+                throw std::runtime_error("failed to parse");
+            }
+            sink = r.command().args_size();
+        });
+        bench("request_print", params, [&req] {
+            std::string out;
+            if (!google::protobuf::TextFormat::PrintToString(req, &out)) {
+                throw std::runtime_error("failed to print");
+            }
+            sink = out.size();
+        });
+    }
+}
+
+// Parsing /etc/sim.conf, which every sim and approve does first.
+void bench_config_parse()
+{
+    for (const int entries : { 0, 10, 100, 1000 }) {
+        auto config = make_env_config(entries);
+        config.set_sock_dir("/var/run/sim");
+        config.set_admin_group("sim-admins");
+        config.set_approve_group("sim-approvers");
+        for (int c = 0; c < entries; c++) {
+            auto cmd = config.add_safe_command();
+            cmd->add_command("generated-command-" + std::to_string(c));
+            cmd->add_args()->add_arg()->set_literal("status");
+            config.add_deny_command()->add_command("denied-command-" +
+                                                    std::to_string(c));
+        }
+        std::string text;
+        if (!google::protobuf::TextFormat::PrintToString(config, &text)) {
+            throw std::runtime_error("failed to print");
+        }
+        bench("config_parse",
+              { { "entries", std::to_string(entries) },
+                { "bytes", std::to_string(text.size()) } },
+              [&text] {
+                  simproto::SimConfig c;
+                  if (!google::protobuf::TextFormat::ParseFromString(text, &c)) {
+                      throw std::runtime_error("failed to parse");
+                  }
+                  sink = c.safe_command_size();
+              });
+    }
+}
+
+// One message across a socket, as between sim, approve and simd.
+// Large ones go as a memfd.
+void bench_fd()
+{
+    std::array<int, 2> fds{};
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds.data())) {
+        throw std::runtime_error("socketpair failed");
+    }
+    FD a(fds[0]);
+    FD b(fds[1]);
+    for (const size_t bytes : { 100, 10000, 100000, 1000000 }) {
+        const std::string data(bytes, 'x');
+        bench("fd_roundtrip", { { "bytes", std::to_string(bytes) } }, [&] {
+            a.write(data);
+            sink = b.read().size();
+        });
+    }
+}
+
+// Names of sockets, temp files, and request ids.
+void bench_random_filename()
+{
+    bench("random_filename", { { "len", "32" } }, [] {
+        sink = make_random_filename(32).size();
+    });
+}
+
+[[noreturn]] void usage(const char* av0, int err)
+{
+    std::cout << av0 << ": Usage [ -h ] [ -j ] [ <name regex> ]\n";
+    exit(err);
+}
+} // namespace
+} // namespace Sim
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "hj")) != -1) {
+        switch (opt) {
+        case 'j':
+            Sim::json_output = true;
+            break;
+        case 'h':
+            Sim::usage(argv[0], EXIT_SUCCESS);
+            break;
+        default: /* '?' */
+            Sim::usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (optind + 1 < argc) {
+        Sim::usage(argv[0], EXIT_FAILURE);
+    }
+    if (optind < argc) {
+        Sim::only = std::make_unique<std::regex>(argv[optind]);
+    }
+    Sim::bench_environ_map();
+    Sim::bench_env_filter();
+    Sim::bench_command_matcher();
+    Sim::bench_argspec();
+    Sim::bench_identity();
+    Sim::bench_copy();
+    Sim::bench_diff();
+    Sim::bench_staged();
+    Sim::bench_audit();
+    Sim::bench_audit_query();
+    Sim::bench_metrics();
+    Sim::bench_proto();
+    Sim::bench_config_parse();
+    Sim::bench_fd();
+    Sim::bench_random_filename();
+}
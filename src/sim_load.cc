@@ -0,0 +1,788 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * End to end load test of sim and approve.
+ *
+ * Runs N concurrent clients, each running `sim true` a number of times
+ * in a row, against M `approve -w` fed an endless stream of "yes", or
+ * with -p, M `approve --policy <policy> --daemon`. It all runs in new
+ * user and mount namespaces, with a generated /etc/sim.conf,
+ * /etc/passwd and /etc/group, and a private sock_dir, so neither the
+ * machine's config nor its users are involved.
+ *
+ * As root the namespace maps all ids to themselves. Otherwise it needs
+ * newuidmap and newgidmap, and subordinate ids in /etc/subuid and
+ * /etc/subgid. Without them it exits with 77, for "skipped".
+ *
+ * Run with `make bench`. The result is one line:
+ *
+ *   BENCH sim_load clients=<n> approvers=<m> ... req_per_sec=<r> p50_us=<t> p99_us=<t>
+ *
+ * or with -j, a JSON object like sim_bench -j. The latency is from
+ * starting sim to it exiting after running the approved command.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+// Project
+#include "util.h"
+
+// C++
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+using clock = std::chrono::steady_clock;
+
+// What automake, and `make bench`, take to mean "skipped".
+constexpr int exit_skip = 77;
+
+// Users and groups inside the namespace. The approvers are uids
+// first_approver_uid and up.
+constexpr uid_t admin_uid = 100;
+constexpr gid_t admin_gid = 100;
+constexpr gid_t approve_gid = 101;
+constexpr uid_t first_approver_uid = 101;
+
+constexpr auto broker_wait = std::chrono::seconds(5);
+
+struct Options {
+    int clients = 10;
+    int approvers = 1;
+    int requests = 10; // Per client.
+    int timeout_seconds = 120;
+    bool verbose = false;
+    bool json = false; // Output a JSON line, like sim_bench -j.
+    std::string sim = "./sim";
+    std::string approve = "./approve";
+    std::string simd; // Put a broker in front, if set.
+    std::string extra_config;
+    std::string policy; // Approve with `approve --policy --daemon`, if set.
+};
+
+[[noreturn]] void usage(const char* av0, int err)
+{
+    std::cout << av0 << ": Usage [ -hjv ] [ -n <clients> ] [ -m <approvers> ]"
+              << " [ -r <requests per client> ]\n"
+              << "  [ -s <sim> ] [ -a <approve> ] [ -b <simd> ]"
+              << " [ -c <extra config> ] [ -p <policy> ]\n"
+              << "  [ -t <timeout seconds> ]\n";
+    exit(err);
+}
+
+[[nodiscard]] int parse_count(const char* s, const char* av0)
+{
+    char* end = nullptr;
+    const long n = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || n < 1 || n > 1000000) {
+        usage(av0, EXIT_FAILURE);
+    }
+    return static_cast<int>(n);
+}
+
+[[nodiscard]] std::string absolute(const std::string& fn)
+{
+    std::vector<char> buf(PATH_MAX);
+    if (realpath(fn.c_str(), buf.data()) == nullptr) {
+        throw SysError("realpath(" + fn + ")");
+    }
+    return buf.data();
+}
+
+[[nodiscard]] std::string read_file(const std::string& fn)
+{
+    std::ifstream f(fn);
+    if (!f) {
+        throw std::runtime_error("failed to open " + fn);
+    }
+    return std::string((std::istreambuf_iterator<char>(f)),
+                       std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string& fn, const std::string& data, mode_t mode)
+{
+    const int fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (fd == -1) {
+        throw SysError("open(" + fn + ")");
+    }
+    Defer _([fd] { ::close(fd); });
+    for (size_t ofs = 0; ofs < data.size();) {
+        const ssize_t rc = write(fd, data.data() + ofs, data.size() - ofs);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("write(" + fn + ")");
+        }
+        ofs += rc;
+    }
+    // After writing, since writing clears the suid bit.
+    if (fchmod(fd, mode)) {
+        throw SysError("fchmod(" + fn + ")");
+    }
+}
+
+// The subordinate id range of the user in e.g. /etc/subuid, as start
+// and count. Count is zero if there is none.
+[[nodiscard]] std::pair<unsigned long, unsigned long>
+subid_range(const std::string& fn, const std::string& user, uid_t uid)
+{
+    std::ifstream f(fn);
+    for (std::string line; std::getline(f, line);) {
+        std::replace(line.begin(), line.end(), ':', ' ');
+        std::istringstream ss(line);
+        std::string name;
+        unsigned long start = 0;
+        unsigned long count = 0;
+        if ((ss >> name >> start >> count) &&
+            (name == user || name == std::to_string(uid))) {
+            return { start, count };
+        }
+    }
+    return { 0, 0 };
+}
+
+// Run e.g. newuidmap, mapping 0 inside to `id` and 1 and up to the
+// subordinate ids.
+[[nodiscard]] bool
+run_idmap(const char* prog, pid_t pid, unsigned long id, unsigned long start, int count)
+{
+    const std::vector<std::string> args{
+        prog, std::to_string(pid),   "0", std::to_string(id), "1",
+        "1",  std::to_string(start), std::to_string(count),
+    };
+    const pid_t child = fork();
+    if (child == -1) {
+        throw SysError("fork()");
+    }
+    if (child == 0) {
+        std::vector<char*> argv;
+        for (const auto& a : args) {
+            argv.push_back(const_cast<char*>(a.c_str()));
+        }
+        argv.push_back(nullptr);
+        execvp(prog, argv.data());
+        std::cerr << "sim_load: exec(" << prog << "): " << strerror(errno) << "\n";
+        _exit(EXIT_FAILURE);
+    }
+    int status;
+    if (waitpid(child, &status, 0) != child) {
+        throw SysError("waitpid()");
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Set up the uid and gid maps of the namespace of `pid`. Returns false
+// if this isn't possible here.
+[[nodiscard]] bool map_ids(pid_t pid, const Options& opts)
+{
+    const auto proc = "/proc/" + std::to_string(pid);
+    if (geteuid() == 0) {
+        for (const auto& fn : { proc + "/uid_map", proc + "/gid_map" }) {
+            std::ofstream f(fn);
+            if (!(f << "0 0 4294967295\n" << std::flush)) {
+                throw std::runtime_error("failed to write " + fn);
+            }
+        }
+        return true;
+    }
+    const int needed = first_approver_uid + opts.approvers;
+    const auto user = uid_to_username(getuid());
+    const auto uids = subid_range("/etc/subuid", user, getuid());
+    const auto gids = subid_range("/etc/subgid", user, getuid());
+    if (uids.second < static_cast<unsigned long>(needed) ||
+        gids.second < static_cast<unsigned long>(needed)) {
+        std::cerr << "sim_load: SKIP: need " << needed << " subordinate ids for <"
+                  << user << "> in /etc/subuid and /etc/subgid\n";
+        return false;
+    }
+    if (!run_idmap("newuidmap", pid, getuid(), uids.first, needed) ||
+        !run_idmap("newgidmap", pid, getgid(), gids.first, needed)) {
+        std::cerr << "sim_load: SKIP: newuidmap or newgidmap failed\n";
+        return false;
+    }
+    return true;
+}
+
+// Give the process the user and groups it runs as in the namespace.
+void become(uid_t uid, gid_t gid)
+{
+    const std::array<gid_t, 1> groups{ gid };
+    if (setgroups(groups.size(), groups.data())) {
+        throw SysError("setgroups()");
+    }
+    if (setresgid(gid, gid, gid)) {
+        throw SysError("setresgid()");
+    }
+    if (setresuid(uid, uid, uid)) {
+        throw SysError("setresuid()");
+    }
+}
+
+// Point the standard fds of a child at /dev/null, or `in` for stdin.
+void redirect(int in, bool verbose)
+{
+    const int null = open("/dev/null", O_RDWR);
+    if (null == -1) {
+        throw SysError("open(/dev/null)");
+    }
+    if (dup2(in == -1 ? null : in, STDIN_FILENO) == -1 ||
+        dup2(null, STDOUT_FILENO) == -1 ||
+        (!verbose && dup2(null, STDERR_FILENO) == -1)) {
+        throw SysError("dup2()");
+    }
+    ::close(null);
+}
+
+void exec(const std::string& prog, const std::vector<std::string>& args)
+{
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(prog.c_str()));
+    for (const auto& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::array<char*, 4> envp{ {
+        const_cast<char*>("PATH=/usr/sbin:/usr/bin:/sbin:/bin"),
+        const_cast<char*>("HOME=/"),
+        const_cast<char*>("LANG=C"),
+        nullptr,
+    } };
+    execve(prog.c_str(), argv.data(), envp.data());
+    throw SysError("execve(" + prog + ")");
+}
+
+// Fork, and run `f` in the child with the signal mask from before
+// SIGCHLD was blocked.
+[[nodiscard]] pid_t spawn(const sigset_t& mask, const std::function<void()>& f)
+{
+    const pid_t pid = fork();
+    if (pid == -1) {
+        throw SysError("fork()");
+    }
+    if (pid != 0) {
+        return pid;
+    }
+    try {
+        if (sigprocmask(SIG_SETMASK, &mask, nullptr)) {
+            throw SysError("sigprocmask()");
+        }
+        f();
+    } catch (const std::exception& e) {
+        std::cerr << "sim_load: " << e.what() << std::endl;
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+// Build the environment under `base`: a tmpfs with the binaries, the
+// sock_dir, and a copy of /etc where everything but the files sim
+// reads are symlinks to the real one.
+void setup(const Options& opts, const std::string& base)
+{
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr)) {
+        throw SysError("mount(/, MS_PRIVATE)");
+    }
+    if (mount("sim_load", base.c_str(), "tmpfs", 0, "mode=0755")) {
+        throw SysError("mount(" + base + ")");
+    }
+
+    const auto real_etc = base + "/etc.real";
+    const auto etc = base + "/etc";
+    if (mkdir(real_etc.c_str(), 0755) || mkdir(etc.c_str(), 0755)) {
+        throw SysError("mkdir(" + etc + ")");
+    }
+    if (mount("/etc", real_etc.c_str(), nullptr, MS_BIND | MS_REC, nullptr)) {
+        throw SysError("mount(/etc, " + real_etc + ")");
+    }
+    const std::set<std::string> replaced{
+        "sim.conf", "passwd", "group", "nsswitch.conf"
+    };
+    {
+        DIR* dir = opendir(real_etc.c_str());
+        if (dir == nullptr) {
+            throw SysError("opendir(" + real_etc + ")");
+        }
+        Defer _([dir] { closedir(dir); });
+        while (const auto de = readdir(dir)) {
+            const std::string name(de->d_name);
+            if (name == "." || name == ".." || replaced.count(name)) {
+                continue;
+            }
+            // Symlinks are copied, since relative ones would otherwise
+            // resolve from the wrong place.
+            std::vector<char> buf(PATH_MAX);
+            const ssize_t len =
+                readlink((real_etc + "/" + name).c_str(), buf.data(), buf.size() - 1);
+            const std::string target =
+                len > 0 ? std::string(buf.data(), len) : real_etc + "/" + name;
+            if (symlink(target.c_str(), (etc + "/" + name).c_str())) {
+                throw SysError("symlink(" + etc + "/" + name + ")");
+            }
+        }
+    }
+
+    std::string passwd = "root:x:0:0:root:/root:/bin/sh\n"
+                         "simload-admin:x:" +
+                         std::to_string(admin_uid) + ":" + std::to_string(admin_gid) +
+                         "::/:/bin/sh\n";
+    std::string approvers;
+    for (int c = 0; c < opts.approvers; c++) {
+        const auto name = "simload-approver" + std::to_string(c);
+        passwd += name + ":x:" + std::to_string(first_approver_uid + c) + ":" +
+                  std::to_string(approve_gid) + "::/:/bin/sh\n";
+        approvers += (c ? "," : "") + name;
+    }
+    write_file(etc + "/passwd", passwd, 0644);
+    write_file(etc + "/group",
+               "root:x:0:\n"
+               "sim-admins:x:" +
+                   std::to_string(admin_gid) +
+                   ":simload-admin\n"
+                   "sim-approvers:x:" +
+                   std::to_string(approve_gid) + ":" + approvers + "\n",
+               0644);
+    write_file(etc + "/nsswitch.conf",
+               "passwd: files\ngroup: files\nshadow: files\nhosts: files\n",
+               0644);
+
+    const auto sock_dir = base + "/sock";
+    std::string config = "sock_dir: \"" + sock_dir +
+                         "\"\n"
+                         "admin_group: \"sim-admins\"\n"
+                         "approve_group: \"sim-approvers\"\n";
+    if (!opts.simd.empty()) {
+        config += "broker_socket: \"" + base + "/simd.sock\"\n";
+    }
+    if (!opts.policy.empty()) {
+        write_file(base + "/policy", read_file(opts.policy), 0644);
+    }
+    if (!opts.extra_config.empty()) {
+        config += read_file(opts.extra_config);
+    }
+    write_file(etc + "/sim.conf", config, 0644);
+
+    if (mkdir(sock_dir.c_str(), 0755)) {
+        throw SysError("mkdir(" + sock_dir + ")");
+    }
+    if (chown(sock_dir.c_str(), 0, approve_gid)) {
+        throw SysError("chown(" + sock_dir + ")");
+    }
+
+    const auto bin = base + "/bin";
+    if (mkdir(bin.c_str(), 0755)) {
+        throw SysError("mkdir(" + bin + ")");
+    }
+    write_file(bin + "/sim", read_file(opts.sim), 04711);
+    write_file(bin + "/approve", read_file(opts.approve), 0755);
+    if (!opts.simd.empty()) {
+        write_file(bin + "/simd", read_file(opts.simd), 0755);
+    }
+
+    if (mount(etc.c_str(), "/etc", nullptr, MS_BIND, nullptr)) {
+        throw SysError("mount(" + etc + ", /etc)");
+    }
+}
+
+// The value at `pct` percent into sorted `v`.
+[[nodiscard]] int64_t percentile(const std::vector<int64_t>& v, int pct)
+{
+    return v[(v.size() - 1) * pct / 100];
+}
+
+// Print in the same formats as sim_bench. Results are numbers.
+void print_result(const std::vector<std::pair<std::string, std::string>>& params,
+                  const std::vector<std::pair<std::string, std::string>>& results,
+                  bool json)
+{
+    if (!json) {
+        std::cout << "BENCH sim_load";
+        for (const auto& kv : params) {
+            std::cout << " " << kv.first << "=" << kv.second;
+        }
+        for (const auto& kv : results) {
+            std::cout << " " << kv.first << "=" << kv.second;
+        }
+        std::cout << std::endl;
+        return;
+    }
+    std::cout << "{\"name\":\"sim_load\",\"params\":{";
+    for (size_t c = 0; c < params.size(); c++) {
+        std::cout << (c ? "," : "") << "\"" << params[c].first << "\":\""
+                  << params[c].second << "\"";
+    }
+    std::cout << "}";
+    for (const auto& kv : results) {
+        std::cout << ",\"" << kv.first << "\":" << kv.second;
+    }
+    std::cout << "}" << std::endl;
+}
+
+// Run the benchmark, inside the namespaces.
+[[nodiscard]] int run(const Options& opts, const std::string& base)
+{
+    setup(opts, base);
+    const auto bin = base + "/bin";
+
+    // Block SIGCHLD, to wait for it with a timeout.
+    sigset_t chld;
+    sigset_t orig;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &chld, &orig)) {
+        throw SysError("sigprocmask()");
+    }
+
+    // Everything but the clients, to kill when done.
+    std::vector<pid_t> helpers;
+    const Defer kill_helpers([&helpers] {
+        for (const auto pid : helpers) {
+            kill(pid, SIGKILL);
+        }
+        for (const auto pid : helpers) {
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    });
+
+    if (!opts.simd.empty()) {
+        helpers.push_back(spawn(orig, [&] {
+            redirect(-1, opts.verbose);
+            exec(bin + "/simd", {});
+        }));
+        const auto sock = base + "/simd.sock";
+        struct stat st {
+        };
+        for (const auto start = clock::now(); stat(sock.c_str(), &st);) {
+            if (clock::now() - start > broker_wait) {
+                throw std::runtime_error("simd didn't create " + sock);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    for (int c = 0; c < opts.approvers && !opts.policy.empty(); c++) {
+        helpers.push_back(spawn(orig, [&] {
+            redirect(-1, opts.verbose);
+            become(first_approver_uid + c, approve_gid);
+            exec(bin + "/approve", { "--policy", base + "/policy", "--daemon" });
+        }));
+    }
+    for (int c = 0; c < opts.approvers && opts.policy.empty(); c++) {
+        std::array<int, 2> fds{};
+        if (pipe2(fds.data(), O_CLOEXEC)) {
+            throw SysError("pipe2()");
+        }
+        // "a" selects all groups of requests, and is ignored when
+        // there is only one. Keeps going until approve exits.
+        helpers.push_back(spawn(orig, [&fds] {
+            ::close(fds[0]);
+            signal(SIGPIPE, SIG_DFL);
+            std::string data;
+            for (int n = 0; n < 1024; n++) {
+                data += "a\ny\n";
+            }
+            while (write(fds[1], data.data(), data.size()) > 0) {
+            }
+        }));
+        helpers.push_back(spawn(orig, [&] {
+            redirect(fds[0], opts.verbose);
+            become(first_approver_uid + c, approve_gid);
+            exec(bin + "/approve", { "-w" });
+        }));
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    // Latency of each request in ns, or -1 if it failed.
+    const size_t total = static_cast<size_t>(opts.clients) * opts.requests;
+    void* m = mmap(nullptr,
+                   total * sizeof(int64_t),
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS,
+                   -1,
+                   0);
+    if (m == MAP_FAILED) {
+        throw SysError("mmap()");
+    }
+    const auto lat = static_cast<int64_t*>(m);
+    const Defer unmap([m, total] { munmap(m, total * sizeof(int64_t)); });
+    std::fill(lat, lat + total, -1);
+
+    const auto start = clock::now();
+    std::set<pid_t> clients;
+    for (int c = 0; c < opts.clients; c++) {
+        int64_t* out = lat + static_cast<size_t>(c) * opts.requests;
+        clients.insert(spawn(orig, [&opts, &bin, out] {
+            // In its own process group, to kill it and its sim on
+            // timeout.
+            setpgid(0, 0);
+            become(admin_uid, admin_gid);
+            if (chdir("/")) {
+                throw SysError("chdir(/)");
+            }
+            for (int r = 0; r < opts.requests; r++) {
+                const auto req_start = clock::now();
+                const pid_t pid = fork();
+                if (pid == -1) {
+                    throw SysError("fork()");
+                }
+                if (pid == 0) {
+                    try {
+                        redirect(-1, opts.verbose);
+                        exec(bin + "/sim", { "true" });
+                    } catch (const std::exception& e) {
+                        std::cerr << "sim_load: " << e.what() << std::endl;
+                    }
+                    _exit(EXIT_FAILURE);
+                }
+                int status;
+                if (waitpid(pid, &status, 0) != pid) {
+                    throw SysError("waitpid()");
+                }
+                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                    out[r] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 clock::now() - req_start)
+                                 .count();
+                }
+            }
+        }));
+    }
+
+    // Wait for the clients.
+    const auto deadline = start + std::chrono::seconds(opts.timeout_seconds);
+    bool timed_out = false;
+    while (!clients.empty()) {
+        int status;
+        const pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid == -1) {
+            throw SysError("waitpid()");
+        }
+        if (pid > 0) {
+            clients.erase(pid);
+            continue;
+        }
+        const auto left = deadline - clock::now();
+        if (left <= clock::duration::zero()) {
+            timed_out = true;
+            break;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+        struct timespec ts {
+        };
+        ts.tv_sec = ns.count() / 1000000000;
+        ts.tv_nsec = ns.count() % 1000000000;
+        if (sigtimedwait(&chld, nullptr, &ts) == -1 && errno != EAGAIN &&
+            errno != EINTR) {
+            throw SysError("sigtimedwait()");
+        }
+    }
+    const auto elapsed = clock::now() - start;
+    for (const auto pid : clients) {
+        kill(-pid, SIGKILL);
+        int status;
+        waitpid(pid, &status, 0);
+    }
+
+    std::vector<int64_t> done;
+    for (size_t c = 0; c < total; c++) {
+        if (lat[c] >= 0) {
+            done.push_back(lat[c]);
+        }
+    }
+    std::sort(done.begin(), done.end());
+    const double secs = std::chrono::duration<double>(elapsed).count();
+    const std::vector<std::pair<std::string, std::string>> params{
+        { "clients", std::to_string(opts.clients) },
+        { "approvers", std::to_string(opts.approvers) },
+        { "requests", std::to_string(total) },
+        { "broker", opts.simd.empty() ? "no" : "yes" },
+        { "policy", opts.policy.empty() ? "no" : "yes" },
+    };
+    std::vector<std::pair<std::string, std::string>> results{
+        { "failed", std::to_string(total - done.size()) },
+        { "req_per_sec", std::to_string(done.size() / secs) },
+    };
+    if (!done.empty()) {
+        results.emplace_back("p50_us", std::to_string(percentile(done, 50) / 1000));
+        results.emplace_back("p99_us", std::to_string(percentile(done, 99) / 1000));
+    }
+    print_result(params, results, opts.json);
+    if (timed_out) {
+        std::cerr << "sim_load: timed out after " << opts.timeout_seconds << "s\n";
+    }
+    return done.size() == total ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+[[nodiscard]] int mainwrap(int argc, char** argv)
+{
+    Options opts;
+    {
+        int opt;
+        while ((opt = getopt(argc, argv, "hjvn:m:r:s:a:b:c:p:t:")) != -1) {
+            switch (opt) {
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+                break;
+            case 'j':
+                opts.json = true;
+                break;
+            case 'v':
+                opts.verbose = true;
+                break;
+            case 'n':
+                opts.clients = parse_count(optarg, argv[0]);
+                break;
+            case 'm':
+                opts.approvers = parse_count(optarg, argv[0]);
+                break;
+            case 'r':
+                opts.requests = parse_count(optarg, argv[0]);
+                break;
+            case 's':
+                opts.sim = optarg;
+                break;
+            case 'a':
+                opts.approve = optarg;
+                break;
+            case 'b':
+                opts.simd = optarg;
+                break;
+            case 'c':
+                opts.extra_config = optarg;
+                break;
+            case 'p':
+                opts.policy = optarg;
+                break;
+            case 't':
+                opts.timeout_seconds = parse_count(optarg, argv[0]);
+                break;
+            default: /* '?' */
+                usage(argv[0], EXIT_FAILURE);
+            }
+        }
+    }
+    if (argc != optind) {
+        throw std::runtime_error("Trailing args on command line");
+    }
+    // Paths may be relative to here, and the binaries are read after
+    // /etc is replaced.
+    opts.sim = absolute(opts.sim);
+    opts.approve = absolute(opts.approve);
+    if (!opts.simd.empty()) {
+        opts.simd = absolute(opts.simd);
+    }
+    if (!opts.policy.empty()) {
+        opts.policy = absolute(opts.policy);
+    }
+    if (!opts.extra_config.empty()) {
+        opts.extra_config = absolute(opts.extra_config);
+    }
+
+    std::string base = "/tmp/sim_load.XXXXXX";
+    if (mkdtemp(&base[0]) == nullptr) {
+        throw SysError("mkdtemp()");
+    }
+    // Only ever a mount point, so empty outside the namespace.
+    const Defer rm([&base] { rmdir(base.c_str()); });
+    if (chmod(base.c_str(), 0755)) {
+        throw SysError("chmod(" + base + ")");
+    }
+
+    // The child creates the namespaces, and waits for us to map its
+    // ids.
+    std::array<int, 2> ready{};
+    std::array<int, 2> mapped{};
+    if (pipe2(ready.data(), O_CLOEXEC) || pipe2(mapped.data(), O_CLOEXEC)) {
+        throw SysError("pipe2()");
+    }
+    const pid_t pid = fork();
+    if (pid == -1) {
+        throw SysError("fork()");
+    }
+    if (pid == 0) {
+        ::close(ready[0]);
+        ::close(mapped[1]);
+        if (unshare(CLONE_NEWUSER | CLONE_NEWNS)) {
+            std::cerr << "sim_load: SKIP: unshare(): " << strerror(errno) << "\n";
+            _exit(exit_skip);
+        }
+        char ch = 0;
+        if (write(ready[1], &ch, 1) != 1 || read(mapped[0], &ch, 1) != 1) {
+            _exit(exit_skip);
+        }
+        try {
+            _exit(run(opts, base));
+        } catch (const std::exception& e) {
+            std::cerr << "sim_load: " << e.what() << std::endl;
+        }
+        _exit(EXIT_FAILURE);
+    }
+    ::close(ready[1]);
+    ::close(mapped[0]);
+    char ch = 0;
+    if (read(ready[0], &ch, 1) == 1 && map_ids(pid, opts)) {
+        if (write(mapped[1], &ch, 1) != 1) {
+            throw SysError("write()");
+        }
+    }
+    ::close(mapped[1]);
+    ::close(ready[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid) {
+        throw SysError("waitpid()");
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+} // namespace
+} // namespace Sim
+
+int main(int argc, char** argv)
+{
+    try {
+        return Sim::mainwrap(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
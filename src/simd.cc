@@ -0,0 +1,567 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * simd is an optional broker between sim and approve.
+ *
+ * Without it every sim creates its own socket in sock_dir, and approve
+ * has to list the directory and connect to every socket in turn. simd
+ * instead owns one socket (`broker_socket` in the config), keeps the
+ * pending requests in memory, and serves all sim and approve
+ * connections from one epoll loop.
+ *
+ * simd must run as root, and sim and approve check that it does.
+ * Anyone can connect, so it checks that requesters are in the admin
+ * group and approvers are in the approver group.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+// Project
+#include "fd.h"
+#include "identity.h"
+#include "simproto.pb.h"
+#include "util.h"
+
+// Libraries
+#include "google/protobuf/text_format.h"
+
+// C++
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Sim {
+namespace {
+constexpr int max_backlog = 128;
+constexpr int max_events = 64;
+constexpr mode_t broker_sock_mode = 0666;
+constexpr int request_id_len = 32;
+
+volatile sig_atomic_t quit = 0;
+
+void sighandler(int) { quit = 1; }
+
+void set_nonblock(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+        throw SysError("fcntl(O_NONBLOCK)");
+    }
+}
+
+class Broker
+{
+public:
+    explicit Broker(simproto::SimConfig config);
+
+    // No copy or move.
+    Broker(const Broker&) = delete;
+    Broker(Broker&&) = delete;
+    Broker& operator=(const Broker&) = delete;
+    Broker& operator=(Broker&&) = delete;
+
+    ~Broker();
+
+    // Serve until signalled.
+    void run();
+
+private:
+    struct Client {
+        explicit Client(int f) : sockfd(f), fd(f) {}
+        const int sockfd;
+        FD fd;
+        uid_t uid = 0;
+        std::string user;
+        bool admin = false;
+        bool approver = false;
+
+        // Set if this client is an approve that wants new requests
+        // as they arrive.
+        bool watching = false;
+
+        // Set if this client has listed requests, and so is told when
+        // they're withdrawn.
+        bool listed = false;
+
+        // Set if this client is a sim waiting for approval.
+        std::string request_id;
+    };
+
+    struct Pending {
+        int fd;
+        simproto::ApproveRequest req;
+    };
+
+    void accept_clients();
+    void handle(Client& client);
+    void on_request(Client& client, const simproto::ApproveRequest& req);
+    void on_list(Client& client, bool watch);
+    void on_response(Client& client, const simproto::ApproveResponse& resp);
+    bool offer(Client& client, const Pending& p);
+    void drop(int fd);
+
+    // Send a reply to a client. Returns false, and drops the client, if
+    // that failed.
+    bool send(Client& client, const simproto::BrokerReply& reply);
+    bool send_error(Client& client, const std::string& msg);
+
+    const simproto::SimConfig config_;
+    const gid_t admin_gid_;
+    const gid_t approve_gid_;
+    int sock_ = -1;
+    int epoll_ = -1;
+    std::unordered_map<int, std::unique_ptr<Client>> clients_;
+
+    // Pending requests, in arrival order, with an index by id.
+    std::list<Pending> pending_;
+    std::unordered_map<std::string, std::list<Pending>::iterator> by_id_;
+};
+
+Broker::Broker(simproto::SimConfig config)
+    : config_(std::move(config)),
+      admin_gid_(group_to_gid(config_.admin_group())),
+      approve_gid_(group_to_gid(config_.approve_group()))
+{
+    const auto& fn = config_.broker_socket();
+    sock_ = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock_ == -1) {
+        throw SysError("socket");
+    }
+    Defer defer([&] { ::close(sock_); });
+
+    // Remove socket left behind by a previous run, but nothing else.
+    struct stat st {
+    };
+    if (!lstat(fn.c_str(), &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            throw std::runtime_error(fn + " exists, and is not a socket");
+        }
+        if (unlink(fn.c_str())) {
+            throw SysError("unlink(" + fn + ")");
+        }
+    }
+
+    struct sockaddr_un sa {
+    };
+    sa.sun_family = AF_UNIX;
+    if (fn.size() >= sizeof sa.sun_path) {
+        throw std::runtime_error("broker socket name too long: " + fn);
+    }
+    strncpy(static_cast<char*>(sa.sun_path), fn.c_str(), sizeof sa.sun_path - 1);
+    if (bind(sock_, reinterpret_cast<struct sockaddr*>(&sa), sizeof sa)) {
+        throw SysError("bind(" + fn + ")");
+    }
+    if (chmod(fn.c_str(), broker_sock_mode)) {
+        throw SysError("chmod(" + fn + ")");
+    }
+    if (listen(sock_, max_backlog)) {
+        throw SysError("listen");
+    }
+    set_nonblock(sock_);
+
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ == -1) {
+        throw SysError("epoll_create1");
+    }
+    struct epoll_event ev {
+    };
+    ev.events = EPOLLIN;
+    ev.data.fd = sock_;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, sock_, &ev)) {
+        throw SysError("epoll_ctl(ADD, listen)");
+    }
+    defer.defuse();
+}
+
+Broker::~Broker()
+{
+    clients_.clear();
+    ::close(epoll_);
+    ::close(sock_);
+    if (unlink(config_.broker_socket().c_str())) {
+        std::clog << "simd: Failed to delete socket <" << config_.broker_socket()
+                  << ">: " << strerror(errno) << std::endl;
+    }
+}
+
+void Broker::run()
+{
+    std::array<struct epoll_event, max_events> events{};
+    while (!quit) {
+        const int n = epoll_wait(epoll_, events.data(), events.size(), -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw SysError("epoll_wait");
+        }
+        for (int c = 0; c < n; c++) {
+            const int fd = events[c].data.fd;
+            if (fd == sock_) {
+                accept_clients();
+                continue;
+            }
+            const auto client = clients_.find(fd);
+            if (client == clients_.end()) {
+                // Dropped earlier in this batch.
+                continue;
+            }
+            if (events[c].events & EPOLLIN) {
+                handle(*client->second);
+            } else {
+                drop(fd);
+            }
+        }
+    }
+}
+
+void Broker::accept_clients()
+{
+    for (;;) {
+        const int fd = accept4(sock_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return;
+            }
+            std::clog << "simd: accept: " << strerror(errno) << std::endl;
+            return;
+        }
+        auto client = std::make_unique<Client>(fd);
+        try {
+            const auto cred = client->fd.peer_cred();
+            client->uid = cred.uid;
+            client->user = uid_to_username(client->uid);
+            client->admin =
+                cred.member_of(admin_gid_, config_.admin_group(), client->user);
+            client->approver =
+                cred.member_of(approve_gid_, config_.approve_group(), client->user);
+        } catch (const std::exception& e) {
+            std::clog << "simd: Rejecting client: " << e.what() << std::endl;
+            continue;
+        }
+        if (!client->admin && !client->approver) {
+            std::clog << "simd: Rejecting <" << client->user << "> (" << client->uid
+                      << "): neither admin nor approver\n";
+            continue;
+        }
+
+        struct epoll_event ev {
+        };
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev)) {
+            std::clog << "simd: epoll_ctl(ADD): " << strerror(errno) << std::endl;
+            continue;
+        }
+        clients_[fd] = std::move(client);
+    }
+}
+
+void Broker::handle(Client& client)
+{
+    std::string data;
+    try {
+        data = client.fd.read();
+    } catch (const std::exception& e) {
+        std::clog << "simd: Reading from <" << client.user << ">: " << e.what()
+                  << std::endl;
+        drop(client.sockfd);
+        return;
+    }
+    if (data.empty()) {
+        drop(client.sockfd);
+        return;
+    }
+    simproto::BrokerRequest req;
+    if (!req.ParseFromString(data)) {
+        send_error(client, "failed to parse request");
+        return;
+    }
+    if (req.has_request()) {
+        on_request(client, req.request());
+    } else if (req.list()) {
+        on_list(client, req.watch());
+    } else if (req.has_response()) {
+        on_response(client, req.response());
+    } else {
+        send_error(client, "empty request");
+    }
+}
+
+void Broker::on_request(Client& client, const simproto::ApproveRequest& req)
+{
+    if (!client.admin) {
+        send_error(client, "user <" + client.user + "> is not part of admin group");
+        return;
+    }
+    if (!client.request_id.empty()) {
+        send_error(client, "request already pending on this connection");
+        return;
+    }
+    Pending p{ client.sockfd, req };
+    p.req.set_id(make_random_filename(request_id_len));
+    p.req.set_user(client.user);
+    client.request_id = p.req.id();
+    std::clog << "simd: Request " << p.req.id() << " from <" << client.user << "> ("
+              << client.uid << ")\n";
+    const auto it = pending_.insert(pending_.end(), std::move(p));
+    by_id_[it->req.id()] = it;
+
+    // offer() may drop watchers, so don't iterate over clients_ itself.
+    std::vector<int> watchers;
+    for (const auto& c : clients_) {
+        if (c.second->watching) {
+            watchers.push_back(c.first);
+        }
+    }
+    for (const auto fd : watchers) {
+        const auto w = clients_.find(fd);
+        if (w != clients_.end()) {
+            (void)offer(*w->second, *it);
+        }
+    }
+}
+
+// Send a pending request to an approver. Returns false if the
+// approver was dropped.
+bool Broker::offer(Client& client, const Pending& p)
+{
+    const auto& requester = *clients_.at(p.fd);
+    if (requester.uid == client.uid) {
+        // Can't approve your own request anyway.
+        return true;
+    }
+    simproto::BrokerReply reply;
+    *reply.mutable_request() = p.req;
+    reply.set_uid(requester.uid);
+    reply.set_user(requester.user);
+    return send(client, reply);
+}
+
+void Broker::on_list(Client& client, bool watch)
+{
+    if (!client.approver) {
+        send_error(client, "user <" + client.user + "> is not part of approver group");
+        return;
+    }
+    for (const auto& p : pending_) {
+        if (!offer(client, p)) {
+            return;
+        }
+    }
+    simproto::BrokerReply end;
+    end.set_end(true);
+    if (send(client, end)) {
+        client.watching = watch;
+        client.listed = true;
+    }
+}
+
+void Broker::on_response(Client& client, const simproto::ApproveResponse& resp)
+{
+    if (!client.approver) {
+        send_error(client, "user <" + client.user + "> is not part of approver group");
+        return;
+    }
+    const auto found = by_id_.find(resp.id());
+    if (found == by_id_.end()) {
+        send_error(client, "no such request (it may have been withdrawn)");
+        return;
+    }
+    auto& requester = *clients_.at(found->second->fd);
+    if (requester.uid == client.uid) {
+        send_error(client, "can't approve your own request");
+        return;
+    }
+
+    std::clog << "simd: Request " << resp.id() << " "
+              << (resp.approved() ? "approved" : "rejected") << " by <" << client.user
+              << "> (" << client.uid << ")\n";
+    simproto::BrokerReply decision;
+    *decision.mutable_response() = resp;
+    decision.set_uid(client.uid);
+    decision.set_user(client.user);
+    const bool needs_more = found->second->req.approvals_required() > 1;
+    const bool delivered = send(requester, decision);
+    if (delivered && resp.approved() && !needs_more) {
+        // sim is done. A rejected request stays, like in sock_dir mode,
+        // in case someone else approves it. So does one needing more
+        // approvers, until sim has enough and hangs up.
+        drop(requester.sockfd);
+    }
+    if (!delivered) {
+        send_error(client, "requester has gone away");
+        return;
+    }
+    // Ack. Must not be an empty packet, since that looks like EOF.
+    simproto::BrokerReply ack;
+    *ack.mutable_response() = resp;
+    send(client, ack);
+}
+
+bool Broker::send(Client& client, const simproto::BrokerReply& reply)
+{
+    std::string data;
+    if (!reply.SerializeToString(&data)) {
+        throw std::runtime_error("failed to serialize broker reply");
+    }
+    try {
+        client.fd.write(data);
+    } catch (const std::exception& e) {
+        std::clog << "simd: Writing to <" << client.user << ">: " << e.what()
+                  << std::endl;
+        drop(client.sockfd);
+        return false;
+    }
+    return true;
+}
+
+bool Broker::send_error(Client& client, const std::string& msg)
+{
+    simproto::BrokerReply reply;
+    reply.set_error(msg);
+    return send(client, reply);
+}
+
+void Broker::drop(int fd)
+{
+    const auto found = clients_.find(fd);
+    if (found == clients_.end()) {
+        return;
+    }
+    std::string withdrawn;
+    const auto& id = found->second->request_id;
+    if (!id.empty()) {
+        const auto p = by_id_.find(id);
+        if (p != by_id_.end()) {
+            withdrawn = id;
+            pending_.erase(p->second);
+            by_id_.erase(p);
+        }
+    }
+    if (epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr)) {
+        std::clog << "simd: epoll_ctl(DEL): " << strerror(errno) << std::endl;
+    }
+    clients_.erase(found);
+    if (withdrawn.empty()) {
+        return;
+    }
+
+    // So that approvers looking at it can stop. send() may drop
+    // clients, so don't iterate over clients_ itself.
+    std::vector<int> listers;
+    for (const auto& c : clients_) {
+        if (c.second->listed) {
+            listers.push_back(c.first);
+        }
+    }
+    simproto::BrokerReply reply;
+    reply.set_withdrawn(withdrawn);
+    for (const auto l : listers) {
+        const auto c = clients_.find(l);
+        if (c != clients_.end()) {
+            send(*c->second, reply);
+        }
+    }
+}
+
+[[noreturn]] void usage(const char* av0, int err)
+{
+    std::cout << av0 << ": Usage [ -h ]\n";
+    exit(err);
+}
+} // namespace
+
+[[nodiscard]] int mainwrap(int argc, char** argv)
+{
+    // Parse options.
+    {
+        int opt;
+        while ((opt = getopt(argc, argv, "h")) != -1) {
+            switch (opt) {
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+                break;
+            default: /* '?' */
+                usage(argv[0], EXIT_FAILURE);
+            }
+        }
+    }
+    if (argc != optind) {
+        throw std::runtime_error("Trailing args on command line");
+    }
+    if (geteuid() != 0) {
+        throw std::runtime_error("simd must run as root");
+    }
+
+    // Load config.
+    simproto::SimConfig config;
+    {
+        std::ifstream f(config_file);
+        const std::string str((std::istreambuf_iterator<char>(f)),
+                              std::istreambuf_iterator<char>());
+        if (!google::protobuf::TextFormat::ParseFromString(str, &config)) {
+            throw std::runtime_error("error parsing config " + std::string(config_file));
+        }
+    }
+    const IdentityCache identities(config);
+    if (config.broker_socket().empty()) {
+        throw std::runtime_error("broker_socket not set in " + std::string(config_file));
+    }
+
+    struct sigaction sigact {
+    };
+    sigact.sa_handler = sighandler;
+    if (sigaction(SIGINT, &sigact, nullptr) || sigaction(SIGTERM, &sigact, nullptr)) {
+        throw SysError("sigaction");
+    }
+    // Dead clients are handled where writes fail.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::clog << "simd: Listening on " << config.broker_socket() << std::endl;
+    Broker broker(std::move(config));
+    broker.run();
+    return EXIT_SUCCESS;
+}
+} // namespace Sim
+
+int main(int argc, char** argv)
+{
+    try {
+        return Sim::mainwrap(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
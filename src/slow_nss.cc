@@ -0,0 +1,68 @@
+/*
+ *    Copyright 2026 Google LLC
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        https://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+/*
+ * Fake slow NSS, to benchmark as if users and groups came from a
+ * directory service with a network round trip per lookup.
+ *
+ * Only linked into sim_bench, where these definitions take precedence
+ * over the ones in libc.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C++
+#include <chrono>
+#include <thread>
+
+// POSIX
+#include <dlfcn.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/types.h>
+
+namespace Sim {
+// Added to every lookup, along with the dlsym() to find the real
+// function.
+std::chrono::microseconds slow_nss_delay{ 0 };
+
+namespace {
+template <typename T>
+[[nodiscard]] T slow(const char* name)
+{
+    std::this_thread::sleep_for(slow_nss_delay);
+    return reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+}
+} // namespace
+} // namespace Sim
+
+extern "C" {
+struct passwd* getpwuid(uid_t uid)
+{
+    return Sim::slow<struct passwd* (*)(uid_t)>("getpwuid")(uid);
+}
+
+struct group* getgrnam(const char* name)
+{
+    return Sim::slow<struct group* (*)(const char*)>("getgrnam")(name);
+}
+
+int getgrouplist(const char* user, gid_t group, gid_t* groups, int* ngroups)
+{
+    return Sim::slow<int (*)(const char*, gid_t, gid_t*, int*)>("getgrouplist")(
+        user, group, groups, ngroups);
+}
+}
@@ -22,22 +22,80 @@
 // C++
 #include <algorithm>
 #include <cerrno>
+#include <chrono>
+#include <climits>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <random>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 // POSIX
 #include <grp.h>
 #include <pwd.h>
+#include <sys/file.h>
 #include <unistd.h>
 
 namespace Sim {
 namespace {
-constexpr int max_group_count = 1000;
+constexpr int initial_group_count = 64;
+constexpr int max_group_count = 65536;
+
+LookupCache* lookup_cache = nullptr;
+std::function<void(std::chrono::nanoseconds)> lookup_timer;
+
+// Errors from getpwuid() and friends that mean there is no such entry.
+// Anything else, e.g. EPERM or EBADF, is a failure to look, and must
+// not be cached as the entry not existing.
+[[nodiscard]] bool is_not_found(int err)
+{
+    return err == 0 || err == ENOENT || err == ESRCH;
+}
+
+// Look up `key` in the cache, or with `f` if not cached. `f` returns
+// false if there's no such entry. The cache is only an optimization,
+// so errors from it are ignored.
+[[nodiscard]] bool lookup(const std::string& key,
+                          std::string* value,
+                          const std::function<bool(std::string*)>& f)
+{
+    if (lookup_cache != nullptr) {
+        try {
+            bool found = false;
+            if (lookup_cache->get(key, &found, value)) {
+                return found;
+            }
+        } catch (const std::exception& e) {
+            std::clog << "Identity cache: " << e.what() << std::endl;
+        }
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const bool found = f(value);
+    if (lookup_timer) {
+        lookup_timer(std::chrono::steady_clock::now() - start);
+    }
+    if (lookup_cache != nullptr) {
+        try {
+            lookup_cache->put(key, found, *value);
+        } catch (const std::exception& e) {
+            std::clog << "Identity cache: " << e.what() << std::endl;
+        }
+    }
+    return found;
+}
 } // namespace
 
-SysError::SysError(const std::string& s) : std::runtime_error(s + ": " + strerror(errno))
+void set_lookup_cache(LookupCache* cache) { lookup_cache = cache; }
+
+void set_lookup_timer(std::function<void(std::chrono::nanoseconds)> f)
+{
+    lookup_timer = std::move(f);
+}
+
+SysError::SysError(const std::string& s)
+    : std::runtime_error(s + ": " + strerror(errno)), err_(errno)
 {
 }
 
@@ -57,23 +115,83 @@ PushEUID::~PushEUID()
     }
 }
 
+FileLock::FileLock(int fd, int op) : fd_(fd)
+{
+    while (flock(fd_, op)) {
+        if (errno != EINTR) {
+            throw SysError("flock");
+        }
+    }
+}
+
+FileLock::FileLock(int fd,
+                   int op,
+                   std::chrono::steady_clock::time_point deadline,
+                   const std::string& what)
+    : fd_(fd)
+{
+    // There's no flock() with a timeout, so poll.
+    constexpr auto interval = std::chrono::milliseconds(10);
+    while (flock(fd_, op | LOCK_NB)) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EWOULDBLOCK) {
+            throw SysError("flock");
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            throw LockBusy(what);
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+            interval, deadline - now));
+    }
+}
+
+FileLock::~FileLock() { flock(fd_, LOCK_UN); }
+
 std::string uid_to_username(uid_t uid)
 {
-    const struct passwd* pw = getpwuid(uid);
-    if (pw == nullptr) {
-        throw SysError("getpwuid(" + std::to_string(uid) + ")");
+    const auto key = "uid:" + std::to_string(uid);
+    std::string name;
+    const bool found = lookup(key, &name, [uid](std::string* ret) {
+        errno = 0;
+        const struct passwd* pw = getpwuid(uid);
+        if (pw == nullptr) {
+            if (is_not_found(errno)) {
+                return false;
+            }
+            throw SysError("getpwuid(" + std::to_string(uid) + ")");
+        }
+        *ret = pw->pw_name;
+        return true;
+    });
+    if (!found) {
+        throw std::runtime_error("getpwuid(" + std::to_string(uid) + "): no such user");
     }
-    return pw->pw_name;
+    return name;
 }
 
 // Given group name, return gid.
 gid_t group_to_gid(const std::string& group)
 {
-    struct group* gr = getgrnam(group.c_str());
-    if (gr == nullptr) {
-        throw SysError("getpwnam(" + group + ")");
+    std::string gid;
+    const bool found = lookup("group:" + group, &gid, [&group](std::string* ret) {
+        errno = 0;
+        const struct group* gr = getgrnam(group.c_str());
+        if (gr == nullptr) {
+            if (is_not_found(errno)) {
+                return false;
+            }
+            throw SysError("getgrnam(" + group + ")");
+        }
+        *ret = std::to_string(gr->gr_gid);
+        return true;
+    });
+    if (!found) {
+        throw std::runtime_error("getgrnam(" + group + "): no such group");
     }
-    return gr->gr_gid;
+    return static_cast<gid_t>(std::stoul(gid));
 }
 
 // Return true if user is member of admin_group.
@@ -82,36 +200,33 @@ bool user_is_member(const std::string& user,
                     const std::string& admin_group)
 {
     const gid_t admin_gid = group_to_gid(admin_group);
-
-    int groupcount = 0;
-    bool check_group_count = true;
-
-    if (false) {
-        // This doesn't work on OpenBSD, since only(?) Linux gives us
-        // the info we want.
-        getgrouplist(user.c_str(), gid, nullptr, &groupcount);
-    } else {
-        groupcount = max_group_count;
-        check_group_count = false;
+    if (gid == admin_gid) {
+        return true;
     }
 
-    std::vector<gid_t> groups(groupcount);
-    const int rc = getgrouplist(user.c_str(), gid, groups.data(), &groupcount);
-    if (rc < 0) {
-        throw SysError("getgrouplist()");
-    }
-    if (check_group_count) {
-        if (groupcount != rc) {
-            throw SysError("getgrouplist() returned " + std::to_string(rc) + ", want " +
-                           std::to_string(groupcount));
+    const auto key = "member:" + user + '\0' + std::to_string(admin_gid);
+    std::string member;
+    (void)lookup(key, &member, [&](std::string* ret) {
+        // Linux says how many groups there are if the buffer is too
+        // small, but e.g. OpenBSD doesn't, so just grow it until it fits.
+        std::vector<gid_t> groups;
+        for (int size = initial_group_count;; size *= 2) {
+            if (size > max_group_count) {
+                throw std::runtime_error("getgrouplist(" + user + "): too many groups");
+            }
+            groups.resize(size);
+            int count = size;
+            if (getgrouplist(user.c_str(), gid, groups.data(), &count) >= 0) {
+                groups.resize(count);
+                break;
+            }
         }
-    }
-    for (const auto& g : groups) {
-        if (g == admin_gid) {
-            return true;
-        }
-    }
-    return false;
+        const bool is_member =
+            std::find(groups.begin(), groups.end(), admin_gid) != groups.end();
+        *ret = is_member ? "1" : "0";
+        return true;
+    });
+    return member == "1";
 }
 
 [[nodiscard]] std::string make_random_filename(size_t len)
@@ -129,5 +244,18 @@ bool user_is_member(const std::string& user,
     return std::string(std::begin(data), std::end(data));
 }
 
+int poll_timeout(std::chrono::steady_clock::time_point deadline)
+{
+    if (deadline == no_deadline) {
+        return -1;
+    }
+    const auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= left.zero()) {
+        return 0;
+    }
+    const auto ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(left).count() + 1;
+    return static_cast<int>(std::min<decltype(ms)>(ms, INT_MAX));
+}
 
 } // namespace Sim
@@ -14,6 +14,7 @@
  *    See the License for the specific language governing permissions and
  *    limitations under the License.
  */
+#include <chrono>
 #include <functional>
 #include <stdexcept>
 #include <string>
@@ -62,13 +63,75 @@ private:
     const uid_t old_euid_;
 };
 
+// Thrown by FileLock when another process still holds the lock at the
+// deadline.
+class LockBusy : public std::runtime_error
+{
+public:
+    explicit LockBusy(const std::string& what)
+        : std::runtime_error(what + " is locked by another process")
+    {
+    }
+};
+
+// flock() for the lifetime of the object.
+class FileLock
+{
+public:
+    FileLock(int fd, int op);
+
+    // Give up at `deadline`, throwing LockBusy naming `what`. A
+    // deadline in the past means trying once.
+    FileLock(int fd,
+             int op,
+             std::chrono::steady_clock::time_point deadline,
+             const std::string& what);
+    ~FileLock();
+
+    // No copy or move.
+    FileLock(const FileLock&) = delete;
+    FileLock(FileLock&&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+    FileLock& operator=(FileLock&&) = delete;
+
+private:
+    const int fd_;
+};
+
 class SysError : public std::runtime_error
 {
 public:
     explicit SysError(const std::string& s);
+
+    // errno at the time of the error.
+    [[nodiscard]] int err() const noexcept { return err_; }
+
+private:
+    int err_;
 };
 
 constexpr const char* config_file = "/etc/sim.conf";
+
+// Cache for the user and group lookups below. See identity.h.
+class LookupCache
+{
+public:
+    virtual ~LookupCache() = default;
+
+    // Return true if `key` is cached. `found` is then set to whether
+    // the lookup found anything, and if so `value` to what.
+    [[nodiscard]] virtual bool
+    get(const std::string& key, bool* found, std::string* value) = 0;
+    virtual void put(const std::string& key, bool found, const std::string& value) = 0;
+};
+
+// Use `cache` for lookups, or nothing if null.
+void set_lookup_cache(LookupCache* cache);
+
+// Call `f`, if set, with the time taken by each lookup that the cache
+// didn't answer.
+void set_lookup_timer(std::function<void(std::chrono::nanoseconds)> f);
+
 [[nodiscard]] std::string uid_to_username(uid_t uid);
 [[nodiscard]] gid_t group_to_gid(const std::string& group);
 
@@ -79,5 +142,13 @@ user_is_member(const std::string& user, gid_t gid, const std::string& admin_grou
 
 [[nodiscard]] std::string make_random_filename(size_t len);
 
+// No deadline.
+constexpr auto no_deadline = std::chrono::steady_clock::time_point::max();
+
+// Time left until `deadline` as a poll() timeout: -1 if there is no
+// deadline, and 0 once it has passed. Rounded up, but at most INT_MAX
+// milliseconds, so poll() can return before a far away deadline.
+[[nodiscard]] int poll_timeout(std::chrono::steady_clock::time_point deadline);
+
 
 } // namespace Sim
@@ -1,6 +1,10 @@
 #include "util.h"
 
 #include<cassert>
+#include<map>
+#include<stdexcept>
+#include<string>
+#include<utility>
 
 int main()
 {
@@ -24,4 +28,44 @@ int main()
   assert("root" == uid_to_username(0));
   assert(0 == group_to_gid("root"));
   assert(user_is_member("root", 0, "root"));
+
+  // Lookups go through the cache, if any.
+  {
+    struct FakeCache : public LookupCache {
+      std::map<std::string, std::pair<bool, std::string>> entries;
+      bool get(const std::string& key, bool* found, std::string* value) override
+      {
+        const auto e = entries.find(key);
+        if (e == entries.end()) {
+          return false;
+        }
+        *found = e->second.first;
+        *value = e->second.second;
+        return true;
+      }
+      void put(const std::string& key, bool found, const std::string& value) override
+      {
+        entries[key] = { found, value };
+      }
+    } cache;
+    set_lookup_cache(&cache);
+
+    assert("root" == uid_to_username(0));
+    assert(cache.entries.count("uid:0"));
+    cache.entries["uid:0"] = { true, "cached-root" };
+    assert("cached-root" == uid_to_username(0));
+
+    // Negative entries.
+    cache.entries["group:cached-missing"] = { false, "" };
+    bool threw = false;
+    try {
+      (void)group_to_gid("cached-missing");
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+
+    set_lookup_cache(nullptr);
+    assert("root" == uid_to_username(0));
+  }
 }